@@ -0,0 +1,230 @@
+#ifndef KERNEL_MEMORY_BUDDYREGION_H
+#define KERNEL_MEMORY_BUDDYREGION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Memory/PhysicalAllocator.h>
+#include <Runtime/Spinlock.h>
+
+namespace Kernel {
+namespace Vm {
+class Map;
+class MapEntry;
+}
+}
+
+namespace Kernel::Memory {
+class Pool;
+
+/**
+ * @brief Contiguous segment of physical memory, managed by a buddy allocator
+ *
+ * This is an alternative to the bitmap based Region, with the same interface towards the pool.
+ * Memory in the region is managed as blocks of power of two pages (the block's order), which are
+ * naturally aligned in physical memory. For each order, a list of free blocks is kept; allocating
+ * a block splits a larger free block as needed, and freeing a block merges it with its buddy (the
+ * other half of the next larger block) for as long as the buddy is free as well. Both operations
+ * take time proportional to the number of orders, rather than the size of the region.
+ *
+ * Some pages at the start of the region are reserved to hold an information structure for each
+ * page. Only the entry for the first page of each block (its head) is meaningful: it holds the
+ * block's order and state, as well as the links for the free lists. The lists are linked by page
+ * index, so the free pages themselves are never accessed.
+ *
+ * Allocated blocks may be freed partially: the block is split in halves until the pages to free
+ * are covered by whole blocks.
+ *
+ * Since the free lists can't easily be updated atomically, all operations on the region are
+ * serialized by a spin lock.
+ *
+ * A region may span holes in physical memory, as long as the page information array fits in front
+ * of the first hole; the pages in the holes are reserved right after the region is created.
+ */
+class BuddyRegion {
+    friend class Pool;
+
+    public:
+        /**
+         * @brief Largest supported block order
+         *
+         * Blocks may contain at most 2^kMaxOrder pages; for 4K pages, this is 4G.
+         */
+        constexpr static const size_t kMaxOrder{20};
+
+        static size_t GetMetadataSize(const PhysicalAllocator *allocator, const size_t length);
+
+    protected:
+        BuddyRegion(Pool *pool, const uintptr_t base, const size_t length);
+        ~BuddyRegion();
+
+        int alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs);
+        int free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs);
+
+        int allocContiguous(Pool *pool, const size_t numPages, const size_t alignLog2,
+                uintptr_t &outBase);
+        int freeContiguous(Pool *pool, const uintptr_t base, const size_t numPages);
+
+        int allocLarge(Pool *pool, const size_t sizeIdx, uintptr_t &outAddr);
+        int freeLarge(Pool *pool, const size_t sizeIdx, const uintptr_t addr);
+
+        size_t reserve(Pool *pool, const uintptr_t base, const size_t length);
+        size_t unreserve(Pool *pool, const uintptr_t base, const size_t length);
+
+        size_t applyVirtualMap(uintptr_t base, Vm::Map *map);
+
+        size_t getLargestFreeRun() const;
+        bool getFreeRuns(size_t &outLargest, size_t *outCounts, const size_t numBuckets) const;
+        size_t getFreeLargePages(const size_t sizeIdx) const;
+
+        /// Get search statistics; the buddy allocator never scans for free pages, so these are 0
+        inline void getScanStats(size_t &outAllocs, size_t &outWords) const {
+            outAllocs = outWords = 0;
+        }
+
+        /// Get the physical address of the first allocatable page in the region
+        constexpr inline uintptr_t getAllocBase() const {
+            return this->allocBasePhys;
+        }
+        /// Get the physical address past the last allocatable page in the region
+        constexpr inline uintptr_t getAllocEnd() const {
+            return this->allocEndPhys;
+        }
+        /// Get the number of allocatable pages in the region
+        constexpr inline size_t getTotalPages() const {
+            return this->totalPages - this->numReserved;
+        }
+        /// Get the number of allocated pages in the region
+        constexpr inline size_t getAllocatedPages() const {
+            return this->numAllocated - this->numReserved;
+        }
+        /// Get the number of large frames of the given size in the region
+        constexpr inline size_t getTotalLargePages(const size_t sizeIdx) const {
+            return this->largeFrames[sizeIdx];
+        }
+        /// Get the number of large frames of the given size allocated as large pages
+        constexpr inline size_t getAllocatedLargePages(const size_t sizeIdx) const {
+            return this->largeAllocated[sizeIdx];
+        }
+
+        /**
+         * @brief Test if the given physical page address is contained in this region.
+         *
+         * Only the allocatable part of the region is considered.
+         *
+         * @param address Physical address to test
+         *
+         * @return Whether the address is inside this region.
+         */
+        constexpr inline bool contains(const uintptr_t address) const {
+            return (address >= this->allocBasePhys) && (address < this->allocEndPhys);
+        }
+
+    private:
+        /// Page index used to terminate free lists
+        constexpr static const uint32_t kNone{0xFFFFFFFF};
+
+        /// Flags for a page's information structure
+        enum PageFlags: uint8_t {
+            /// Page is the head of a free block
+            kFlagFree                           = (1 << 0),
+            /// Page is the head of an allocated block
+            kFlagAllocated                      = (1 << 1),
+        };
+
+        /**
+         * @brief Information about a single page
+         *
+         * This is only meaningful for the first page of a block; for all other pages, the flags
+         * are cleared.
+         */
+        struct PageInfo {
+            /// Index of the next free block of the same order
+            uint32_t next;
+            /// Index of the previous free block of the same order
+            uint32_t prev;
+            /// Order of the block
+            uint8_t order;
+            /// Block state (a combination of PageFlags)
+            uint8_t flags;
+        };
+
+    private:
+        void setMetadataBase(void *base);
+
+        bool allocBlock(const size_t order, size_t &outPage);
+        void freeBlock(size_t page, size_t order);
+        size_t freeRun(const size_t start, const size_t count);
+        bool findBlock(const size_t page, size_t &outHead) const;
+        void splitAllocated(const size_t head);
+
+        void pushFree(const size_t page, const size_t order);
+        void removeFree(const size_t page, const size_t order);
+
+    private:
+        /// Protects the free lists and page information
+        mutable Runtime::Spinlock lock;
+
+        /// Physical base address of the region
+        uintptr_t physBase;
+
+        /**
+         * Total number of pages in this region
+         *
+         * @remark This does not equal the total number of allocatable pages; some of these pages
+         *         will be reserved for metadata.
+         */
+        size_t numPages;
+
+        /// Physical address of the page information array
+        uintptr_t metadataPhys;
+        /// Bytes reserved for the page information array (a multiple of the page size)
+        size_t metadataReserved;
+
+        /// Page information array, indexed by page number relative to the allocatable base
+        PageInfo *info{nullptr};
+
+        /// Virtual memory object (in the kernel map) for the page information array
+        Vm::MapEntry *metadataVm{nullptr};
+
+        /// Physical address of the first allocatable page
+        uintptr_t allocBasePhys;
+        /// Physical address one past the last allocatable page
+        uintptr_t allocEndPhys;
+
+        /**
+         * Page frame number of the first allocatable page
+         *
+         * Blocks are aligned in terms of page frame numbers, so that they are naturally aligned
+         * in physical memory.
+         */
+        size_t pfnBase;
+
+        /// Number of allocatable pages
+        size_t totalPages;
+        /// Number of allocated pages, including reserved pages
+        size_t numAllocated{0};
+        /// Number of pages permanently reserved by reserve()
+        size_t numReserved{0};
+
+        /// Index of the first free block of each order
+        uint32_t freeHeads[kMaxOrder + 1];
+        /// Number of free blocks of each order
+        size_t freeCounts[kMaxOrder + 1];
+        /// Bitmap of orders whose free lists are not empty
+        uint32_t freeOrders{0};
+
+        /// Number of extra page sizes tracked
+        size_t numLargeSizes{0};
+        /// Order of each of the allocator's extra page sizes
+        uint8_t largeOrders[PhysicalAllocator::kMaxExtraSizes];
+        /// Number of naturally aligned frames of each extra page size inside the region
+        size_t largeFrames[PhysicalAllocator::kMaxExtraSizes];
+        /// Number of frames of each extra page size allocated as large pages
+        size_t largeAllocated[PhysicalAllocator::kMaxExtraSizes];
+
+        static_assert(kMaxOrder < 32, "free order bitmap too small");
+};
+}
+
+#endif
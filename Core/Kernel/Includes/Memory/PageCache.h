@@ -0,0 +1,108 @@
+#ifndef KERNEL_MEMORY_PAGECACHE_H
+#define KERNEL_MEMORY_PAGECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Kernel {
+class PhysicalAllocator;
+}
+
+namespace Kernel::Memory {
+class Pool;
+
+/**
+ * @brief Per processor cache of free physical pages
+ *
+ * Each processor holds a small stack (a "magazine") of free physical pages, which it can hand out
+ * and take back without touching the pool's region bitmaps. When the magazine runs dry, it is
+ * refilled with a batch of pages from its pool; likewise, when it overflows, a batch of pages is
+ * returned to the pool.
+ *
+ * @remark Pages sitting in a cache are considered allocated as far as the pool is concerned.
+ *
+ * @remark The cache is only ever accessed by its owning processor, so it is not locked. It must
+ *         not be used from interrupt context.
+ */
+class PageCache {
+    friend class Kernel::PhysicalAllocator;
+
+    public:
+        /// Maximum number of pages held by a single cache
+        constexpr static const size_t kCapacity{64};
+
+        /**
+         * @brief Number of pages transferred between the cache and its pool at once
+         *
+         * Requests for more than this many pages are satisfied directly from the pool, once any
+         * pages in the cache have been used up.
+         */
+        constexpr static const size_t kBatchSize{kCapacity / 2};
+
+        /**
+         * @brief Cache performance counters
+         */
+        struct Stats {
+            /// Allocation requests satisfied entirely from the cache
+            size_t hits{0};
+            /// Allocation requests that had to go to the pool
+            size_t misses{0};
+            /// Number of batches of pages taken from the pool
+            size_t refills{0};
+            /// Number of batches of pages returned to the pool
+            size_t drains{0};
+        };
+
+    public:
+        int alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs);
+        int free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs);
+        void flush(Pool *pool);
+
+        /// Get the cache's performance counters
+        constexpr inline const Stats &getStats() const {
+            return this->stats;
+        }
+        /// Get the number of pages currently held in the cache
+        constexpr inline size_t getNumCached() const {
+            return this->numCached;
+        }
+
+    private:
+        int refill(Pool *pool);
+        void drain(Pool *pool, const size_t numPages);
+
+    private:
+        /**
+         * @brief Index of the pool whose pages are cached
+         *
+         * Only allocations from this pool are serviced by the cache; requests for any other pool
+         * go straight to that pool.
+         */
+        size_t pool{0};
+
+        /// Number of pages in the cache
+        size_t numCached{0};
+
+        /**
+         * @brief Physical addresses of cached pages
+         *
+         * This is used as a stack: the most recently freed pages (most likely to still be in the
+         * processor's caches) are handed out first, while the oldest entries are drained back to
+         * the pool first.
+         */
+        uintptr_t pages[kCapacity];
+
+        /// Performance counters
+        Stats stats;
+
+        /**
+         * @brief Set while the cache is being modified
+         *
+         * Memory pressure handlers may be invoked from within a cache operation; while this is
+         * set, any allocations or frees they make bypass the cache.
+         */
+        bool busy{false};
+};
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef KERNEL_MEMORY_PAGEFRAMEDB_H
+#define KERNEL_MEMORY_PAGEFRAMEDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <platform/KernelMemoryMap.h>
+#include <platform/PageTable.h>
+
+namespace Kernel::Vm {
+class Map;
+}
+
+namespace Kernel::Memory {
+/**
+ * @brief Information about a single physical page frame
+ *
+ * Four of these fit in a cache line. All fields may be modified concurrently, so they should only
+ * be accessed through the atomic helpers in PageFrameDb.
+ */
+struct PageFrame {
+    /// State flags
+    enum Flags: uint16_t {
+        /// The page may not be moved or reclaimed (for example, because a device accesses it)
+        kPinned                                 = (1 << 0),
+        /// The page is shared, and must be copied before it's written to
+        kCopyOnWrite                            = (1 << 1),
+        /// The page has been written to since it was last cleaned
+        kDirty                                  = (1 << 2),
+        /// First frame of a large page; the order field is valid
+        kLargePage                              = (1 << 3),
+    };
+
+    /// Types of page owners; this determines the meaning of the `data` field
+    enum class Owner: uint8_t {
+        /// Not allocated, or the owner is unknown
+        None                                    = 0,
+        /// General kernel use
+        Kernel                                  = 1,
+        /// Page table; `data` is the virtual address it maps
+        PageTable                               = 2,
+        /// Backs a VM object; `data` is a pointer to the object
+        VmObject                                = 3,
+        /// Backs a kernel heap or zone allocation; `data` is the virtual address of the page
+        Heap                                    = 4,
+    };
+
+    /// Number of references to the page; it's 1 right after allocation
+    uint32_t refCount;
+    /// State flags (a combination of `Flags`)
+    uint16_t flags;
+    /// Owner of the page
+    Owner owner;
+    /// For large pages, the base 2 logarithm of the number of frames in the page
+    uint8_t order;
+    /// Owner specific data, usually used for reverse lookups
+    uint64_t data;
+};
+static_assert(sizeof(PageFrame) == 16, "page frames must be 16 bytes");
+
+/**
+ * @brief Page frame database
+ *
+ * Holds a PageFrame for each page of physical memory managed by the physical allocator. The
+ * entries form a single array indexed by page frame number, in a dedicated part of the kernel's
+ * address space; looking up a page is just an index into it.
+ *
+ * Only the parts of the array that cover allocatable memory are backed by memory, in sections of
+ * `kSectionSize` bytes of physical memory. The backing pages are allocated from the physical
+ * allocator when a region is mapped into the kernel's address space.
+ *
+ * The physical allocator initializes a page's entry when it's allocated (with a reference count
+ * of 1) and clears it when freed. For contiguous allocations, each page gets its own entry; for
+ * large pages, only the first frame's entry is initialized, and its order is set.
+ *
+ * @remark The database only becomes available when Enable() is called, once the kernel's address
+ *         space is active. Pages allocated before that have no reference count.
+ */
+class PageFrameDb {
+    public:
+        /**
+         * Amount of physical memory covered by each section of the database
+         *
+         * This is the granularity at which the array is backed with memory.
+         */
+        constexpr static const size_t kSectionSize{0x1000000};
+
+        PageFrameDb() = delete;
+
+        static void AddRange(Vm::Map *map, const uintptr_t base, const size_t length);
+        static void Enable();
+
+        /**
+         * @brief Get the entry for a physical page.
+         *
+         * @param phys Physical address of the page (need not be page aligned)
+         *
+         * @return Entry for the page, or `nullptr` if the database isn't available or the page
+         *         isn't managed by the physical allocator
+         */
+        static inline PageFrame *Get(const uintptr_t phys) {
+            const auto section = phys / kSectionSize;
+            if(!gEnabled || section >= kMaxSections ||
+                    !(gSections[section / 64] & (1ULL << (section % 64)))) {
+                return nullptr;
+            }
+
+            return reinterpret_cast<PageFrame *>(Platform::KernelAddressLayout::PageFrameDbStart) +
+                (phys >> kFrameShift);
+        }
+
+        /**
+         * @brief Add a reference to a page.
+         *
+         * @return New reference count
+         */
+        static inline uint32_t Retain(PageFrame *frame) {
+            return __atomic_add_fetch(&frame->refCount, 1, __ATOMIC_RELAXED);
+        }
+        /**
+         * @brief Drop a reference to a page.
+         *
+         * The caller is responsible for freeing the page once the last reference is dropped.
+         *
+         * @return Remaining reference count
+         */
+        static inline uint32_t Release(PageFrame *frame) {
+            return __atomic_sub_fetch(&frame->refCount, 1, __ATOMIC_ACQ_REL);
+        }
+
+        /// Set the given flags on a page
+        static inline void SetFlags(PageFrame *frame, const uint16_t flags) {
+            __atomic_or_fetch(&frame->flags, flags, __ATOMIC_RELAXED);
+        }
+        /// Clear the given flags of a page
+        static inline void ClearFlags(PageFrame *frame, const uint16_t flags) {
+            __atomic_and_fetch(&frame->flags, static_cast<uint16_t>(~flags), __ATOMIC_RELAXED);
+        }
+        /// Read the flags of a page
+        static inline uint16_t GetFlags(const PageFrame *frame) {
+            return __atomic_load_n(&frame->flags, __ATOMIC_RELAXED);
+        }
+
+        /// Record the owner of a page
+        static inline void SetOwner(PageFrame *frame, const PageFrame::Owner owner,
+                const uint64_t data = 0) {
+            __atomic_store_n(&frame->data, data, __ATOMIC_RELAXED);
+            __atomic_store_n(reinterpret_cast<uint8_t *>(&frame->owner),
+                    static_cast<uint8_t>(owner), __ATOMIC_RELEASE);
+        }
+
+        static void InitFrames(const uintptr_t *addrs, const size_t num);
+        static void InitContiguous(const uintptr_t base, const size_t num);
+        static void InitLarge(const uintptr_t base, const uint8_t order);
+        static void ClearFrames(const uintptr_t *addrs, const size_t num);
+        static void ClearContiguous(const uintptr_t base, const size_t num);
+
+    private:
+        /// Base 2 logarithm of the page size
+        constexpr static const size_t kFrameShift{
+            static_cast<size_t>(__builtin_ctzll(Platform::PageTable::PageSize()))};
+        /// Maximum number of sections (limited by the size of the virtual address range)
+        constexpr static const size_t kMaxSections{
+            ((Platform::KernelAddressLayout::PageFrameDbEnd -
+              Platform::KernelAddressLayout::PageFrameDbStart + 1) / sizeof(PageFrame)) /
+            (kSectionSize >> kFrameShift)};
+        /// Bytes of the array covering a single section
+        constexpr static const size_t kSectionBytes{(kSectionSize >> kFrameShift) *
+            sizeof(PageFrame)};
+        static_assert(!(kSectionBytes % Platform::PageTable::PageSize()),
+                "sections must cover whole pages of the database");
+
+        static void MapSections(Vm::Map *map, const size_t first, const size_t last);
+
+    private:
+        /// Set once the database may be accessed
+        static bool gEnabled;
+        /// Bitmap of sections whose part of the array is backed by memory
+        static uint64_t gSections[(kMaxSections + 63) / 64];
+};
+}
+
+#endif
@@ -6,6 +6,7 @@
 
 namespace Kernel {
 namespace Memory {
+class PageCache;
 class Pool;
 }
 namespace Vm {
@@ -19,36 +20,130 @@ class Map;
  * Inside each pool can be one or more regions, which are contiguous physical memory sections from
  * which physical pages are allocated.
  *
- * @remark Currently, all kernel requests are satisfied from the default pool. Any additional pools
- *         initialized by the platform code are not used.
+ * On NUMA systems, the platform code creates one pool per memory node, and informs the allocator
+ * of the relative distances between them. Unless a particular pool is requested, allocations are
+ * satisfied from the calling processor's local pool first, falling back to the other pools in order
+ * of increasing distance.
  *
  * @remark All initialization must take place before any additional processors are started. That is
- *         to say, it is not threadsafe.
+ *         to say, it is not threadsafe. Once initialized, pages may be allocated and freed from any
+ *         number of processors at the same time.
+ *
+ * Besides pages of the standard size, naturally aligned pages of any of the extra page sizes
+ * specified at initialization time can be allocated. These are carved out of the same regions.
+ *
+ * Each pool also keeps a small stash of pages that have been zeroed ahead of time, for example when
+ * the system is idle, by calling ZeroFreePages(). Allocations that request zeroed pages take from
+ * this stash first, and zero any remaining pages inline. While the stash has room, freed pages are
+ * kept on a dirty list, and are the first to be zeroed.
+ *
+ * Once per processor caches are enabled, most allocations and frees of the local pool are
+ * satisfied from the calling processor's page cache, which in turn exchanges pages with the pool
+ * in batches.
+ *
+ * The platform may also designate one pool as the DMA pool, holding memory that is reachable by
+ * devices with limited addressing capabilities (such as legacy ISA DMA.) It is never used for
+ * allocations from the local pool; it must be requested explicitly.
+ *
+ * Each pool has three watermarks (min, low and high) that describe how much free memory it should
+ * have. When the number of free pages drops below the low or min watermark, or rises back above
+ * the high watermark, the pool's memory pressure level changes, and all registered pressure
+ * handlers are invoked; subsystems holding on to memory they don't strictly need (such as caches)
+ * can use this to give it back before the pool actually runs out.
  */
 class PhysicalAllocator {
+    friend class Memory::Pool;
+
     public:
         /// Maximum extra page sizes supported
         constexpr const static size_t kMaxExtraSizes{4};
         /// Maximum number of memory pools, including the default pool, to support
-        constexpr const static size_t kMaxPools{4};
+        constexpr const static size_t kMaxPools{8};
+
+        /**
+         * @brief Pool index to request the calling processor's local pool
+         *
+         * Allocations made with this pool index are satisfied from the local pool if possible,
+         * then from the remaining pools in order of their distance. Pages freed with this pool
+         * index are returned to whichever pool they belong to.
+         */
+        constexpr const static size_t kLocalPool{~0ULL};
+
+        /**
+         * @brief Occasions at which allocator statistics are written to the console
+         *
+         * These may be combined; see SetStatsDump().
+         */
+        enum StatsDump: uint8_t {
+            /// Once the kernel has finished initializing
+            kStatsDumpBoot                      = (1 << 0),
+            /// When the kernel panics
+            kStatsDumpPanic                     = (1 << 1),
+        };
+
+        /// Maximum number of memory pressure handlers that may be registered
+        constexpr const static size_t kMaxPressureHandlers{16};
+
+        /**
+         * @brief Memory pressure levels of a pool
+         *
+         * The level rises as soon as the pool's free pages drop below a watermark, but only drops
+         * back to `kPressureNone` once free pages rise above the high watermark.
+         */
+        enum Pressure: uint8_t {
+            /// There is plenty of free memory
+            kPressureNone                       = 0,
+            /// Free memory is below the low watermark; caches should start shrinking
+            kPressureLow                        = 1,
+            /// Free memory is below the min watermark; release everything that can be released
+            kPressureMin                        = 2,
+        };
+
+        /**
+         * @brief Function invoked when the memory pressure level of a pool changes
+         *
+         * Handlers are invoked synchronously by whichever allocation or free caused the level to
+         * change, so they may be called with locks held and from any processor; they must not
+         * block. A handler may free memory, but must not allocate any. The same level may be
+         * reported more than once.
+         *
+         * @param pool Index of the pool whose pressure level changed
+         * @param level New pressure level of the pool
+         * @param context Context pointer passed at registration time
+         */
+        using PressureHandler = void (*)(const size_t pool, const Pressure level, void *context);
+
+        /// A range of physical memory inside a region that is never allocated
+        struct ReservedRange {
+            /// Physical base address of the range (page aligned)
+            uintptr_t base;
+            /// Length of the range, in bytes (page aligned)
+            size_t length;
+        };
 
     public:
         static void Init(const size_t pageSz, const size_t extraSizes[],
                 const size_t numExtraSizes, const size_t numBonusPools = 0);
-        static void AddRegion(const uintptr_t base, const size_t length, const size_t pool = 0);
+        static void AddRegion(const uintptr_t base, const size_t length, const size_t pool = 0,
+                const ReservedRange *reserved = nullptr, const size_t numReserved = 0);
+        static void ReserveRange(const uintptr_t base, const size_t length, const size_t pool = 0);
+        static size_t UnreserveRange(const uintptr_t base, const size_t length,
+                const size_t pool = 0);
+        static size_t GetRegionOverhead(const size_t length);
 
         /**
          * @brief Allocate a single page
          *
          * @param outPageAddress Output of the physical address of the page
+         * @param zeroed Whether the contents of the page must be zeroed
          *
          * @return 1 if the page was successfully allocated
          */
-        static inline int AllocatePage(uintptr_t &outPageAddress) {
-            return AllocatePages(1, &outPageAddress);
+        static inline int AllocatePage(uintptr_t &outPageAddress, const bool zeroed = false) {
+            return AllocatePages(1, &outPageAddress, kLocalPool, zeroed);
         }
         static int AllocatePages(const size_t numPages, uintptr_t *outPageAddrs,
-                const size_t pool = 0);
+                const size_t pool = kLocalPool, const bool zeroed = false);
         /**
          * @brief Free a single page
          *
@@ -60,26 +155,149 @@ class PhysicalAllocator {
             return FreePages(1, &pageAddress);
         }
         static int FreePages(const size_t numPages, const uintptr_t *inPageAddrs,
-                const size_t pool = 0);
+                const size_t pool = kLocalPool);
+
+        static int AllocateContiguous(const size_t numPages, const size_t alignLog2,
+                uintptr_t &outBase, const size_t pool = kLocalPool);
+        static int FreeContiguous(const uintptr_t base, const size_t numPages,
+                const size_t pool = kLocalPool);
+
+        static int AllocateLargePage(const size_t pageSize, uintptr_t &outPageAddress,
+                const size_t pool = kLocalPool);
+        static int FreeLargePage(const uintptr_t pageAddress, const size_t pageSize,
+                const size_t pool = kLocalPool);
 
         static size_t GetTotalPages(const size_t pool = 0);
         static size_t GetAllocPages(const size_t pool = 0);
+        static size_t GetLargestFreeRun(const size_t pool = 0);
+        static void GetScanStats(size_t &outAllocs, size_t &outWords, const size_t pool = 0);
+        static size_t GetZeroedPages(const size_t pool = 0);
+
+        static void DumpStats();
+        static void DumpStats(const StatsDump reason);
+
+        static void SetWatermarks(const size_t pool, const size_t min, const size_t low,
+                const size_t high);
+        static void GetWatermarks(const size_t pool, size_t &outMin, size_t &outLow,
+                size_t &outHigh);
+        static Pressure GetPressure(const size_t pool = 0);
+        static size_t GetFreePages(const size_t pool = 0);
+        static int AddPressureHandler(PressureHandler handler, void *context = nullptr);
+        static int RemovePressureHandler(PressureHandler handler, void *context = nullptr);
+
+        /**
+         * @brief Select when statistics are dumped to the console
+         *
+         * This may be called before the allocator is initialized, for example while parsing the
+         * kernel command line.
+         *
+         * @param when Combination of StatsDump flags
+         */
+        static inline void SetStatsDump(const uint8_t when) {
+            gStatsDump = when;
+        }
+        /// Whether statistics should be dumped for the given occasion
+        static inline bool WantsStatsDump(const StatsDump reason) {
+            return gStatsDump & reason;
+        }
+
+        static size_t ZeroFreePages(const size_t budget);
+
+        static size_t GetTotalLargePages(const size_t pageSize, const size_t pool = 0);
+        static size_t GetFreeLargePages(const size_t pageSize, const size_t pool = 0);
+        static size_t GetAllocLargePages(const size_t pageSize, const size_t pool = 0);
 
         static void RemapTo(Kernel::Vm::Map *map);
 
+        static void SetPoolDistances(const uint8_t *distances, const size_t numPools);
+        static void SetLocalPool(const size_t pool);
+        static size_t GetLocalPool();
+        static size_t GetNumPools();
+        static void SetDmaPool(const size_t pool);
+        static size_t GetDmaPool();
+        static uint32_t GetCpuId();
+
+        static void EnableCpuCaches();
+        static void FlushCpuCache();
+        static bool GetCpuCacheStats(size_t &outHits, size_t &outMisses);
+
         /// Get the primary page size of the physical allocator
         constexpr inline auto getPageSize() const {
             return this->pageSz;
         }
+        /// Get the number of extra page sizes supported
+        constexpr inline auto getNumExtraPageSizes() const {
+            return this->numExtraPageSizes;
+        }
+        /// Get an extra page size, as a power of two multiple of the primary page size
+        constexpr inline auto getExtraPageSizeLog2(const size_t idx) const {
+            return this->extraPageSizes[idx];
+        }
+
+    private:
+        /// Number of pool ranges that can be added before virtual memory is available
+        constexpr const static size_t kInitialPoolRanges{kMaxPools * 16};
+        /// Maximum number of pages handed to a pool at once when freeing to the local pool
+        constexpr const static size_t kFreeBatchSize{64};
+
+        /// Range of physical memory covered by a region that was added to a pool
+        struct PoolRange {
+            /// Physical address of the first byte of the range
+            uintptr_t base;
+            /// Physical address of the byte past the end of the range
+            uintptr_t end;
+            /// Index of the pool the range belongs to
+            size_t pool;
+        };
+
+        /**
+         * @brief Table of the ranges of physical memory covered by all pools
+         *
+         * Like the pools' region tables, this is only modified in place before virtual memory is
+         * available: afterwards, adding a range creates an updated copy of the table, which then
+         * replaces the old one. This way, pages can be mapped to their pool without locking.
+         */
+        struct PoolRangeTable {
+            /// Number of ranges the table has room for
+            size_t capacity;
+            /// Number of valid ranges
+            size_t numRanges;
+            /// Ranges, sorted by their base address
+            PoolRange *ranges;
+        };
 
     private:
         PhysicalAllocator(const size_t pageSz, const size_t extraSizes[],
                 const size_t numExtraSizes, const size_t numBonusPools);
 
+    private:
+        static Memory::PageCache *GetCpuCache(const size_t pool);
+
+        static int AllocateFrom(const size_t pool, const size_t numPages, uintptr_t *outPageAddrs,
+                const bool zeroed);
+        static int FreeTo(const size_t pool, const size_t numPages, const uintptr_t *inPageAddrs);
+        static size_t FindPool(const uintptr_t address);
+        static void AddPoolRange(const uintptr_t base, const size_t length, const size_t pool);
+        static void NotifyPressure(const size_t pool, const Pressure level);
+        static void DrainCpuCache(const size_t pool, const Pressure level, void *);
+
+        int getExtraPageSizeIndex(const size_t pageSize) const;
+
     private:
         /// Globally shared instance of the physical allocator
         static PhysicalAllocator *gShared;
 
+        /**
+         * @brief Whether per processor page caches are used
+         *
+         * Set once processor local storage is available for all processors, since the caches
+         * are located there.
+         */
+        static bool gCpuCachesEnabled;
+
+        /// Occasions at which statistics are dumped (a combination of StatsDump flags)
+        static uint8_t gStatsDump;
+
         /**
          * Size of a single page, in bytes
          *
@@ -97,6 +315,8 @@ class PhysicalAllocator {
          * @remark Contents of this array should be sorted in ascending order.
          */
         uint8_t extraPageSizes[kMaxExtraSizes];
+        /// Number of valid entries in the extra page sizes array
+        size_t numExtraPageSizes{0};
 
         /**
          * Memory pools to allocate from
@@ -105,6 +325,28 @@ class PhysicalAllocator {
          * most kernel allocations are satisfied, unless otherwise requested.
          */
         Memory::Pool *pools[kMaxPools];
+        /// Number of pools that have been initialized
+        size_t numPools{0};
+        /// Number of pools (at the start of each fallback list) tried for local allocations
+        size_t numFallbackPools{0};
+        /// Index of the DMA pool, or `kLocalPool` if there is none
+        size_t dmaPool{kLocalPool};
+
+        /**
+         * Pool fallback order
+         *
+         * For each pool, this contains the indices of all pools (starting with the pool itself)
+         * in order of increasing distance from it. Allocations for the local pool try the pools
+         * in this order. The DMA pool, if any, is always last, and is not tried.
+         */
+        uint8_t fallback[kMaxPools][kMaxPools];
+
+        /// Ranges of physical memory covered by each pool, used to find the pool a page is in
+        PoolRangeTable *poolRanges{&this->initialPoolRanges};
+        /// Range table used until virtual memory is available
+        PoolRangeTable initialPoolRanges{kInitialPoolRanges, 0, this->initialPoolRangeBuf};
+        /// Storage for the initial range table
+        PoolRange initialPoolRangeBuf[kInitialPoolRanges];
 
         static_assert(kMaxExtraSizes >= 1, "invalid max extra page sizes");
         static_assert(kMaxPools >= 1, "invalid max pools size");
@@ -4,69 +4,337 @@
 #include <stddef.h>
 #include <stdint.h>
 
-namespace Kernel {
-class PhysicalAllocator;
-namespace Vm {
+#include <Memory/PhysicalAllocator.h>
+#include <Runtime/Spinlock.h>
+
+/**
+ * @brief Physical allocator engine selection
+ *
+ * When set, regions are managed by a buddy allocator (BuddyRegion) rather than a bitmap of pages
+ * (Region.) This is normally set by the build system.
+ */
+#ifndef KERNEL_PHYSALLOC_BUDDY
+#define KERNEL_PHYSALLOC_BUDDY 0
+#endif
+
+namespace Kernel::Vm {
 class Map;
 }
-}
 
 /// Physical allocator internals
 namespace Kernel::Memory {
+class BuddyRegion;
 class Region;
 
 /**
  * @brief Collection of allocatable physical regions
  *
  * Pools satisfy allocations from one or more of its regions, which are just contiguous sections of
- * physical memory space in the system.
+ * physical memory space in the system. Allocations start at the lowest region that may still have
+ * free pages, rather than always at the first region.
+ *
+ * How pages are managed inside a region is decided at build time: either with a bitmap (Region)
+ * or a buddy allocator (BuddyRegion.) Both expose the same interface to the pool, and may be
+ * called from multiple processors at once.
+ *
+ * There is no fixed limit on the number of regions: the pool starts out with a small, built in
+ * region table, which is replaced by larger tables allocated from the physical allocator once
+ * virtual memory is available. This allows memory to be hot added at any time.
+ *
+ * The pool keeps a running count of its free pages, which is compared against its watermarks on
+ * every allocation and free to track the pool's memory pressure level.
  */
 class Pool {
     friend class Kernel::PhysicalAllocator;
+    friend class BuddyRegion;
     friend class Region;
+    friend class PageFrameDb;
 
     public:
+        /// Region implementation used by the pool
+#if KERNEL_PHYSALLOC_BUDDY
+        using RegionType = BuddyRegion;
+#else
+        using RegionType = Region;
+#endif
+
         /**
-         * Maximum regions per pool
+         * Number of regions in the built in region table
          *
-         * This constant defines the maximum number of regions that can be associated with a single
-         * pool, and will be used to satisfy all allocations in the pool.
+         * This is the maximum number of regions a pool can have before virtual memory is
+         * available; afterwards, the table is replaced with a larger one as needed.
          */
-        constexpr static const size_t kMaxRegions{16};
+        constexpr static const size_t kInitialRegions{16};
 
         /**
-         * Maximum global regions
+         * Number of statically allocated regions
          *
          * Since the physical allocator needs to function before any other memory allocation is
-         * available, all of its structures are preallocated, including the regions. This constant
-         * defines the maximum number of regions that can be allocated globally.
+         * available, storage for the first regions (across all pools) is preallocated. Once it
+         * runs out, further regions are allocated from the physical allocator, which requires
+         * virtual memory to be available.
+         */
+        constexpr static const size_t kStaticRegions{48};
+
+        /**
+         * Maximum number of zeroed pages held by a pool
+         *
+         * Each pool keeps a stash of pages that have already been zeroed ahead of time, from
+         * which allocations that require zeroed memory are satisfied first.
+         */
+        constexpr static const size_t kZeroedCapacity{256};
+
+        /// Number of pages zeroed at a time when filling the zeroed page stash
+        constexpr static const size_t kZeroedBatchSize{32};
+
+        /**
+         * Maximum number of freed pages held on a pool's dirty list
+         *
+         * Freed pages are set aside on the dirty list while the zeroed page stash has room for
+         * them, so that refilling the stash zeroes pages that were in use anyway, rather than
+         * taking more pages out of the regions.
+         */
+        constexpr static const size_t kDirtyCapacity{64};
+
+        /**
+         * Number of addresses sorted at a time when freeing pages
+         *
+         * Sorting groups pages by region, and pages in the same bitmap word next to each other,
+         * so they can be freed together.
+         */
+        constexpr static const size_t kFreeBatchSize{64};
+
+        /**
+         * Number of buckets in the statistics histograms
+         *
+         * All histograms are logarithmic: bucket `n` counts values from `2^n` up to
+         * `2^(n+1) - 1`, with larger values counted in the last bucket.
+         */
+        constexpr static const size_t kHistogramBuckets{32};
+
+        /**
+         * Default watermarks, in 1/1024ths of the pool's total pages
+         *
+         * These are recalculated whenever the pool's size changes, until watermarks are set
+         * explicitly.
+         */
+        constexpr static const size_t kDefaultMinWatermark{4},
+                  kDefaultLowWatermark{8}, kDefaultHighWatermark{12};
+
+    private:
+        /**
+         * @brief Table of the regions in a pool
+         *
+         * Tables are never modified once virtual memory is available: adding a region creates a
+         * copy of the table with the new region, which then replaces the old table. This way,
+         * allocations can keep using the regions without taking any locks.
+         *
+         * Regions are only ever appended to the table, so their indices don't change.
          */
-        constexpr static const size_t kMaxGlobalRegions{48};
+        struct RegionTable {
+            /// Number of regions the table has room for
+            size_t capacity;
+            /// Number of valid regions
+            size_t numRegions;
+            /// Regions, in the order they were added
+            RegionType **regions;
+            /// Indices of the regions (into `regions`) sorted by their physical base address
+            uint32_t *sorted;
+        };
 
     private:
-        Pool(PhysicalAllocator *allocator) : allocator(allocator) {}
+        Pool(PhysicalAllocator *allocator, const size_t index) : allocator(allocator),
+            index(index) {
+            this->initialTable.capacity = kInitialRegions;
+            this->initialTable.regions = this->initialRegions;
+            this->initialTable.sorted = this->initialSorted;
+        }
 
-        void addRegion(const uintptr_t base, const size_t length);
+        /// Get the current region table
+        inline const RegionTable *getRegionTable() const {
+            return __atomic_load_n(&this->table, __ATOMIC_ACQUIRE);
+        }
+
+        void addRegion(const uintptr_t base, const size_t length,
+                const PhysicalAllocator::ReservedRange *reserved, const size_t numReserved);
+        void reserveRanges(RegionType *region, const PhysicalAllocator::ReservedRange *reserved,
+                const size_t numReserved);
+        static void InsertRegion(RegionTable *table, RegionType *region);
+        static RegionTable *AllocRegionTable(const size_t minCapacity);
+        static void *AllocStorage(const size_t bytes);
+
+        size_t reserve(const uintptr_t base, const size_t length);
+        size_t unreserve(const uintptr_t base, const size_t length);
         void applyVirtualMap(Vm::Map *map);
 
+        int freeToRegions(const size_t num, const uintptr_t *inAddrs);
+        size_t holdDirty(const size_t num, const uintptr_t *inAddrs, uintptr_t *outRest,
+                size_t &outNumRest);
+        void flushDirty();
+
+        void advanceRegionHint(size_t from);
+        void lowerRegionHint(const size_t index);
+
+        RegionType *findRegion(const uintptr_t address, size_t &outIndex) const;
+
+        void recordAlloc(const size_t requested, const int allocated, const uint64_t start);
+        void recordFree(const uint64_t start);
+
+        void adjustFree(const int64_t delta);
+        void updatePressure(const size_t free);
+        void notifyPressure();
+        void updateWatermarks();
+
     public:
         int alloc(const size_t num, uintptr_t *outAddrs);
         int free(const size_t num, const uintptr_t *inAddrs);
 
+        int allocContiguous(const size_t num, const size_t alignLog2, uintptr_t &outBase);
+        int freeContiguous(const uintptr_t base, const size_t num);
+
+        int allocLarge(const size_t sizeIdx, uintptr_t &outAddr);
+        int freeLarge(const size_t sizeIdx, const uintptr_t addr);
+
+        int allocZeroed(const size_t num, uintptr_t *outAddrs);
+        int allocDirty(const size_t num, uintptr_t *outAddrs);
+        int fillZeroed(const size_t budget);
+        void zeroPages(const size_t num, const uintptr_t *addrs);
+
+        bool contains(const uintptr_t address) const;
+
         size_t getTotalPages() const;
         size_t getAllocatedPages() const;
+        size_t getLargestFreeRun() const;
+        void getScanStats(size_t &outAllocs, size_t &outWords) const;
+        void dumpStats(const size_t index) const;
+
+        /// Get the number of pages in the zeroed page stash
+        inline size_t getNumZeroed() const {
+            return __atomic_load_n(&this->numZeroed, __ATOMIC_RELAXED);
+        }
+        /// Get the number of pages on the dirty list
+        inline size_t getNumDirty() const {
+            return __atomic_load_n(&this->numDirty, __ATOMIC_RELAXED);
+        }
+
+        void setWatermarks(const size_t min, const size_t low, const size_t high);
+        void getWatermarks(size_t &outMin, size_t &outLow, size_t &outHigh) const;
+
+        /// Get the number of free pages in the pool's regions
+        inline size_t getFreePages() const {
+            return __atomic_load_n(&this->numFree, __ATOMIC_RELAXED);
+        }
+        /// Get the current memory pressure level
+        inline PhysicalAllocator::Pressure getPressure() const {
+            return __atomic_load_n(&this->pressure, __ATOMIC_RELAXED);
+        }
+
+        size_t getTotalLargePages(const size_t sizeIdx) const;
+        size_t getFreeLargePages(const size_t sizeIdx) const;
+        size_t getAllocatedLargePages(const size_t sizeIdx) const;
 
     private:
         /// Physical allocator that owns this pool
         PhysicalAllocator *allocator;
+        /// Index of the pool in the physical allocator
+        size_t index;
+
+        /// Current region table; either the built in table, or one allocated later
+        RegionTable *table{&this->initialTable};
+
+        /// Built in region table, used until virtual memory is available
+        RegionTable initialTable{};
+        /// Storage for the regions in the built in table
+        RegionType *initialRegions[kInitialRegions]{};
+        /// Storage for the sorted region indices in the built in table
+        uint32_t initialSorted[kInitialRegions]{};
+
+        /**
+         * Index of the lowest region that may have free pages
+         *
+         * Allocations start searching here; it's moved past regions that run out of pages, and
+         * lowered again when pages are freed to a region below it.
+         */
+        size_t regionHint{0};
+
+        /**
+         * @brief Allocation statistics
+         *
+         * These are updated with relaxed atomic increments by alloc() and free(); latencies are
+         * measured in ticks of the platform's cycle counter.
+         */
+        struct {
+            /// Number of calls to alloc()
+            size_t allocs{0};
+            /// Number of allocations that returned some, but fewer pages than requested
+            size_t partialAllocs{0};
+            /// Number of allocations that failed, or returned no pages at all
+            size_t failedAllocs{0};
+            /// Number of calls to free()
+            size_t frees{0};
+
+            /// Number of times free memory dropped below the min watermark
+            size_t minHits{0};
+            /// Number of times free memory dropped below the low watermark
+            size_t lowHits{0};
+            /// Number of times free memory rose back above the high watermark
+            size_t highHits{0};
+
+            /// Histogram of allocation latencies
+            size_t allocLatency[kHistogramBuckets]{};
+            /// Histogram of free latencies
+            size_t freeLatency[kHistogramBuckets]{};
+        } stats;
+
+        /**
+         * Number of free pages in the pool's regions
+         *
+         * Updated by every allocation and free; pages in the zeroed page stash, on the dirty
+         * list or in the per processor caches count as allocated.
+         */
+        size_t numFree{0};
+
+        /// Watermarks, in pages
+        struct {
+            size_t min{0};
+            size_t low{0};
+            size_t high{0};
+            /// Set when the watermarks were set explicitly, rather than derived from the size
+            bool fixed{false};
+        } watermarks;
+
+        /// Current memory pressure level
+        PhysicalAllocator::Pressure pressure{PhysicalAllocator::kPressureNone};
+        /// Set while the pressure handlers are invoked for this pool
+        bool notifying{false};
+        /// Set when the pressure level changes, until the handlers have been told
+        bool notifyPending{false};
+
+        /// Protects the zeroed page stash and the dirty list
+        Runtime::Spinlock zeroedLock;
+        /// Number of pages in the zeroed page stash
+        size_t numZeroed{0};
+
+        /**
+         * Physical addresses of pages that have been zeroed
+         *
+         * These pages are allocated from the pool's regions as far as they're concerned, and
+         * are handed out to allocations that request zeroed memory. They're only used for other
+         * allocations if the pool is otherwise exhausted.
+         */
+        uintptr_t zeroed[kZeroedCapacity];
+
+        /// Number of pages on the dirty list
+        size_t numDirty{0};
 
         /**
-         * Regions belonging to the pool
+         * Physical addresses of freed pages awaiting zeroing
          *
-         * When allocating or deallocating, we'll iterate through this array until we either
-         * encounter a `nullptr` or reach `kMaxRegions`, whichever happens first.
+         * Like the zeroed pages, these are allocated as far as the regions are concerned. They
+         * are zeroed and moved to the zeroed page stash by fillZeroed(), and are returned to the
+         * regions when the pool comes under memory pressure.
          */
-        Region *regions[kMaxRegions];
+        uintptr_t dirty[kDirtyCapacity];
 };
 }
 
@@ -4,9 +4,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
-namespace Kernel {
-class PhysicalAllocator;
+#include <Memory/PhysicalAllocator.h>
 
+namespace Kernel {
 namespace Vm {
 class Map;
 class MapEntry;
@@ -23,12 +23,37 @@ class Pool;
  * indicate which pages are allocated, and which are unused. The bitmap is represented such that
  * all pages that are free are set (1) and allocated pages are cleared (0)
  *
- * @TODO Add locking
- * @TODO Per CPU caches
+ * On top of the bitmap sits a summary bitmap, which holds one bit for each 64-bit word of the
+ * page bitmap. A set bit indicates that the corresponding word has at least one free page. This
+ * allows allocations to skip directly to a word with free pages, rather than scanning over large
+ * swaths of fully allocated memory.
+ *
+ * For each of the allocator's extra (large) page sizes, the region additionally tracks all
+ * naturally aligned large frames that lie entirely inside its allocatable range: a count of free
+ * pages in each frame, and a bitmap indicating which frames are entirely free. These are kept up
+ * to date by all allocation paths, so a free large frame can be located without scanning the page
+ * bitmap.
+ *
+ * All operations on a region may be performed concurrently from multiple processors, without any
+ * locks: pages are claimed and released with atomic operations on the bitmap words, which are the
+ * only authoritative record of which pages are free. The summary bitmap and large frame tables
+ * are hints that are kept in sync on a best effort basis; a stale hint only costs an extra look at
+ * the bitmap. To reduce contention, each processor begins its search for free pages at a different
+ * offset into the bitmap.
+ *
+ * Additionally, the region keeps a hint to the lowest bitmap word that may contain free pages.
+ * Searches never start below it, so that long runs of allocated pages at the start of the region
+ * aren't scanned over and over again.
+ *
+ * A region may span holes in physical memory, as long as its metadata fits in front of the first
+ * hole; the pages in the holes are reserved right after the region is created.
  */
 class Region {
     friend class Pool;
 
+    public:
+        static size_t GetMetadataSize(const PhysicalAllocator *allocator, const size_t length);
+
     protected:
         Region(Pool *pool, const uintptr_t base, const size_t length);
         ~Region();
@@ -36,19 +61,133 @@ class Region {
         int alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs);
         int free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs);
 
+        int allocContiguous(Pool *pool, const size_t numPages, const size_t alignLog2,
+                uintptr_t &outBase);
+        int freeContiguous(Pool *pool, const uintptr_t base, const size_t numPages);
+
+        int allocLarge(Pool *pool, const size_t sizeIdx, uintptr_t &outAddr);
+        int freeLarge(Pool *pool, const size_t sizeIdx, const uintptr_t addr);
+
+        size_t reserve(Pool *pool, const uintptr_t base, const size_t length);
+        size_t unreserve(Pool *pool, const uintptr_t base, const size_t length);
+
         size_t applyVirtualMap(uintptr_t base, Vm::Map *map);
 
+        size_t getLargestFreeRun() const;
+        bool getFreeRuns(size_t &outLargest, size_t *outCounts, const size_t numBuckets) const;
+
+        /// Get the number of alloc() calls and the number of words they examined in total
+        inline void getScanStats(size_t &outAllocs, size_t &outWords) const {
+            outAllocs = __atomic_load_n(&this->scanStats.allocs, __ATOMIC_RELAXED);
+            outWords = __atomic_load_n(&this->scanStats.words, __ATOMIC_RELAXED);
+        }
+
+        /// Get the physical address of the first allocatable page in the region
+        constexpr inline uintptr_t getAllocBase() const {
+            return this->allocBasePhys;
+        }
+        /// Get the physical address past the last allocatable page in the region
+        constexpr inline uintptr_t getAllocEnd() const {
+            return this->allocEndPhys;
+        }
+        /// Get the number of allocatable pages in the region
+        inline size_t getTotalPages() const {
+            return this->bitmapSize - __atomic_load_n(&this->numReserved, __ATOMIC_RELAXED);
+        }
+        /// Get the number of allocated pages in the region
+        inline size_t getAllocatedPages() const {
+            return __atomic_load_n(&this->numAllocated, __ATOMIC_RELAXED) -
+                __atomic_load_n(&this->numReserved, __ATOMIC_RELAXED);
+        }
+        /// Get the number of large frames of the given size in the region
+        constexpr inline size_t getTotalLargePages(const size_t sizeIdx) const {
+            return this->large[sizeIdx].numFrames;
+        }
+        /// Get the number of entirely free large frames of the given size
+        inline size_t getFreeLargePages(const size_t sizeIdx) const {
+            return __atomic_load_n(&this->large[sizeIdx].numFree, __ATOMIC_RELAXED);
+        }
+        /// Get the number of large frames of the given size allocated as large pages
+        inline size_t getAllocatedLargePages(const size_t sizeIdx) const {
+            return __atomic_load_n(&this->large[sizeIdx].numAllocated, __ATOMIC_RELAXED);
+        }
+
+    private:
+        struct LargeFrames;
+
+        static size_t LayoutMetadata(const PhysicalAllocator *allocator, const size_t numPages,
+                LargeFrames *large);
+
+        void setMetadataBase(void *base);
+
+        size_t getStartWord() const;
+        size_t allocFromWords(Pool *pool, const size_t first, const size_t last,
+                const size_t numPages, uintptr_t *outAddrs, size_t &scanned, size_t &outNext);
+        void advanceFreeHint(size_t from, const size_t to);
+        void lowerFreeHint(const size_t word);
+        size_t claimFromWord(const size_t word, const size_t max, uint64_t &outTaken);
+        void clearSummaryBit(const size_t word);
+
+        size_t findFreePage(const size_t start) const;
+        size_t findAllocatedPage(const size_t start, const size_t end) const;
+        bool claimRun(const size_t start, const size_t count);
+        void markFree(const size_t start, const size_t count);
+        void updateLargeFrames(const size_t word, const uint64_t mask, const bool freed);
+        void syncLargeFrame(LargeFrames &info, const size_t frame);
+
         /**
          * @brief Test if the given physical page address is contained in this region.
          *
+         * Only the allocatable part of the region is considered; pages reserved for metadata are
+         * never handed out, so they cannot be freed either.
+         *
          * @param address Physical address to test
          *
          * @return Whether the address is inside this region.
          */
-        constexpr inline bool contains(const uintptr_t address) {
-            return (address >= this->physBase) && (address < (this->physBase + this->numPages));
+        constexpr inline bool contains(const uintptr_t address) const {
+            return (address >= this->allocBasePhys) && (address < this->allocEndPhys);
         }
 
+    private:
+        /**
+         * @brief Bookkeeping for one of the allocator's extra page sizes
+         */
+        struct LargeFrames {
+            /// Size of a large frame, as a power of two multiple of the base page size
+            uint8_t pageSizeLog2{0};
+
+            /// Index (into the page bitmap) of the first page of the first tracked frame
+            size_t firstPage{0};
+            /// Number of naturally aligned frames that fit in the allocatable range
+            size_t numFrames{0};
+            /**
+             * Number of frames that are entirely free
+             *
+             * This always matches the number of bits set in the free frame map, except for
+             * short periods of time while the map is updated.
+             */
+            size_t numFree{0};
+            /// Number of frames currently allocated as large pages
+            size_t numAllocated{0};
+
+            /// Byte offset of the free page counts from the start of the metadata area
+            size_t countsOffset{0};
+            /// Byte offset of the free frame bitmap from the start of the metadata area
+            size_t mapOffset{0};
+
+            /// Number of free base pages in each frame
+            uint32_t *freePages{nullptr};
+            /**
+             * Bitmap of frames; a set bit indicates the frame is entirely free
+             *
+             * Since the free page counts are updated after the page bitmap, a bit may briefly be
+             * set for a frame that has just been partially allocated; frames are only handed out
+             * once all of their pages have been claimed in the page bitmap.
+             */
+            uint64_t *freeMap{nullptr};
+        };
+
     private:
         /// Physical base address of the region
         uintptr_t physBase;
@@ -76,14 +215,31 @@ class Region {
          */
         size_t bitmapSize;
 
+        /// Number of 64-bit words in the bitmap
+        size_t bitmapWords;
+
         /**
          * Amount of bytes reserved for bitmap
          *
          * Bitmap is allocated in increments of whole pages, so the amount reserved for it will
-         * often be greater than the actual space required.
+         * often be greater than the actual space required. This also includes the space for the
+         * summary bitmap, which immediately follows the page bitmap, and the large frame tables
+         * after it.
          */
         size_t bitmapReserved;
 
+        /// Number of 64-bit words in the summary bitmap
+        size_t summaryWords;
+
+        /**
+         * Virtual address of the summary bitmap
+         *
+         * Bit `n` in the summary is set if word `n` of the page bitmap is nonzero (that is, it
+         * has at least one free page.) It is stored in the metadata area, directly following the
+         * page bitmap.
+         */
+        uint64_t *summary{nullptr};
+
         /**
          * Virtual address of the bitmap
          *
@@ -110,8 +266,34 @@ class Region {
          */
         uintptr_t allocBasePhys;
 
-        /// Number of allocated pages
+        /// Physical address one past the last allocatable page
+        uintptr_t allocEndPhys;
+
+        /// Number of allocated pages (updated atomically), including reserved pages
         size_t numAllocated{0};
+        /// Number of pages permanently reserved by reserve()
+        size_t numReserved{0};
+
+        /**
+         * Index of the lowest bitmap word that may contain free pages
+         *
+         * All words below it are known to be fully allocated. It's moved up by allocations that
+         * start searching at it, and lowered whenever pages below it are freed.
+         */
+        size_t freeHint{0};
+
+        /// Search statistics, for measuring how effective the free hint is
+        struct {
+            /// Number of calls to alloc()
+            size_t allocs{0};
+            /// Number of summary and bitmap words examined by those calls
+            size_t words{0};
+        } scanStats;
+
+        /// Number of extra page sizes tracked
+        size_t numLargeSizes{0};
+        /// Large frame bookkeeping, in the same order as the allocator's extra page sizes
+        LargeFrames large[PhysicalAllocator::kMaxExtraSizes];
 };
 }
 
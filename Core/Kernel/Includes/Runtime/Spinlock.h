@@ -0,0 +1,73 @@
+#ifndef KERNEL_RUNTIME_SPINLOCK_H
+#define KERNEL_RUNTIME_SPINLOCK_H
+
+#include <stdint.h>
+
+namespace Kernel::Runtime {
+/**
+ * @brief Simple test-and-test-and-set spin lock
+ *
+ * Waiters spin on a plain load of the lock word, only attempting to take the lock when it appears
+ * to be free, so that contended locks don't bounce the cache line between processors.
+ *
+ * @remark Interrupts are not masked while the lock is held; so it must not be taken from any
+ *         interrupt handlers.
+ */
+class Spinlock {
+    public:
+        /**
+         * @brief Acquire the lock, spinning until it becomes available.
+         */
+        inline void lock() {
+            while(__atomic_exchange_n(&this->locked, 1, __ATOMIC_ACQUIRE)) {
+                while(__atomic_load_n(&this->locked, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#endif
+                }
+            }
+        }
+
+        /**
+         * @brief Try to acquire the lock without waiting.
+         *
+         * @return Whether the lock was acquired
+         */
+        inline bool tryLock() {
+            return !__atomic_exchange_n(&this->locked, 1, __ATOMIC_ACQUIRE);
+        }
+
+        /**
+         * @brief Release the lock.
+         */
+        inline void unlock() {
+            __atomic_store_n(&this->locked, 0, __ATOMIC_RELEASE);
+        }
+
+    private:
+        /// Set while the lock is held
+        uint8_t locked{0};
+};
+
+/**
+ * @brief Holds a spin lock for as long as it is in scope
+ */
+class SpinlockGuard {
+    public:
+        SpinlockGuard(Spinlock &lock) : lock(lock) {
+            this->lock.lock();
+        }
+        ~SpinlockGuard() {
+            this->lock.unlock();
+        }
+
+        SpinlockGuard(const SpinlockGuard &) = delete;
+        SpinlockGuard &operator=(const SpinlockGuard &) = delete;
+
+    private:
+        /// Lock that is held
+        Spinlock &lock;
+};
+}
+
+#endif
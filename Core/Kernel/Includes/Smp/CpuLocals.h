@@ -1,6 +1,8 @@
 #ifndef KERNEL_SMP_CPULOCALS_H
 #define KERNEL_SMP_CPULOCALS_H
 
+#include <Memory/PageCache.h>
+
 namespace Kernel::Vm {
 class Map;
 }
@@ -17,6 +19,29 @@ struct CpuLocals {
      * @brief Currently active memory map
      */
     Vm::Map *map{nullptr};
+
+    /**
+     * @brief Logical index of this processor
+     *
+     * Processors are numbered sequentially as they are brought up; the bootstrap processor is
+     * always 0.
+     */
+    uint32_t cpuId{0};
+
+    /**
+     * @brief Index of the physical memory pool closest to this processor
+     *
+     * Allocations that don't request a particular pool are satisfied from here first.
+     */
+    size_t physPool{0};
+
+    /**
+     * @brief Physical page cache
+     *
+     * Satisfies most single page allocations (and frees) on this processor without going to the
+     * physical allocator's pools.
+     */
+    Memory::PageCache pageCache;
 };
 }
 
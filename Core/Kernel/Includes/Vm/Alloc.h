@@ -12,8 +12,17 @@
 namespace Kernel::Vm {
 /// @{ @name Page Allocator
 [[nodiscard]] void *VAlloc(const size_t length);
+[[nodiscard]] void *VAllocAligned(const size_t length, const size_t alignment);
+[[nodiscard]] void *VAllocLazy(const size_t length);
 void VFree(void *ptr, const size_t length);
 /// @}
 }
 
+namespace Kernel {
+/// @{ @name Kernel Heap
+[[nodiscard]] void *Malloc(const size_t length);
+void Free(void *ptr);
+/// @}
+}
+
 #endif
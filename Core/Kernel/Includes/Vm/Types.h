@@ -113,6 +113,14 @@ enum class TlbInvalidateHint: uintptr_t {
      * in the future) are cleared.
      */
     InvalidateAll                       = (InvalidateLocal | InvalidateRemote),
+    /**
+     * @brief Invalidate the entire TLB
+     *
+     * Rather than invalidating only the specified range, all entries (including global ones) are
+     * dropped from the selected TLBs. This is cheaper than invalidating large or many scattered
+     * ranges page by page.
+     */
+    InvalidateEntire                    = (1 << 2),
 
     /**
      * @brief Bit mask for change type
@@ -5,6 +5,8 @@
 #include <stdint.h>
 
 #include <Logging/Console.h>
+#include <Memory/PhysicalAllocator.h>
+#include <Runtime/Spinlock.h>
 #include <Runtime/String.h>
 #include <Vm/Alloc.h>
 #include <Vm/Types.h>
@@ -12,6 +14,150 @@
 #include <new>
 
 namespace Kernel::Vm {
+/**
+ * @brief Type independent part of zone allocators
+ *
+ * This holds each zone's lock and its per processor magazines: small stacks of free objects that
+ * each processor can allocate from and free to without taking the zone's lock. When a magazine
+ * runs dry, it is refilled with a batch of objects from the zone's regions; when it overflows, a
+ * batch is returned to them.
+ *
+ * It also keeps the zone's region counters, including high-water marks for the number of regions
+ * and allocated objects. All zones are kept in a list, so that their statistics can be reported,
+ * and so that their empty regions can be released when physical memory runs low.
+ *
+ * @remark A magazine is only ever accessed by its processor, so zone allocations must not be made
+ *         from interrupt context.
+ */
+class ZoneAllocatorBase {
+    public:
+        /**
+         * Maximum number of processors with magazines
+         *
+         * Any further processors always allocate from the zone's regions directly.
+         */
+        constexpr static const size_t kMaxProcessors{64};
+
+        /// Maximum number of objects held in a magazine
+        constexpr static const size_t kMagazineCapacity{16};
+
+        /// Number of objects exchanged between a magazine and the zone's regions at once
+        constexpr static const size_t kMagazineBatchSize{kMagazineCapacity / 2};
+
+        /// Default number of empty regions kept around by a zone
+        constexpr static const size_t kDefaultEmptyRegionCache{2};
+
+    public:
+        static void EnableMagazines();
+        static void EnablePressureHandler();
+        static void ReleaseRetired();
+        static void DumpStats();
+
+        void getMagazineStats(size_t &outHits, size_t &outMisses) const;
+
+    protected:
+        /**
+         * @brief Per processor magazine
+         *
+         * Each is aligned to a cache line, so processors don't contend on each other's
+         * magazines.
+         */
+        struct alignas(64) Magazine {
+            /// Number of objects in the magazine
+            size_t rounds{0};
+            /// Free objects; used as a stack, so recently freed (cache hot) objects go out first
+            void *objects[kMagazineCapacity];
+
+            /// Number of allocations satisfied from the magazine
+            size_t hits{0};
+            /// Number of allocations that had to refill the magazine
+            size_t misses{0};
+        };
+
+    protected:
+        ZoneAllocatorBase(const char *name);
+
+        static Magazine *GetMagazine(ZoneAllocatorBase *zone);
+
+        /**
+         * @brief Adjust the zone's empty region cache to the memory pressure level
+         *
+         * Under pressure, the zone keeps no empty regions; the excess ones are retired, and
+         * released later by releaseRetired(). Otherwise, the configured limit is restored.
+         *
+         * This is called from a memory pressure handler, so it must not block.
+         *
+         * @param underPressure Whether memory is running low
+         */
+        virtual void trim(const bool underPressure) = 0;
+        /// Release the memory of all regions retired by trim()
+        virtual void releaseRetired() = 0;
+
+    protected:
+        /// Name of the zone
+        const char *name;
+        /// Next zone in the list of all zones
+        ZoneAllocatorBase *nextZone{nullptr};
+
+        /// Protects the zone's regions and counters
+        Runtime::Spinlock lock;
+
+        /// Maximum number of empty regions to keep; any further empty regions are released
+        size_t maxEmptyRegions{kDefaultEmptyRegionCache};
+        /// Number of empty regions to keep while there is no memory pressure
+        size_t emptyRegionCache{kDefaultEmptyRegionCache};
+        /// Number of regions on the empty list
+        size_t numEmptyRegions{0};
+
+        /// Number of regions currently allocated
+        size_t numRegions{0};
+        /// Largest number of regions allocated at any time
+        size_t peakRegions{0};
+        /// Number of regions that were released back to the page allocator
+        size_t regionsReleased{0};
+
+        /**
+         * Number of objects allocated from regions
+         *
+         * Objects that are held in a magazine count as allocated.
+         */
+        size_t numObjects{0};
+        /// Largest number of objects allocated at any time
+        size_t peakObjects{0};
+
+        /// Magazines for each processor
+        Magazine magazines[kMaxProcessors];
+
+    private:
+        static void HandlePressure(const size_t pool, const PhysicalAllocator::Pressure level,
+                void *);
+
+    private:
+        /// Set once processor local storage is available on all processors
+        static bool gMagazinesEnabled;
+
+        /// List of all zones
+        static ZoneAllocatorBase *gZones;
+        /// Protects the list of zones
+        static Runtime::Spinlock gZonesLock;
+};
+
+/**
+ * @brief Default source of memory for zone allocator regions
+ *
+ * Regions are allocated from (and released to) the virtual page allocator.
+ */
+struct ZonePageBacking {
+    /// Allocate memory for a region
+    static inline void *Alloc(const size_t length, const size_t alignment) {
+        return Vm::VAllocAligned(length, alignment);
+    }
+    /// Release the memory of a region
+    static inline void Free(void *ptr, const size_t length) {
+        Vm::VFree(ptr, length);
+    }
+};
+
 /**
  * @brief Zone allocator
  *
@@ -20,21 +166,57 @@ namespace Kernel::Vm {
  * allocations extremely quickly, while rarely needing to actually allocate new memory from the
  * kernel's memory pool.
  *
- * @tparam T Name of the type to allocate
+ * Regions are allocated at virtual addresses aligned to their size, so the region an object
+ * belongs to is found by masking off the low bits of its address; this makes freeing objects
+ * independent of the number of regions in the zone.
+ *
+ * Regions are kept on one of three lists, depending on how many free objects they have: partial,
+ * full, and empty. Allocations always come from the first partially used region (or if there is
+ * none, an empty one) so finding space is constant time. A small number of empty regions are kept
+ * around to absorb allocation bursts; the rest are released to the page allocator.
  *
- * @TODO Optimizations for finding free regions
+ * Once enabled, most allocations and frees are satisfied from the calling processor's magazine
+ * without taking any locks; see ZoneAllocatorBase.
  *
- * @TODO Thread safety stuff
+ * @tparam T Name of the type to allocate
+ * @tparam RegionSize Size of a region, in bytes; must be a power of two
+ * @tparam Backing Source of memory for regions; it must provide static `Alloc(length, alignment)`
+ *         and `Free(ptr, length)` methods, like ZonePageBacking.
  */
-template<class T, const char *ZoneName, size_t RegionSize>
-class ZoneAllocator {
+template<class T, const char *ZoneName, size_t RegionSize, class Backing = ZonePageBacking>
+class ZoneAllocator: public ZoneAllocatorBase {
     private:
         struct Region;
 
+        /// Size of a cache line; object storage never shares one with region metadata
+        constexpr static const size_t kCacheLineSize{64};
+
+        /// Alignment of the object storage in a region
+        constexpr static const size_t kStorageAlignment{
+            (alignof(T) > kCacheLineSize) ? alignof(T) : kCacheLineSize};
+
+        /**
+         * @brief Number of (64 bit) bitmap entries
+         *
+         * This is sized for the number of objects that would fit into a region without any
+         * metadata, which is always sufficient.
+         */
+        constexpr static const size_t kBitmapEntries{((RegionSize / sizeof(T)) + 63) / 64};
+
+        /**
+         * @brief Whether regions keep a summary of which bitmap entries have free slots
+         *
+         * This is used for bitmaps with up to 64 entries, so a free slot is found with two bit
+         * scans. Regions with larger bitmaps instead keep a hint to the first entry that may have
+         * free slots, and search linearly from there.
+         */
+        constexpr static const bool kUseSummary{kBitmapEntries > 1 && kBitmapEntries <= 64};
+
         /**
          * @brief Allocation region metadata
          *
          * Structure containing metadata about a region, placed at the top end of the region.
+         * Frequently accessed fields come first, so they share a cache line.
          */
         struct RegionMetadata {
             /**
@@ -43,24 +225,34 @@ class ZoneAllocator {
             constexpr static const uint64_t kMagic{0xf849a50c9e0f8139};
 
             /**
-             * @brief Number of (64 bit) bitmap entries
+             * @brief Previous and next regions
+             *
+             * Each region is on exactly one of the zone's partial, full or empty lists.
              */
-            constexpr static const size_t kBitmapEntries{6};
+            struct Region *prev{nullptr}, *next{nullptr};
 
             /**
-             * @brief Pointer to the next region
+             * @brief Number of free objects in the region
              *
-             * All regions in a zone allocator are attached together in a linked list, traversed
-             * when we need to allocate or free an object.
+             * This determines which list the region is on.
              */
-            struct Region *next{nullptr};
+            size_t numFree;
 
             /**
-             * @brief Allocation bitmap
+             * @brief Bitmap entries with free slots
              *
-             * A set bit indicates an available slot; a clear bit indicates allocated.
+             * A set bit indicates that the corresponding bitmap entry is nonzero. Only
+             * maintained if `kUseSummary` is set.
              */
-            uint64_t bitmap[kBitmapEntries];
+            uint64_t summary;
+
+            /**
+             * @brief Index of the first bitmap entry that may have free slots
+             *
+             * All entries before it are zero. Only maintained for bitmaps with more than 64
+             * entries.
+             */
+            size_t searchHint;
 
             /**
              * @brief Security cookie
@@ -70,29 +262,71 @@ class ZoneAllocator {
              */
             uint64_t magic;
 
+            /**
+             * @brief Allocation bitmap
+             *
+             * A set bit indicates an available slot; a clear bit indicates allocated.
+             */
+            uint64_t bitmap[kBitmapEntries];
+
             /**
              * @brief Initialize region metadata
              */
             RegionMetadata() {
-                // how many usable entries have we got?
-                constexpr static const auto kBitmapBits = sizeof(bitmap) * 8;
-                constexpr const auto payloadSize = RegionSize - offsetof(Region, storage);
-                constexpr const auto numItems = payloadSize / sizeof(T);
-                static_assert(numItems <= kBitmapBits, "region size too large for bitmap");
-
-                // fill the bitmask (TODO: optimize)
-                memset(this->bitmap, 0, sizeof(bitmap));
+                constexpr const size_t kFullWords{kNumItems / 64}, kRemainder{kNumItems % 64};
+                constexpr const size_t kUsedWords{kFullWords + (kRemainder ? 1 : 0)};
 
-                for(size_t i = 0; i < numItems; i++) {
-                    this->bitmap[i / 64] |= (1ULL << (i % 64));
+                // mark every slot as available, a whole word at a time
+                for(size_t i = 0; i < kBitmapEntries; i++) {
+                    this->bitmap[i] = (i < kFullWords) ? ~0ULL : 0;
+                }
+                if constexpr(kRemainder != 0) {
+                    this->bitmap[kFullWords] = (1ULL << kRemainder) - 1;
                 }
 
+                this->numFree = kNumItems;
+                if constexpr(kUsedWords == 64) {
+                    this->summary = ~0ULL;
+                } else if constexpr(kUsedWords < 64) {
+                    this->summary = (1ULL << kUsedWords) - 1;
+                } else {
+                    this->summary = 0;
+                }
+                this->searchHint = 0;
 
                 // set up the security cookie
-                this->magic = kMagic ^ reinterpret_cast<uint64_t>(this);
+                this->magic = GetCookie(this);
+            }
+
+            /**
+             * @brief Check whether the security cookie is intact
+             *
+             * The cookie also encodes the zone's name, so this fails for regions that belong
+             * to another zone.
+             */
+            inline bool isValid() const {
+                return this->magic == GetCookie(this);
+            }
+
+            /**
+             * @brief Calculate the security cookie for a region
+             */
+            static inline uint64_t GetCookie(const RegionMetadata *meta) {
+                return kMagic ^ reinterpret_cast<uint64_t>(meta) ^
+                    reinterpret_cast<uint64_t>(ZoneName);
             }
         };
 
+        /// Offset of the object storage from the start of a region
+        constexpr static const size_t kStorageOffset{
+            (sizeof(RegionMetadata) + (kStorageAlignment - 1)) & ~(kStorageAlignment - 1)};
+
+        /// Number of objects that fit in a region
+        constexpr static const size_t kNumItems{(RegionSize - kStorageOffset) / sizeof(T)};
+        static_assert(kStorageOffset < RegionSize && kNumItems,
+                "region size too small for a single object");
+        static_assert(kNumItems <= (kBitmapEntries * 64), "region bitmap too small (wtf)");
+
         /**
          * @brief Allocation region
          *
@@ -108,59 +342,72 @@ class ZoneAllocator {
             /**
              * @brief Object storage
              *
-             * The remainder of the region is reserved for storage of objects.
+             * The remainder of the region is reserved for storage of objects. It starts on a new
+             * cache line, so that objects don't share a line with the region's metadata.
              */
-            alignas(T) uint8_t storage[];
+            alignas(kStorageAlignment) uint8_t storage[];
 
 
 
             /**
              * @brief Alocate memory for a new region
+             *
+             * The memory is aligned to the region size, so that From() works.
              */
             void *operator new(size_t) noexcept {
-                return Vm::VAlloc(RegionSize);
+                return Backing::Alloc(RegionSize, RegionSize);
             }
             /**
              * @brief Release memory for a region
              *
-             * The memory is returned back to the virtual allocator.
+             * The memory is returned back to where it was allocated from.
              */
             void operator delete(void *ptr) {
-                Vm::VFree(ptr, RegionSize);
+                Backing::Free(ptr, RegionSize);
             }
 
             /**
              * @brief Allocate a new object
+             *
+             * The way a free slot is found depends on the size of the bitmap; see `kUseSummary`.
              */
             T *alloc() {
-                uint64_t *readPtr = this->meta.bitmap;
-
-                for(size_t off = 0; off < (RegionMetadata::kBitmapEntries * 64); off += 64) {
-                    // read this chunk; skip if zero (all pages allocated)
-                    auto val = *readPtr;
-                    if(!val) {
-                        readPtr++;
-                        continue;
-                    }
+                size_t word;
 
-                    // mark as allocated
-                    const auto bit = __builtin_ffsll(val);
-                    REQUIRE(bit, "wtf");
+                if constexpr(kBitmapEntries == 1) {
+                    word = 0;
+                } else if constexpr(kUseSummary) {
+                    if(!this->meta.summary) {
+                        return nullptr;
+                    }
+                    word = __builtin_ctzll(this->meta.summary);
+                } else {
+                    word = this->meta.searchHint;
+                    while(word < kBitmapEntries && !this->meta.bitmap[word]) {
+                        word++;
+                    }
+                    this->meta.searchHint = word;
+                }
 
-                    val &= ~(1ULL << (bit - 1));
-                    *readPtr = val;
+                if(word >= kBitmapEntries || !this->meta.bitmap[word]) {
+                    // failed to allocate
+                    return nullptr;
+                }
 
-                    // get its address
-                    const auto idx = off + (bit - 1);
-                    auto addr = this->addressFor(idx);
+                // mark as allocated
+                const auto bit = __builtin_ctzll(this->meta.bitmap[word]);
+                this->meta.bitmap[word] &= ~(1ULL << bit);
 
-                    // XXX: zero memory
-                    memset(addr, 0, sizeof(T));
-                    return addr;
+                if constexpr(kUseSummary) {
+                    if(!this->meta.bitmap[word]) {
+                        this->meta.summary &= ~(1ULL << word);
+                    }
                 }
 
-                // failed to allocate
-                return nullptr;
+                this->meta.numFree--;
+
+                // get its address
+                return this->addressFor((word * 64) + bit);
             }
 
             /**
@@ -171,14 +418,46 @@ class ZoneAllocator {
              * @remark The specified object _must_ have previously been allocated from this pool.
              */
             void free(void *ptr) {
-                // validate pointer is inside the region's extents
+                // validate pointer is inside the region's extents, and points to a slot
                 if(!this->contains(ptr)) {
                     PANIC("attempt to free %p from foreign region (this=%p)", ptr, this);
                 }
 
+                const auto offset = reinterpret_cast<uintptr_t>(ptr) -
+                    reinterpret_cast<uintptr_t>(this->storage);
+                if(offset % sizeof(T)) {
+                    PANIC("attempt to free misaligned object %p (region %p)", ptr, this);
+                }
+
                 // mark it as available
                 const auto idx = this->indexFor(ptr);
-                this->meta.bitmap[idx / 64] |= (1ULL << (idx % 64));
+                const auto bit = (1ULL << (idx % 64));
+                if(this->meta.bitmap[idx / 64] & bit) {
+                    PANIC("double free of %p (region %p)", ptr, this);
+                }
+
+                this->meta.bitmap[idx / 64] |= bit;
+
+                if constexpr(kUseSummary) {
+                    this->meta.summary |= (1ULL << (idx / 64));
+                } else if constexpr(kBitmapEntries > 64) {
+                    if((idx / 64) < this->meta.searchHint) {
+                        this->meta.searchHint = idx / 64;
+                    }
+                }
+
+                this->meta.numFree++;
+            }
+
+            /**
+             * @brief Get the region that an object was allocated from
+             *
+             * @remark The result is only meaningful if the object was allocated from a zone
+             *         with the same region size; check the region's security cookie.
+             */
+            static inline Region *From(void *ptr) {
+                return reinterpret_cast<Region *>(reinterpret_cast<uintptr_t>(ptr) &
+                        ~(RegionSize - 1));
             }
 
             /**
@@ -191,7 +470,8 @@ class ZoneAllocator {
                 const auto addr = reinterpret_cast<uintptr_t>(ptr);
                 const auto endAddr = reinterpret_cast<uintptr_t>(this) + RegionSize;
 
-                if(addr < reinterpret_cast<uintptr_t>(this) || (addr + sizeof(T)) > endAddr) {
+                if(addr < reinterpret_cast<uintptr_t>(this->storage) ||
+                        (addr + sizeof(T)) > endAddr) {
                     return false;
                 }
                 return true;
@@ -216,139 +496,395 @@ class ZoneAllocator {
              * @brief Is the region fully loaded?
              */
             constexpr inline bool isFull() const {
-                for(size_t i = 0; i < RegionMetadata::kBitmapEntries; i++) {
-                    if(this->meta.bitmap[i]) {
-                        return false;
-                    }
-                }
-
-                // all bits are clear
-                return true;
+                return !this->meta.numFree;
+            }
+            /**
+             * @brief Are all of the region's objects free?
+             */
+            constexpr inline bool isEmpty() const {
+                return this->meta.numFree == kNumItems;
             }
         };
         static_assert(sizeof(Region) <= RegionSize, "region size over limit (wtf)");
+        static_assert(offsetof(Region, storage) == kStorageOffset, "invalid storage offset");
+        static_assert(!(RegionSize & (RegionSize - 1)), "region size must be a power of two");
 
     public:
+        ZoneAllocator() : ZoneAllocatorBase(ZoneName) {}
+
         /**
          * @brief Allocate memory for a new object
          *
-         * @return Memory for a new object or `nullptr` if no memory available
+         * The object is taken from the calling processor's magazine if possible; if it's empty, it
+         * is refilled with a batch of objects from the zone's regions first.
+         *
+         * @return Zeroed memory for a new object or `nullptr` if no memory available
          */
         T *alloc() {
-            // TODO: acquire lock
+            T *obj{nullptr};
+            this->releaseRetired();
 
-            // find a free region and allocate from it
-            auto nextFree = this->findRegionWithSpace();
-            if(nextFree) {
-                // TODO: handle this call failing and retry another region?
-                return nextFree->alloc();
-            }
+            auto mag = GetMagazine(this);
 
-            // otherwise, allocate a new region and thread it in
-            auto newRegion = new Region;
+            if(!mag) {
+                Runtime::SpinlockGuard guard(this->lock);
+                obj = this->allocLocked();
+            } else if(mag->rounds) {
+                mag->hits++;
+                obj = static_cast<T *>(mag->objects[--mag->rounds]);
+            } else {
+                mag->misses++;
 
-            if(!this->start) {
-                this->start = newRegion;
-            }
+                Runtime::SpinlockGuard guard(this->lock);
+                while(mag->rounds < kMagazineBatchSize) {
+                    auto fresh = this->allocLocked();
+                    if(!fresh) break;
+                    mag->objects[mag->rounds++] = fresh;
+                }
 
-            if(this->last) {
-                this->last->meta.next = newRegion;
-            } else {
-                this->last = newRegion;
+                if(mag->rounds) {
+                    obj = static_cast<T *>(mag->objects[--mag->rounds]);
+                }
             }
 
-            this->last = newRegion;
-            this->freeRegion = newRegion;
-
-            // allocate from that region
-            return newRegion->alloc();
+            if(obj) {
+                memset(obj, 0, sizeof(T));
+            }
+            return obj;
         }
 
         /**
          * @brief Release a previously allocated object
          *
-         * Return the memory from a previously allocated object back to the appropriate region.
+         * Return the memory from a previously allocated object back to the appropriate region,
+         * which is found directly from the object's address. If the calling processor has a
+         * magazine, the object is placed there instead; when it's full, its oldest objects are
+         * returned to their regions first. Freeing an object that is already in the magazine
+         * results in a panic, like freeing one that is already free in its region.
          */
         void free(void *ptr) {
-            // TODO: acquire lock
+            auto region = Region::From(ptr);
+            if(!region->meta.isValid()) {
+                // the object belongs to nobody, or the region's metadata was overwritten
+                PANIC("object %p not in zone %p(%s)", ptr, this, ZoneName);
+            }
 
-            // iterate over all regions
-            auto region = this->start;
+            this->releaseRetired();
 
-            while(region) {
-                if(!region->contains(ptr)) {
-                    continue;
+            auto mag = GetMagazine(this);
+            if(!mag) {
+                Region *release{nullptr};
+                {
+                    Runtime::SpinlockGuard guard(this->lock);
+                    this->freeLocked(region, ptr, release);
                 }
 
-                region->free(ptr);
+                ReleaseRegions(release);
+                return;
+            }
+
+            // objects in the magazine are still marked allocated in their region's bitmap
+            for(size_t i = 0; i < mag->rounds; i++) {
+                if(mag->objects[i] == ptr) {
+                    PANIC("double free of %p (zone %p(%s) magazine)", ptr, this, ZoneName);
+                }
+            }
+
+            if(mag->rounds == kMagazineCapacity) {
+                this->drain(mag, kMagazineBatchSize);
+            }
+            mag->objects[mag->rounds++] = ptr;
+        }
+
+        /**
+         * @brief Return all objects in the calling processor's magazine to the zone's regions
+         */
+        void flushMagazine() {
+            auto mag = GetMagazine(this);
+            if(mag && mag->rounds) {
+                this->drain(mag, mag->rounds);
+            }
+        }
+
+        /**
+         * @brief Set how many empty regions the zone keeps around
+         *
+         * Any empty regions beyond the new limit are released immediately.
+         *
+         * @param maxEmpty Maximum number of empty regions to keep; 0 releases regions as soon as
+         *        they become empty
+         */
+        void setEmptyRegionCache(const size_t maxEmpty) {
+            Region *release{nullptr};
+
+            {
+                Runtime::SpinlockGuard guard(this->lock);
+                this->emptyRegionCache = maxEmpty;
+                this->maxEmptyRegions = maxEmpty;
+                this->trimLocked(release);
+            }
+
+            ReleaseRegions(release);
+        }
+
+    protected:
+        /**
+         * @brief Adjust the zone's empty region cache to the memory pressure level
+         *
+         * If the zone's lock is held (for example, because the zone is allocating a region, which
+         * caused the pressure change) nothing happens. Retired regions are not released here, as
+         * that may require taking locks held further up the call stack; they're added to the
+         * retired list instead.
+         */
+        void trim(const bool underPressure) override {
+            Region *release{nullptr};
+
+            if(!this->lock.tryLock()) {
                 return;
             }
+            this->maxEmptyRegions = underPressure ? 0 : this->emptyRegionCache;
+            this->trimLocked(release);
+            this->lock.unlock();
 
-            // if we get here, the object belongs to nobody (wtf?)
-            PANIC("object %p not in zone %p(%s)", ptr, this, ZoneName);
+            if(!release) {
+                return;
+            }
+
+            auto tail = release;
+            while(tail->meta.next) {
+                tail = tail->meta.next;
+            }
+
+            auto head = __atomic_load_n(&this->retired, __ATOMIC_RELAXED);
+            do {
+                tail->meta.next = head;
+            } while(!__atomic_compare_exchange_n(&this->retired, &head, release, true,
+                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        }
+
+        /**
+         * @brief Release the memory of all regions retired by trim()
+         *
+         * This is cheap if there are none, so it's called on every allocation and free.
+         */
+        void releaseRetired() override {
+            if(!__atomic_load_n(&this->retired, __ATOMIC_RELAXED)) {
+                return;
+            }
+
+            ReleaseRegions(__atomic_exchange_n(&this->retired, nullptr, __ATOMIC_ACQUIRE));
         }
 
     private:
         /**
-         * @brief Allocate a new region
+         * @brief Allocate an object from the zone's regions
+         *
+         * @remark The zone's lock must be held.
          *
-         * Get memory for a new region, insert it into the region list, and return a pointer to
-         * the newly allocated region.
+         * @return Memory for a new object (not zeroed) or `nullptr` if no memory available
          */
-        Region *newRegion() {
-            auto region = new Region;
-            return region;
+        T *allocLocked() {
+            // prefer partially used regions, so that empty ones can be released
+            auto region = this->partial ? this->partial : this->empty;
+
+            if(!region) {
+                region = new Region;
+                if(!region) {
+                    return nullptr;
+                }
+
+                this->numRegions++;
+                if(this->numRegions > this->peakRegions) {
+                    this->peakRegions = this->numRegions;
+                }
+
+                this->pushRegion(this->empty, region);
+                this->numEmptyRegions++;
+            }
+
+            // allocate from it and move it to the appropriate list
+            const auto wasEmpty = region->isEmpty();
+            auto obj = region->alloc();
+            REQUIRE(obj, "zone %s region %p has no free objects", ZoneName, region);
+
+            if(wasEmpty) {
+                this->unlinkRegion(this->empty, region);
+                this->numEmptyRegions--;
+                this->pushRegion(region->isFull() ? this->full : this->partial, region);
+            } else if(region->isFull()) {
+                this->unlinkRegion(this->partial, region);
+                this->pushRegion(this->full, region);
+            }
+
+            this->numObjects++;
+            if(this->numObjects > this->peakObjects) {
+                this->peakObjects = this->numObjects;
+            }
+
+            return obj;
         }
 
         /**
-         * @brief Find the first region with vacancy to allocate new objects
+         * @brief Return an object to its region
+         *
+         * The region is moved to the list matching its new number of free objects. If it became
+         * empty and the zone already has enough empty regions, it's removed from the zone, and
+         * added to the list of regions to release instead.
          *
-         * Iterate through the list of all regions, starting with the one deemed most likely to
-         * have free memory.
+         * @param region Region the object belongs to
+         * @param ptr Object to release
+         * @param release List of regions to release; they must be released (using
+         *        ReleaseRegions()) once the zone's lock is dropped.
+         *
+         * @remark The zone's lock must be held.
          */
-        Region *findRegionWithSpace() {
-            // bail if no entries
-            if(!this->start) {
-                return nullptr;
+        void freeLocked(Region *region, void *ptr, Region *&release) {
+            const auto wasFull = region->isFull();
+            region->free(ptr);
+            this->numObjects--;
+
+            if(wasFull) {
+                this->unlinkRegion(this->full, region);
+            } else if(region->isEmpty()) {
+                this->unlinkRegion(this->partial, region);
+            } else {
+                return;
             }
 
-            // TODO: support starting search at free ptr
-            auto region = this->start;
+            if(!region->isEmpty()) {
+                this->pushRegion(this->partial, region);
+            } else if(this->numEmptyRegions < this->maxEmptyRegions) {
+                this->pushRegion(this->empty, region);
+                this->numEmptyRegions++;
+            } else {
+                this->retireRegion(region, release);
+            }
+        }
 
-            while(region) {
-                if(!region->isFull()) {
-                    return region;
+        /**
+         * @brief Return the oldest objects in a magazine to their regions
+         *
+         * @param mag Magazine to drain
+         * @param num Number of objects to return
+         */
+        void drain(Magazine *mag, const size_t num) {
+            Region *release{nullptr};
+
+            {
+                Runtime::SpinlockGuard guard(this->lock);
+                for(size_t i = 0; i < num; i++) {
+                    this->freeLocked(Region::From(mag->objects[i]), mag->objects[i], release);
                 }
-                region = region->meta.next;
             }
 
-            // they're all full :(
-            return nullptr;
+            ReleaseRegions(release);
+
+            mag->rounds -= num;
+            memmove(mag->objects, mag->objects + num, mag->rounds * sizeof(void *));
+        }
+
+        /**
+         * @brief Insert a region at the head of a region list
+         */
+        static inline void pushRegion(Region *&head, Region *region) {
+            region->meta.prev = nullptr;
+            region->meta.next = head;
+
+            if(head) {
+                head->meta.prev = region;
+            }
+            head = region;
+        }
+
+        /**
+         * @brief Remove a region from a region list
+         */
+        static inline void unlinkRegion(Region *&head, Region *region) {
+            if(region->meta.prev) {
+                region->meta.prev->meta.next = region->meta.next;
+            } else {
+                head = region->meta.next;
+            }
+
+            if(region->meta.next) {
+                region->meta.next->meta.prev = region->meta.prev;
+            }
+
+            region->meta.prev = region->meta.next = nullptr;
+        }
+
+        /**
+         * @brief Retire empty regions beyond the zone's current limit
+         *
+         * @param release List of regions to release; they must be released (using
+         *        ReleaseRegions()) once the zone's lock is dropped.
+         *
+         * @remark The zone's lock must be held.
+         */
+        void trimLocked(Region *&release) {
+            while(this->numEmptyRegions > this->maxEmptyRegions) {
+                auto region = this->empty;
+                this->unlinkRegion(this->empty, region);
+                this->numEmptyRegions--;
+                this->retireRegion(region, release);
+            }
+        }
+
+        /**
+         * @brief Remove an (unlinked) empty region from the zone
+         *
+         * The region is added to the given list of regions to release.
+         *
+         * @remark The zone's lock must be held.
+         */
+        void retireRegion(Region *region, Region *&release) {
+            this->numRegions--;
+            this->regionsReleased++;
+
+            region->meta.next = release;
+            release = region;
+        }
+
+        /**
+         * @brief Release the memory of retired regions back to the page allocator
+         *
+         * @param list Regions to release, linked through their `next` pointers
+         */
+        static void ReleaseRegions(Region *list) {
+            while(list) {
+                auto next = list->meta.next;
+                // invalidate the cookie, so stale pointers into the region are caught
+                list->meta.magic = 0;
+                delete list;
+                list = next;
+            }
         }
 
     private:
         /**
-         * @brief Pointer to the first region
+         * @brief Regions with both free and allocated objects
          *
-         * This may be `nullptr` if no allocations have been serviced yet. It's used as the start
-         * of a linked list of all regions.
+         * New objects are always allocated from the first region on this list.
          */
-        Region *start{nullptr};
+        Region *partial{nullptr};
+
+        /// Regions without any free objects
+        Region *full{nullptr};
 
         /**
-         * @brief Pointer to the last region
+         * @brief Regions without any allocated objects
          *
-         * Points to the last region in the list of regions.
+         * At most `maxEmptyRegions` regions are on this list.
          */
-        Region *last{nullptr};
+        Region *empty{nullptr};
 
         /**
-         * @brief First region with free objects
+         * @brief Regions retired in response to memory pressure
          *
-         * Points to the region that most recently had an object freed back to it. This is used to
-         * speed up searching for free objects.
+         * They have been removed from the zone, but their memory has yet to be released. Linked
+         * through their `next` pointers.
          */
-        Region *freeRegion{nullptr};
+        Region *retired{nullptr};
 };
 
 
@@ -0,0 +1,284 @@
+#include "Numa.h"
+#include "Tables.h"
+#include "TableTypes.h"
+
+#include <Logging/Console.h>
+#include <Memory/PhysicalAllocator.h>
+
+using namespace Platform::Amd64Uefi;
+using namespace Platform::Amd64Uefi::Acpi;
+
+Numa::MemoryRange Numa::gRanges[kMaxMemoryRanges];
+size_t Numa::gNumRanges{0};
+Numa::Processor Numa::gProcessors[kMaxProcessors];
+size_t Numa::gNumProcessors{0};
+uint32_t Numa::gPoolDomains[kMaxPools]{0};
+size_t Numa::gNumPools{1};
+uint8_t Numa::gDistances[kMaxPools * kMaxPools];
+bool Numa::gHasDistances{false};
+
+/**
+ * @brief Discover the system's NUMA topology.
+ *
+ * This must be called after the ACPI tables have been located, but before the physical allocator
+ * is initialized, since it determines how many pools are needed.
+ */
+void Numa::Init() {
+    auto srat = reinterpret_cast<const Srat *>(Tables::Find("SRAT"));
+    if(!srat) return;
+
+    gNumPools = 0;
+    ParseSrat(srat);
+
+    // memory ranges in the SRAT are optional, in theory
+    if(!gNumPools) {
+        gNumPools = 1;
+    }
+
+    auto slit = reinterpret_cast<const Slit *>(Tables::Find("SLIT"));
+    if(slit) {
+        ParseSlit(slit);
+    }
+
+    ResolveProcessors(slit);
+
+    if(gNumPools > 1) {
+        Kernel::Console::Notice("NUMA: %zu nodes, %zu memory ranges, %zu processors%s",
+                gNumPools, gNumRanges, gNumProcessors, gHasDistances ? "" : " (no SLIT)");
+    }
+}
+
+/**
+ * @brief Get the pool that a physical address belongs to.
+ *
+ * Addresses that aren't described by the SRAT belong to the first pool.
+ *
+ * @param address Physical address to look up
+ * @param outEnd Variable to receive the end of the range of addresses that, starting at the given
+ *        address, all belong to the same pool
+ *
+ * @return Index of the physical allocator pool for the address
+ */
+size_t Numa::GetPoolForAddress(const uintptr_t address, uintptr_t &outEnd) {
+    // ranges are sorted by base address
+    for(size_t i = 0; i < gNumRanges; i++) {
+        const auto &range = gRanges[i];
+        if(range.end <= address) continue;
+
+        if(range.base > address) {
+            outEnd = range.base;
+            return 0;
+        }
+
+        outEnd = range.end;
+        return range.pool;
+    }
+
+    outEnd = ~0ULL;
+    return 0;
+}
+
+/**
+ * @brief Provide the node distances to the physical allocator.
+ *
+ * This must be called after the physical allocator has been initialized.
+ */
+void Numa::ApplyDistances() {
+    if(!gHasDistances || gNumPools < 2) return;
+
+    Kernel::PhysicalAllocator::SetPoolDistances(gDistances, gNumPools);
+}
+
+/**
+ * @brief Get the pool closest to a processor.
+ *
+ * @param apicId Local APIC ID of the processor
+ *
+ * @return Index of the physical allocator pool for the processor's node, or the first pool if the
+ *         processor isn't described by the SRAT.
+ */
+size_t Numa::GetPoolForApicId(const uint32_t apicId) {
+    for(size_t i = 0; i < gNumProcessors; i++) {
+        if(gProcessors[i].apicId == apicId) return gProcessors[i].pool;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read all processor and memory affinity structures from the SRAT.
+ */
+void Numa::ParseSrat(const Srat *srat) {
+    auto ptr = reinterpret_cast<const uint8_t *>(srat) + sizeof(Srat);
+    const auto end = reinterpret_cast<const uint8_t *>(srat) + srat->header.length;
+
+    while(ptr + sizeof(SratEntry) <= end) {
+        auto entry = reinterpret_cast<const SratEntry *>(ptr);
+        if(entry->length < sizeof(SratEntry) || ptr + entry->length > end) break;
+
+        switch(entry->type) {
+            case SratEntry::Type::Memory: {
+                auto mem = reinterpret_cast<const SratMemory *>(entry);
+                if((mem->flags & (1 << 0)) && mem->length) {
+                    AddMemoryRange(mem->domain, mem->base, mem->length);
+                }
+                break;
+            }
+
+            case SratEntry::Type::ProcessorLocalApic:
+            case SratEntry::Type::ProcessorLocalX2Apic: {
+                uint32_t apicId, domain, flags;
+
+                if(entry->type == SratEntry::Type::ProcessorLocalApic) {
+                    auto apic = reinterpret_cast<const SratLocalApic *>(entry);
+                    apicId = apic->apicId;
+                    domain = apic->domainLow | (apic->domainHigh[0] << 8) |
+                        (apic->domainHigh[1] << 16) | (apic->domainHigh[2] << 24);
+                    flags = apic->flags;
+                } else {
+                    auto apic = reinterpret_cast<const SratLocalX2Apic *>(entry);
+                    apicId = apic->apicId;
+                    domain = apic->domain;
+                    flags = apic->flags;
+                }
+
+                if(!(flags & (1 << 0))) break;
+
+                if(gNumProcessors == kMaxProcessors) {
+                    Kernel::Console::Warning("NUMA: too many processors, ignoring APIC %u", apicId);
+                    break;
+                }
+
+                gProcessors[gNumProcessors++] = {
+                    .apicId = apicId,
+                    .domain = domain,
+                    .pool   = 0,
+                };
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        ptr += entry->length;
+    }
+}
+
+/**
+ * @brief Read the distances between all nodes that have a pool from the SLIT.
+ */
+void Numa::ParseSlit(const Slit *slit) {
+    const auto n = slit->numLocalities;
+    if(slit->header.length < sizeof(Slit) + (n * n)) {
+        Kernel::Console::Warning("NUMA: invalid SLIT (%llu localities)", n);
+        return;
+    }
+
+    for(size_t i = 0; i < gNumPools; i++) {
+        for(size_t j = 0; j < gNumPools; j++) {
+            const auto from = gPoolDomains[i], to = gPoolDomains[j];
+            uint8_t distance = (i == j) ? 10 : 20;
+
+            if(from < n && to < n) {
+                distance = slit->entries[(from * n) + to];
+            }
+
+            gDistances[(i * gNumPools) + j] = distance;
+        }
+    }
+
+    gHasDistances = true;
+}
+
+/**
+ * @brief Determine the pool for each processor.
+ *
+ * Processors in a node that has no memory of its own are assigned the pool of the closest node
+ * that does, if the distances are known.
+ *
+ * @param slit System locality information table, if available
+ */
+void Numa::ResolveProcessors(const Slit *slit) {
+    const size_t n = slit ? slit->numLocalities : 0;
+
+    for(size_t i = 0; i < gNumProcessors; i++) {
+        auto &proc = gProcessors[i];
+
+        auto pool = GetPoolForDomain(proc.domain, false);
+        if(pool == kMaxPools) {
+            pool = 0;
+
+            if(gHasDistances && proc.domain < n) {
+                const auto row = slit->entries + (proc.domain * n);
+                uint8_t best{0xFF};
+
+                for(size_t j = 0; j < gNumPools; j++) {
+                    const auto domain = gPoolDomains[j];
+                    if(domain < n && row[domain] < best) {
+                        best = row[domain];
+                        pool = j;
+                    }
+                }
+            }
+        }
+
+        proc.pool = pool;
+    }
+}
+
+/**
+ * @brief Look up (or assign) the pool for a proximity domain.
+ *
+ * @param domain Proximity domain
+ * @param create Whether a pool should be assigned to the domain if it doesn't have one yet
+ *
+ * @return Pool index, or `kMaxPools` if the domain doesn't have a pool
+ */
+size_t Numa::GetPoolForDomain(const uint32_t domain, const bool create) {
+    for(size_t i = 0; i < gNumPools; i++) {
+        if(gPoolDomains[i] == domain) return i;
+    }
+
+    if(!create) return kMaxPools;
+
+    if(gNumPools == kMaxPools) {
+        Kernel::Console::Warning("NUMA: too many nodes, merging domain %u into first pool",
+                domain);
+        return 0;
+    }
+
+    gPoolDomains[gNumPools] = domain;
+    return gNumPools++;
+}
+
+/**
+ * @brief Record a memory range from the SRAT.
+ *
+ * The range list is kept sorted by base address.
+ *
+ * @param domain Proximity domain of the memory
+ * @param base Physical base address
+ * @param length Length of the range, in bytes
+ */
+void Numa::AddMemoryRange(const uint32_t domain, const uintptr_t base, const size_t length) {
+    const auto pool = GetPoolForDomain(domain, true);
+
+    if(gNumRanges == kMaxMemoryRanges) {
+        Kernel::Console::Warning("NUMA: too many memory ranges, ignoring %016llx - %016llx",
+                base, base + length);
+        return;
+    }
+
+    size_t i = gNumRanges++;
+    while(i && gRanges[i - 1].base > base) {
+        gRanges[i] = gRanges[i - 1];
+        i--;
+    }
+
+    gRanges[i] = {
+        .base   = base,
+        .end    = base + length,
+        .pool   = static_cast<uint8_t>(pool),
+    };
+}
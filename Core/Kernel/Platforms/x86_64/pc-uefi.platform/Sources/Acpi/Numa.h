@@ -0,0 +1,99 @@
+#ifndef KERNEL_PLATFORM_UEFI_ACPI_NUMA_H
+#define KERNEL_PLATFORM_UEFI_ACPI_NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Memory/PhysicalAllocator.h>
+
+namespace Platform::Amd64Uefi::Acpi {
+struct Slit;
+struct Srat;
+
+/**
+ * @brief NUMA topology discovery
+ *
+ * Reads the memory and processor affinity information from the ACPI SRAT, and node distances from
+ * the SLIT if available. Each proximity domain with memory is assigned one physical allocator
+ * pool, in the order in which they appear in the SRAT; memory not described by the SRAT goes to
+ * the first pool.
+ *
+ * If there is no SRAT, the system is treated as having a single node.
+ */
+class Numa {
+    public:
+        Numa() = delete;
+
+        static void Init();
+        static void ApplyDistances();
+
+        static size_t GetPoolForAddress(const uintptr_t address, uintptr_t &outEnd);
+        static size_t GetPoolForApicId(const uint32_t apicId);
+
+        /// Get the number of physical allocator pools required
+        static inline size_t GetNumPools() {
+            return gNumPools;
+        }
+
+    private:
+        /// Maximum number of SRAT memory ranges to consider
+        constexpr static const size_t kMaxMemoryRanges{32};
+        /// Maximum number of processors whose affinity is recorded
+        constexpr static const size_t kMaxProcessors{256};
+        /// Maximum number of pools
+        constexpr static const size_t kMaxPools{Kernel::PhysicalAllocator::kMaxPools};
+
+        /// A range of physical memory belonging to a node
+        struct MemoryRange {
+            /// Physical base address
+            uintptr_t base;
+            /// Physical address past the end of the range
+            uintptr_t end;
+            /// Pool the range is added to
+            uint8_t pool;
+        };
+
+        /// Proximity domain of a processor
+        struct Processor {
+            /// Local APIC ID
+            uint32_t apicId;
+            /// Proximity domain (as read from the SRAT)
+            uint32_t domain;
+            /// Pool closest to the processor
+            uint8_t pool;
+        };
+
+    private:
+        static void ParseSrat(const Srat *srat);
+        static void ParseSlit(const Slit *slit);
+        static void ResolveProcessors(const Slit *slit);
+
+        static size_t GetPoolForDomain(const uint32_t domain, const bool create);
+
+        static void AddMemoryRange(const uint32_t domain, const uintptr_t base,
+                const size_t length);
+
+    private:
+        /// Memory ranges from the SRAT, sorted by base address
+        static MemoryRange gRanges[kMaxMemoryRanges];
+        /// Number of valid memory ranges
+        static size_t gNumRanges;
+
+        /// Processor affinity entries from the SRAT
+        static Processor gProcessors[kMaxProcessors];
+        /// Number of valid processor entries
+        static size_t gNumProcessors;
+
+        /// Proximity domain corresponding to each pool
+        static uint32_t gPoolDomains[kMaxPools];
+        /// Number of pools (always at least one)
+        static size_t gNumPools;
+
+        /// Distance matrix between pools, if known
+        static uint8_t gDistances[kMaxPools * kMaxPools];
+        /// Whether the distance matrix is valid
+        static bool gHasDistances;
+};
+}
+
+#endif
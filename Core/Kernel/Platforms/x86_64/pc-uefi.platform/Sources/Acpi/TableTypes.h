@@ -0,0 +1,147 @@
+#ifndef KERNEL_PLATFORM_UEFI_ACPI_TABLETYPES_H
+#define KERNEL_PLATFORM_UEFI_ACPI_TABLETYPES_H
+
+#include <stdint.h>
+
+#include <Intrinsics.h>
+
+namespace Platform::Amd64Uefi::Acpi {
+/**
+ * @brief Root system description pointer
+ *
+ * The fields following `rsdtAddress` are only valid if the revision is 2 or greater.
+ */
+struct KUSH_PACKED Rsdp {
+    /// Signature; always "RSD PTR "
+    char signature[8];
+    /// Checksum over the first 20 bytes
+    uint8_t checksum;
+    char oemId[6];
+    /// ACPI revision: 0 for ACPI 1.0, 2 for ACPI 2.0 and later
+    uint8_t revision;
+    /// Physical address of the RSDT
+    uint32_t rsdtAddress;
+
+    /// Length of the entire structure
+    uint32_t length;
+    /// Physical address of the XSDT
+    uint64_t xsdtAddress;
+    /// Checksum over the entire structure
+    uint8_t extendedChecksum;
+    uint8_t reserved[3];
+};
+
+/**
+ * @brief Header common to all system description tables
+ */
+struct KUSH_PACKED SdtHeader {
+    /// Table signature
+    char signature[4];
+    /// Length of the entire table, including this header
+    uint32_t length;
+    uint8_t revision;
+    /// Checksum over the entire table
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+};
+
+/**
+ * @brief System resource affinity table (SRAT)
+ *
+ * The header is followed by a variable number of affinity structures, each starting with a
+ * SratEntry header.
+ */
+struct KUSH_PACKED Srat {
+    SdtHeader header;
+    uint32_t reserved1;
+    uint64_t reserved2;
+};
+
+/**
+ * @brief Header of an SRAT affinity structure
+ */
+struct KUSH_PACKED SratEntry {
+    /// Type of the structure
+    enum Type: uint8_t {
+        ProcessorLocalApic                      = 0,
+        Memory                                  = 1,
+        ProcessorLocalX2Apic                    = 2,
+    };
+
+    Type type;
+    /// Length of the structure, in bytes
+    uint8_t length;
+};
+
+/**
+ * @brief SRAT processor local APIC affinity
+ */
+struct KUSH_PACKED SratLocalApic {
+    SratEntry header;
+    /// Bits 7..0 of the proximity domain
+    uint8_t domainLow;
+    /// Local APIC ID of the processor
+    uint8_t apicId;
+    /// Flags; bit 0 indicates the entry is enabled
+    uint32_t flags;
+    uint8_t localSapicEid;
+    /// Bits 31..8 of the proximity domain
+    uint8_t domainHigh[3];
+    uint32_t clockDomain;
+};
+
+/**
+ * @brief SRAT memory affinity
+ */
+struct KUSH_PACKED SratMemory {
+    SratEntry header;
+    /// Proximity domain of the memory range
+    uint32_t domain;
+    uint16_t reserved1;
+    /// Physical base address of the range
+    uint64_t base;
+    /// Length of the range, in bytes
+    uint64_t length;
+    uint32_t reserved2;
+    /// Flags; bit 0 indicates the entry is enabled, bit 1 that the memory is hot pluggable
+    uint32_t flags;
+    uint64_t reserved3;
+};
+
+/**
+ * @brief SRAT processor local x2APIC affinity
+ */
+struct KUSH_PACKED SratLocalX2Apic {
+    SratEntry header;
+    uint16_t reserved1;
+    /// Proximity domain of the processor
+    uint32_t domain;
+    /// x2APIC ID of the processor
+    uint32_t apicId;
+    /// Flags; bit 0 indicates the entry is enabled
+    uint32_t flags;
+    uint32_t clockDomain;
+    uint32_t reserved2;
+};
+
+/**
+ * @brief System locality information table (SLIT)
+ *
+ * The header is followed by a matrix of `numLocalities` by `numLocalities` bytes, where the entry
+ * at `i * numLocalities + j` is the relative distance from locality (proximity domain) `i` to `j`.
+ * The distance from a locality to itself is normalized to 10.
+ */
+struct KUSH_PACKED Slit {
+    SdtHeader header;
+    /// Number of localities in the system
+    uint64_t numLocalities;
+    /// Distance matrix
+    uint8_t entries[];
+};
+}
+
+#endif
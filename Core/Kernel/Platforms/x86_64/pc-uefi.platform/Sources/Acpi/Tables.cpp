@@ -0,0 +1,125 @@
+#include "Tables.h"
+#include "TableTypes.h"
+#include "Boot/Helpers.h"
+
+#include <Logging/Console.h>
+#include <Runtime/String.h>
+
+using namespace Platform::Amd64Uefi::Acpi;
+
+const SdtHeader *Tables::gRoot{nullptr};
+bool Tables::gIsXsdt{false};
+uintptr_t Tables::gHhdmOffset{0};
+
+/**
+ * @brief Compare a table signature.
+ *
+ * @return Whether the first `length` characters of the two signatures are identical
+ */
+static bool SignatureMatches(const char *a, const char *b, const size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        if(a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Locate the root system description table.
+ *
+ * If the bootloader didn't provide an RSDP (or the higher half direct map offset needed to access
+ * the tables) or the tables are invalid, ACPI tables are simply not available.
+ */
+void Tables::Init() {
+    auto rsdpRes = LimineRequests::gAcpiRsdp.response;
+    auto hhdmRes = LimineRequests::gHigherHalf.response;
+    if(!rsdpRes || !rsdpRes->address || !hhdmRes) {
+        Kernel::Console::Warning("ACPI tables not available");
+        return;
+    }
+
+    gHhdmOffset = hhdmRes->offset;
+
+    // validate the RSDP
+    auto rsdp = reinterpret_cast<const Rsdp *>(rsdpRes->address);
+    if(!SignatureMatches(rsdp->signature, "RSD PTR ", sizeof(rsdp->signature)) ||
+            !ValidateChecksum(rsdp, offsetof(Rsdp, length))) {
+        Kernel::Console::Warning("invalid RSDP at %p", rsdp);
+        return;
+    }
+
+    // prefer the XSDT if available
+    const SdtHeader *root{nullptr};
+
+    if(rsdp->revision >= 2 && rsdp->xsdtAddress) {
+        root = reinterpret_cast<const SdtHeader *>(MapPhys(rsdp->xsdtAddress));
+        gIsXsdt = true;
+    } else {
+        root = reinterpret_cast<const SdtHeader *>(MapPhys(rsdp->rsdtAddress));
+        gIsXsdt = false;
+    }
+
+    if(!ValidateChecksum(root, root->length)) {
+        Kernel::Console::Warning("invalid ACPI %s", gIsXsdt ? "XSDT" : "RSDT");
+        return;
+    }
+
+    gRoot = root;
+}
+
+/**
+ * @brief Find a system description table by its signature.
+ *
+ * @param signature Four character table signature, such as `SRAT`
+ * @param instance Index of the table to return, if there are several with the same signature
+ *
+ * @return Pointer to the table's header, or `nullptr` if not found (or invalid)
+ */
+const SdtHeader *Tables::Find(const char *signature, const size_t instance) {
+    if(!gRoot) return nullptr;
+
+    const auto entrySize = gIsXsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+    const auto numEntries = (gRoot->length - sizeof(SdtHeader)) / entrySize;
+    auto entries = reinterpret_cast<const uint8_t *>(gRoot) + sizeof(SdtHeader);
+
+    size_t found{0};
+
+    for(size_t i = 0; i < numEntries; i++) {
+        // entries may not be naturally aligned
+        uint64_t phys{0};
+        memcpy(&phys, entries + (i * entrySize), entrySize);
+        if(!phys) continue;
+
+        auto table = reinterpret_cast<const SdtHeader *>(MapPhys(phys));
+        if(!SignatureMatches(table->signature, signature, sizeof(table->signature))) continue;
+        if(found++ != instance) continue;
+
+        if(!ValidateChecksum(table, table->length)) {
+            Kernel::Console::Warning("invalid ACPI %.4s at %016llx", signature, phys);
+            return nullptr;
+        }
+        return table;
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief Get the virtual address of a physical address in the higher half direct map.
+ */
+const void *Tables::MapPhys(const uintptr_t phys) {
+    return reinterpret_cast<const void *>(gHhdmOffset + phys);
+}
+
+/**
+ * @brief Verify that the bytes of an ACPI structure sum to zero.
+ */
+bool Tables::ValidateChecksum(const void *base, const size_t length) {
+    uint8_t sum{0};
+    auto ptr = reinterpret_cast<const uint8_t *>(base);
+
+    for(size_t i = 0; i < length; i++) {
+        sum += ptr[i];
+    }
+
+    return !sum;
+}
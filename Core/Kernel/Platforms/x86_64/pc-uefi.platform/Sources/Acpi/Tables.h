@@ -0,0 +1,45 @@
+#ifndef KERNEL_PLATFORM_UEFI_ACPI_TABLES_H
+#define KERNEL_PLATFORM_UEFI_ACPI_TABLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Platform::Amd64Uefi::Acpi {
+struct SdtHeader;
+
+/**
+ * @brief Access to the ACPI system description tables
+ *
+ * Locates the root system description table (either the RSDT, or the XSDT on ACPI 2.0 and later)
+ * via the RSDP provided by the bootloader, and allows looking up other tables by signature.
+ *
+ * @remark Tables are accessed through the bootloader's higher half direct map, so they may only
+ *         be used during early boot, before the kernel's memory map is activated.
+ */
+class Tables {
+    public:
+        Tables() = delete;
+
+        static void Init();
+        static const SdtHeader *Find(const char *signature, const size_t instance = 0);
+
+        /// Whether ACPI tables are available
+        static inline bool IsAvailable() {
+            return gRoot != nullptr;
+        }
+
+    private:
+        static const void *MapPhys(const uintptr_t phys);
+        static bool ValidateChecksum(const void *base, const size_t length);
+
+    private:
+        /// Root system description table (RSDT or XSDT)
+        static const SdtHeader *gRoot;
+        /// Whether the root table is an XSDT (with 64-bit entries) rather than an RSDT
+        static bool gIsXsdt;
+        /// Offset of the bootloader's higher half direct map
+        static uintptr_t gHhdmOffset;
+};
+}
+
+#endif
@@ -146,6 +146,24 @@ static const struct {
     {}
 };
 
+/**
+ * Get the local APIC ID of the calling processor.
+ *
+ * If the processor supports the extended topology leaf, the full 32-bit x2APIC ID is returned;
+ * otherwise, it's the 8-bit initial APIC ID.
+ */
+uint32_t Processor::GetApicId() {
+    uint32_t eax, ebx, ecx, edx;
+
+    if(__get_cpuid_max(0, nullptr) >= 0x0B) {
+        __cpuid_count(0x0B, 0, eax, ebx, ecx, edx);
+        if(ebx) return edx;
+    }
+
+    __cpuid(0x01, eax, ebx, ecx, edx);
+    return (ebx >> 24);
+}
+
 /**
  * Ensure all required CPU features are supported.
  *
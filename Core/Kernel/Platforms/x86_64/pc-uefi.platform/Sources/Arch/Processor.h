@@ -104,6 +104,20 @@ class Processor {
         static void VerifyFeatures();
         static void InitFeatures();
 
+        static uint32_t GetApicId();
+
+        /**
+         * Read the processor's timestamp counter.
+         *
+         * This is only useful for measuring short intervals on the same processor; the counter
+         * is not serializing, and may not be synchronized between processors.
+         */
+        static inline uint64_t GetCycleCount() {
+            uint32_t lo, hi;
+            asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+            return (static_cast<uint64_t>(hi) << 32) | lo;
+        }
+
         /**
          * Read a model-specific register.
          */
@@ -8,6 +8,8 @@
 
 using namespace Platform::Amd64Uefi;
 
+uint32_t ProcessorLocals::gNextCpuId{0};
+
 /**
  * @brief Initialize the processor locals for the bootstrap processor
  *
@@ -20,10 +22,29 @@ void ProcessorLocals::InitBsp() {
 
     info->idt = Idt::gBspIdt;
 
+    AssignCpuId(info);
+    REQUIRE(info->kernel.cpuId == 0, "bootstrap processor got cpu id %u", info->kernel.cpuId);
+
     // set it up in the calling processor's %gs
     Set(info);
 }
 
+/**
+ * @brief Assign the next logical processor index to a processor
+ *
+ * This must be called exactly once for each processor's locals as it is brought up, including
+ * application processors, before anything that uses the index (such as the physical page caches
+ * or zone magazines) runs on it.
+ *
+ * @param proc Processor info structure to assign an index to
+ */
+void ProcessorLocals::AssignCpuId(Info *proc) {
+    const auto id = __atomic_fetch_add(&gNextCpuId, 1, __ATOMIC_RELAXED);
+    REQUIRE(id != UINT32_MAX, "cpu id %u is not unique", id);
+
+    proc->kernel.cpuId = id;
+}
+
 /**
  * @brief Update MSRs for %gs base
  *
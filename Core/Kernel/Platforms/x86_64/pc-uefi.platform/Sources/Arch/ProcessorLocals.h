@@ -60,7 +60,12 @@ class ProcessorLocals {
         }
 
     private:
+        static void AssignCpuId(Info *);
         static void Set(Info *);
+
+    private:
+        /// Logical index to assign to the next processor that is brought up
+        static uint32_t gNextCpuId;
 };
 };
 
@@ -26,10 +26,13 @@
 #include <new>
 
 #include "Helpers.h"
+#include "Acpi/Numa.h"
+#include "Acpi/Tables.h"
 #include "Arch/Gdt.h"
 #include "Arch/Idt.h"
 #include "Arch/Processor.h"
 #include "Arch/ProcessorLocals.h"
+#include "Memory/MemoryMap.h"
 #include "Memory/PhysicalMap.h"
 #include "Io/Console.h"
 #include "Util/Backtrace.h"
@@ -53,13 +56,6 @@ extern "C" char __kernel_text_size, __kernel_rodata_size, __kernel_data_size;
  */
 static constexpr const bool kEnableSymbolication{false};
 
-/**
- * @brief Whether all memory ranges are logged
- *
- * Useful for debugging; when enabled, the bootloader-provided memory map is dumped.
- */
-static constexpr const bool kLogMemMap{false};
-
 /**
  * @brief Whether kernel section initialization is logged
  */
@@ -72,25 +68,6 @@ static constexpr const bool kLogSections{true};
  */
 static constexpr const uintptr_t kFramebufferBase{0xffff'e800'0000'0000};
 
-/**
- * Minimum size of physical memory regions to consider for allocation
- *
- * In some cases, the bootloader may provide a very fragmented memory map to the kernel, in which
- * many small chunks are carved out. Since each physical region comes with some fixed overhead, it
- * does not make sense to add these to the allocator and we just ignore that memory.
- *
- * That is to say, all usable memory regions smaller than this constant are wasted.
- */
-constexpr static const size_t kMinPhysicalRegionSize{0x10000};
-
-/**
- * First address for general purpose physical allocation
- *
- * Reserve all memory below this boundary, and do not add it to the general purpose allocator pool;
- * this is used so we can set aside the low 16M of system memory for legacy ISA DMA.
- */
-constexpr static const uintptr_t kPhysAllocationBound{0x1000000};
-
 /**
  * VM object corresponding to the kernel image.
  *
@@ -129,6 +106,7 @@ extern "C" void _osentry() {
 
     // finish BSP initialization
     ProcessorLocals::InitBsp();
+    Kernel::PhysicalAllocator::SetLocalPool(Acpi::Numa::GetPoolForApicId(Processor::GetApicId()));
 
     // then activate the map
     map->activate();
@@ -150,6 +128,21 @@ extern "C" void _osentry() {
         Kernel::Logging::Console::Warning("no SMP info provided (forcing uniprocessor mode!)");
     }
 
+    /*
+     * Nothing provided by the bootloader is needed anymore, so give its memory to the physical
+     * allocator. Any bootloader responses are invalid after this point.
+     *
+     * Application processors are parked in bootloader memory (polling `goto_address` in their
+     * SMP info structure) until they are started, so as long as there are any, the memory has to
+     * be left alone; it can only be reclaimed once they are all running in the kernel.
+     */
+    if(!cpuInfo || cpuInfo->cpu_count <= 1) {
+        Memory::MemoryMap::ReclaimBootloaderMemory();
+    } else {
+        Kernel::Logging::Console::Notice("Not reclaiming bootloader memory (%llu APs parked)",
+                cpuInfo->cpu_count - 1);
+    }
+
     // jump to the kernel's entry point now
     Kernel::Start(map);
     // we should never get here…
@@ -160,61 +153,48 @@ extern "C" void _osentry() {
  * @brief Initialize the physical memory allocator.
  *
  * This initializes the kernel's physical allocator, with our base and extended page sizes. For
- * amd64, we only support 4K and 2M pages, so those are the two page sizes.
+ * amd64, these are 4K, 2M and 1G pages. (Whether 1G pages can actually be mapped depends on the
+ * processor, but the physical allocator can hand them out regardless.)
  *
- * Once the allocator is initialized, go through each of the memory regions provided by the
- * bootloader that are marked as usable. These are guaranteed to at least be 4K aligned which is
- * required by the physical allocator.
+ * If the ACPI SRAT describes multiple NUMA nodes, one pool is created per node, and each memory
+ * region is split up between the pools of the nodes it belongs to. An additional pool holds the
+ * memory below 16M, for devices with limited DMA addressing; it's only used when explicitly
+ * requested.
  *
- * @param info Information structure provided by the bootloader
+ * Once the allocator is initialized, all memory the bootloader marked as usable is added to it.
+ * Bootloader reclaimable memory follows later, in ReclaimBootloaderMemory().
  */
 static void InitPhysAllocator() {
+    // discover NUMA topology, to know how many pools we need
+    Acpi::Tables::Init();
+    Acpi::Numa::Init();
+
+    const auto numNodes = Acpi::Numa::GetNumPools();
+    const bool hasDma = (numNodes < Kernel::PhysicalAllocator::kMaxPools);
+
     // initialize kernel physical allocator
     static const size_t kExtraPageSizes[]{
-        0x200000,
+        0x200000, 0x40000000,
     };
-    Kernel::PhysicalAllocator::Init(0x1000, kExtraPageSizes, 1);
+    Kernel::PhysicalAllocator::Init(0x1000, kExtraPageSizes,
+            sizeof(kExtraPageSizes) / sizeof(kExtraPageSizes[0]), numNodes - (hasDma ? 0 : 1));
 
-    // locate physical memory map and validate it
-    auto map = LimineRequests::gMemMap.response;
-    REQUIRE(map, "Missing loader info struct %s", "phys mem map");
-    REQUIRE(map->entry_count, "Invalid loader info struct %s", "phys mem map");
-    REQUIRE(map->entries, "Invalid loader info struct %s", "phys mem map");
-
-    // add each usable region to the physical allocator
-    for(size_t i = 0; i < map->entry_count; i++) {
-        const auto entry = map->entries[i];
-
-        if(kLogMemMap) {
-            Kernel::Logging::Console::Trace("%02u: %016llx - %016llx %010llx %u", i, entry->base,
-                    entry->base + entry->length, entry->length, entry->type);
-        }
+    if(hasDma) {
+        Kernel::PhysicalAllocator::SetDmaPool(numNodes);
+    } else {
+        Kernel::Logging::Console::Warning("no pool available for DMA memory");
+    }
 
-        // ignore non-usable memory
-        // XXX: is there reclaimable memory or other stuff?
-        if(entry->type != LIMINE_MEMMAP_USABLE) continue;
-        // ignore if it's too small
-        else if(entry->length < kMinPhysicalRegionSize) continue;
-        // if this entire region is below the cutoff, ignore it
-        else if((entry->base + entry->length) < kPhysAllocationBound) continue;
-
-        // adjust the base/length (if needed)
-        uintptr_t base = entry->base;
-        size_t length = entry->length;
-
-        if(base < kPhysAllocationBound) {
-            const auto diff = (kPhysAllocationBound - base);
-            base += diff;
-            length -= diff;
-            // TODO: mark the set aside region for legacy use
-        }
+    // add all usable memory to the allocator, then set up the pool fallback order
+    Memory::MemoryMap::AddUsable();
+    Acpi::Numa::ApplyDistances();
 
-        // add it to the physical allocator
-        Kernel::PhysicalAllocator::AddRegion(base, length);
+    size_t totalPages{0};
+    for(size_t i = 0; i < Kernel::PhysicalAllocator::GetNumPools(); i++) {
+        totalPages += Kernel::PhysicalAllocator::GetTotalPages(i);
     }
 
-    Kernel::Logging::Console::Notice("Available memory: %zu K",
-            Kernel::PhysicalAllocator::GetTotalPages() * 4);
+    Kernel::Logging::Console::Notice("Available memory: %zu K", totalPages * 4);
 }
 
 /**
@@ -117,7 +117,7 @@ static void *gLimineHeaders[] = {
     // required
     &LimineRequests::gStackSize,
     &LimineRequests::gSmp,
-    // &LimineRequests::gHigherHalf,
+    &LimineRequests::gHigherHalf,
     &LimineRequests::gTerminal,
     &LimineRequests::gFramebuffer,
     &LimineRequests::gKernelAddress,
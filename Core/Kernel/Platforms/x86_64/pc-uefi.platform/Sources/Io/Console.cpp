@@ -5,6 +5,7 @@
 
 #include <FbCons/Console.h>
 #include <Logging/Console.h>
+#include <Memory/PhysicalAllocator.h>
 #include <Vm/Map.h>
 #include <Vm/ContiguousPhysRegion.h>
 
@@ -51,7 +52,9 @@ void Console::Init() {
 /**
  * @brief Parse the command line string specified to find all specified output devices.
  *
- * These are specified by the `-console` argument.
+ * These are specified by the `-console` argument. The `-memstats` argument, which selects when
+ * physical allocator statistics are printed, is handled here as well since the console is the
+ * first to see the command line.
  */
 void Console::ParseCmd(const char *cmdline) {
     char ch;
@@ -124,6 +127,9 @@ void Console::ParseCmd(const char *cmdline) {
                         if(!Util::strncmp("console", key, keyLen)) {
                             ParseCmdToken(value, valueLen);
                         }
+                        else if(!Util::strncmp("memstats", key, keyLen)) {
+                            ParseMemStatsToken(value, valueLen);
+                        }
 
                         // reset state for next token
                         state = State::IDLE;
@@ -175,6 +181,49 @@ void Console::ParseCmdToken(const char *value, const size_t valueLen) {
     }
 }
 
+/**
+ * @brief Parse the value for a `memstats` parameter in the command line.
+ *
+ * The value is a comma-separated list of occasions at which the physical allocator statistics
+ * are written to the console:
+ *
+ * - `boot`: Once the kernel has finished initializing
+ * - `panic`: When the kernel panics
+ *
+ * @param value Start of the value of this command token
+ * @param valueLen Number of characters in the command token
+ */
+void Console::ParseMemStatsToken(const char *value, const size_t valueLen) {
+    using Kernel::PhysicalAllocator;
+    uint8_t when{0};
+
+    const auto end = value + valueLen;
+    while(value < end) {
+        const char *item = value;
+        size_t itemLen{0};
+
+        while(value < end && *value != ',') {
+            value++;
+            itemLen++;
+        }
+        // skip the comma
+        value++;
+
+        if(!itemLen) continue;
+
+        if(!Util::strncmp("boot", item, itemLen)) {
+            when |= PhysicalAllocator::kStatsDumpBoot;
+        } else if(!Util::strncmp("panic", item, itemLen)) {
+            when |= PhysicalAllocator::kStatsDumpPanic;
+        } else {
+            Kernel::Console::Warning("unknown memstats option `%.*s`",
+                    static_cast<int>(itemLen), item);
+        }
+    }
+
+    PhysicalAllocator::SetStatsDump(when);
+}
+
 /**
  * @brief Print a message to the console.
  *
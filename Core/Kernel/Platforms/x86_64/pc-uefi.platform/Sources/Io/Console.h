@@ -45,6 +45,7 @@ class Console {
 
         static void ParseCmd(const char *);
         static void ParseCmdToken(const char *, const size_t);
+        static void ParseMemStatsToken(const char *, const size_t);
 
     private:
         /// The limine function type for terminal output
@@ -0,0 +1,320 @@
+#include "MemoryMap.h"
+
+#include "Acpi/Numa.h"
+#include "Boot/Helpers.h"
+#include "Vm/PageTable.h"
+
+#include <Logging/Console.h>
+#include <Memory/PhysicalAllocator.h>
+
+using namespace Platform::Amd64Uefi;
+using namespace Platform::Amd64Uefi::Memory;
+
+MemoryMap::Range MemoryMap::gRanges[kMaxRanges];
+size_t MemoryMap::gNumRanges{0};
+MemoryMap::Span MemoryMap::gReclaimable[kMaxReclaimable];
+size_t MemoryMap::gNumReclaimable{0};
+MemoryMap::Span MemoryMap::gSpans[kMaxSpans];
+size_t MemoryMap::gNumSpans{0};
+uintptr_t MemoryMap::gStackBase{0}, MemoryMap::gStackEnd{0};
+
+/**
+ * @brief Add all usable memory from the bootloader's memory map to the physical allocator.
+ *
+ * Bootloader reclaimable ranges are recorded, so they can be added once the bootloader's data
+ * structures are no longer needed.
+ *
+ * This must be called after the physical allocator (and its DMA pool, if any) is set up.
+ */
+void MemoryMap::AddUsable() {
+    // locate physical memory map and validate it
+    auto map = LimineRequests::gMemMap.response;
+    REQUIRE(map, "Missing loader info struct %s", "phys mem map");
+    REQUIRE(map->entry_count, "Invalid loader info struct %s", "phys mem map");
+    REQUIRE(map->entries, "Invalid loader info struct %s", "phys mem map");
+
+    /*
+     * Figure out where the boot stack lives, since we keep running on it. It's allocated by the
+     * bootloader in reclaimable memory and accessed through the higher half direct map.
+     */
+    const auto pageSz = PageTable::PageSize();
+    const auto stackSize = LimineRequests::gStackSize.stack_size;
+
+    auto sp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    auto hhdm = LimineRequests::gHigherHalf.response;
+    if(hhdm && sp >= hhdm->offset) {
+        sp -= hhdm->offset;
+    }
+
+    gStackBase = (sp - stackSize) & ~(pageSz - 1);
+    gStackEnd = (sp + stackSize + (pageSz - 1)) & ~(pageSz - 1);
+
+    // add each usable range, and record the reclaimable ones for later
+    for(size_t i = 0; i < map->entry_count; i++) {
+        const auto entry = map->entries[i];
+
+        if(kLogMemMap) {
+            Kernel::Console::Trace("%02u: %016llx - %016llx %010llx %u", i, entry->base,
+                    entry->base + entry->length, entry->length, entry->type);
+        }
+
+        if(entry->type == LIMINE_MEMMAP_USABLE) {
+            AddRange(entry->base, entry->base + entry->length);
+        } else if(entry->type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE) {
+            if(gNumReclaimable == kMaxReclaimable) {
+                Kernel::Console::Warning("too many reclaimable ranges, ignoring %016llx - %016llx",
+                        entry->base, entry->base + entry->length);
+                continue;
+            }
+
+            gReclaimable[gNumReclaimable++] = {
+                .base = entry->base,
+                .end = entry->base + entry->length,
+            };
+        }
+    }
+
+    AddRegions();
+}
+
+/**
+ * @brief Add the memory used by the bootloader to the physical allocator.
+ *
+ * Reclaimable memory that lies in a hole of an existing region is released into that region;
+ * everything else is combined with any ranges that were previously too small to add, and added
+ * as new regions. The boot stack is left alone.
+ *
+ * @remark After this call, none of the bootloader's responses (or the memory map) may be
+ *         accessed anymore; application processors must also have been started, since they are
+ *         parked in bootloader memory.
+ */
+void MemoryMap::ReclaimBootloaderMemory() {
+    const auto before = GetTotalPages();
+
+    for(size_t i = 0; i < gNumReclaimable; i++) {
+        const auto &range = gReclaimable[i];
+
+        // skip the part of the range that holds the boot stack
+        if(range.base < gStackEnd && range.end > gStackBase) {
+            if(range.base < gStackBase) ReclaimRange(range.base, gStackBase);
+            if(range.end > gStackEnd) ReclaimRange(gStackEnd, range.end);
+        } else {
+            ReclaimRange(range.base, range.end);
+        }
+    }
+
+    gNumReclaimable = 0;
+    AddRegions();
+
+    // whatever remains is too small to be useful
+    size_t wasted{0};
+    for(size_t i = 0; i < gNumRanges; i++) {
+        wasted += gRanges[i].end - gRanges[i].base;
+    }
+
+    const auto reclaimed = GetTotalPages() - before;
+    Kernel::Console::Notice("Reclaimed bootloader memory: %zu K (%zu K unused)",
+            (reclaimed * PageTable::PageSize()) / 1024, wasted / 1024);
+}
+
+/**
+ * @brief Reclaim a single range of bootloader memory.
+ *
+ * Parts of the range that are covered by an existing region are unreserved in that region, while
+ * the rest is queued up to be added as new regions.
+ *
+ * @param base Physical base address of the range
+ * @param end Physical address past the end of the range
+ */
+void MemoryMap::ReclaimRange(uintptr_t base, const uintptr_t end) {
+    while(base < end) {
+        // find the lowest region overlapping the rest of the range
+        const Span *span{nullptr};
+        for(size_t i = 0; i < gNumSpans; i++) {
+            const auto &candidate = gSpans[i];
+            if(candidate.end <= base || candidate.base >= end) continue;
+
+            if(!span || candidate.base < span->base) span = &candidate;
+        }
+
+        if(!span) {
+            AddRange(base, end);
+            return;
+        }
+
+        // anything below the region needs a new region; the overlapping part goes back into it
+        if(span->base > base) {
+            AddRange(base, span->base);
+            base = span->base;
+        }
+
+        const auto partEnd = (span->end < end) ? span->end : end;
+        Kernel::PhysicalAllocator::UnreserveRange(base, partEnd - base, span->pool);
+
+        base = partEnd;
+    }
+}
+
+/**
+ * @brief Queue a range of usable memory to be added to the allocator.
+ *
+ * The range is split up by the pools that the memory belongs to, and each piece is inserted into
+ * the sorted range list.
+ *
+ * @param base Physical base address of the range
+ * @param end Physical address past the end of the range
+ */
+void MemoryMap::AddRange(uintptr_t base, uintptr_t end) {
+    const auto pageSz = PageTable::PageSize();
+    const auto dmaPool = Kernel::PhysicalAllocator::GetDmaPool();
+    const bool hasDma = (dmaPool != Kernel::PhysicalAllocator::kLocalPool);
+
+    if(base < kMinAddress) base = kMinAddress;
+    base = (base + (pageSz - 1)) & ~(pageSz - 1);
+    end &= ~(pageSz - 1);
+
+    while(base < end) {
+        size_t pool;
+        uintptr_t pieceEnd;
+
+        if(hasDma && base < kDmaLimit) {
+            pool = dmaPool;
+            pieceEnd = kDmaLimit;
+        } else {
+            pool = Acpi::Numa::GetPoolForAddress(base, pieceEnd);
+        }
+
+        if(pieceEnd > end) pieceEnd = end;
+
+        if(gNumRanges == kMaxRanges) {
+            Kernel::Console::Warning("too many memory ranges, ignoring %016zx - %016zx", base,
+                    end);
+            return;
+        }
+
+        // insert it, keeping the list sorted
+        size_t pos = gNumRanges++;
+        while(pos && gRanges[pos - 1].base > base) {
+            gRanges[pos] = gRanges[pos - 1];
+            pos--;
+        }
+
+        gRanges[pos] = {
+            .base = base,
+            .end = pieceEnd,
+            .pool = static_cast<uint8_t>(pool),
+            .added = false,
+        };
+
+        base = pieceEnd;
+    }
+}
+
+/**
+ * @brief Create regions for all queued ranges.
+ *
+ * Consecutive ranges in the same pool that are separated by holes no larger than kMaxHoleSize are
+ * grouped into a single region. The region's metadata is placed at the start of the first range
+ * in the group, so leading ranges that are too small to hold it are left out.
+ *
+ * Groups with too little usable memory to be worth a region are kept in the range list, so that
+ * they may be combined with other memory later.
+ */
+void MemoryMap::AddRegions() {
+    size_t first{0};
+
+    while(first < gNumRanges) {
+        // find the end of the group
+        const auto pool = gRanges[first].pool;
+        size_t last{first + 1};
+
+        while(last < gNumRanges && gRanges[last].pool == pool &&
+                (gRanges[last].base - gRanges[last - 1].end) <= kMaxHoleSize) {
+            last++;
+        }
+
+        const auto groupEnd = last;
+
+        // the first range must be able to hold the metadata for the entire group
+        const auto end = gRanges[last - 1].end;
+        while(first < last && (gRanges[first].end - gRanges[first].base) <=
+                Kernel::PhysicalAllocator::GetRegionOverhead(end - gRanges[first].base)) {
+            first++;
+        }
+
+        // add it, if it's got enough usable memory
+        size_t usable{0};
+        for(size_t i = first; i < last; i++) {
+            usable += gRanges[i].end - gRanges[i].base;
+        }
+
+        if(first < last && usable >= kMinPhysicalRegionSize) {
+            AddRegion(first, last);
+        }
+
+        first = groupEnd;
+    }
+
+    // remove all ranges that were added
+    size_t out{0};
+    for(size_t i = 0; i < gNumRanges; i++) {
+        if(gRanges[i].added) continue;
+        gRanges[out++] = gRanges[i];
+    }
+    gNumRanges = out;
+}
+
+/**
+ * @brief Add a region covering a group of ranges.
+ *
+ * The holes between the ranges are reserved as part of adding the region, so that none of their
+ * pages (which may hold the boot stack, ACPI tables or the kernel image) can ever be allocated.
+ *
+ * @param first Index of the first range in the group
+ * @param last Index one past the last range in the group
+ */
+void MemoryMap::AddRegion(const size_t first, const size_t last) {
+    const auto base = gRanges[first].base, end = gRanges[last - 1].end;
+    const auto pool = gRanges[first].pool;
+
+    if(gNumSpans == kMaxSpans) {
+        Kernel::Console::Warning("too many regions, ignoring %016zx - %016zx", base, end);
+        return;
+    }
+
+    Kernel::PhysicalAllocator::ReservedRange holes[kMaxRanges];
+    size_t numHoles{0};
+
+    for(size_t i = first + 1; i < last; i++) {
+        const auto holeBase = gRanges[i - 1].end;
+        if(gRanges[i].base != holeBase) {
+            holes[numHoles++] = {
+                .base = holeBase,
+                .length = gRanges[i].base - holeBase,
+            };
+        }
+    }
+
+    Kernel::PhysicalAllocator::AddRegion(base, end - base, pool, holes, numHoles);
+
+    for(size_t i = first; i < last; i++) {
+        gRanges[i].added = true;
+    }
+
+    gSpans[gNumSpans++] = {
+        .base = base,
+        .end = end,
+        .pool = pool,
+    };
+}
+
+/**
+ * @brief Get the total number of allocatable pages in all pools.
+ */
+size_t MemoryMap::GetTotalPages() {
+    size_t total{0};
+    for(size_t i = 0; i < Kernel::PhysicalAllocator::GetNumPools(); i++) {
+        total += Kernel::PhysicalAllocator::GetTotalPages(i);
+    }
+    return total;
+}
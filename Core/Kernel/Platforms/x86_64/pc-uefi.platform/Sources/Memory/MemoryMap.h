@@ -0,0 +1,114 @@
+#ifndef KERNEL_PLATFORM_UEFI_MEMORY_MEMORYMAP_H
+#define KERNEL_PLATFORM_UEFI_MEMORY_MEMORYMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Platform::Amd64Uefi::Memory {
+/**
+ * @brief Hands the memory described by the bootloader's memory map to the physical allocator
+ *
+ * Usable memory is split up by the pool it belongs to: memory below 16M goes to the DMA pool (if
+ * the physical allocator has one) while everything else goes to the pool of its NUMA node.
+ *
+ * The memory map can be quite fragmented, and each physical allocator region comes with some
+ * fixed overhead. Rather than ignoring small ranges, adjacent ranges in the same pool that are
+ * separated by only small holes are combined into a single region, and the holes are reserved.
+ * Any ranges that are still too small to be worth a region are kept around and reconsidered when
+ * the bootloader reclaimable memory is added.
+ */
+class MemoryMap {
+    public:
+        MemoryMap() = delete;
+
+        static void AddUsable();
+        static void ReclaimBootloaderMemory();
+
+    private:
+        /// Maximum number of ranges that can be waiting to be added to the allocator
+        constexpr static const size_t kMaxRanges{128};
+        /// Maximum number of bootloader reclaimable ranges
+        constexpr static const size_t kMaxReclaimable{64};
+        /// Maximum number of regions that can be added
+        constexpr static const size_t kMaxSpans{64};
+
+        /**
+         * Minimum amount of usable memory in a physical allocator region
+         *
+         * Groups of ranges with less usable memory than this aren't worth the fixed overhead of
+         * a region, and are left out.
+         */
+        constexpr static const size_t kMinPhysicalRegionSize{0x10000};
+
+        /**
+         * Largest hole between two ranges that may be spanned by a single region
+         *
+         * Holes cost one bit of bitmap per page, which is far less than the overhead of another
+         * region for small holes.
+         */
+        constexpr static const size_t kMaxHoleSize{0x100000};
+
+        /// Memory below this address is placed in the DMA pool
+        constexpr static const uintptr_t kDmaLimit{0x1000000};
+        /// Lowest address that may be allocated (so that the zero page is never handed out)
+        constexpr static const uintptr_t kMinAddress{0x1000};
+
+        /**
+         * @brief Whether all memory ranges are logged
+         *
+         * Useful for debugging; when enabled, the bootloader-provided memory map is dumped.
+         */
+        constexpr static const bool kLogMemMap{false};
+
+        /// A range of usable memory that's waiting to be added to the allocator
+        struct Range {
+            /// Physical base address
+            uintptr_t base;
+            /// Physical address past the end of the range
+            uintptr_t end;
+            /// Pool to add the range to
+            uint8_t pool;
+            /// Set once the range has been added to a region
+            bool added;
+        };
+
+        /// A range of physical memory covered by a region
+        struct Span {
+            /// Physical base address
+            uintptr_t base;
+            /// Physical address past the end of the range
+            uintptr_t end;
+            /// Pool the region belongs to
+            uint8_t pool;
+        };
+
+    private:
+        static void ReclaimRange(uintptr_t base, const uintptr_t end);
+        static void AddRange(uintptr_t base, uintptr_t end);
+        static void AddRegions();
+        static void AddRegion(const size_t first, const size_t last);
+
+        static size_t GetTotalPages();
+
+    private:
+        /// Ranges waiting to be added, sorted by base address
+        static Range gRanges[kMaxRanges];
+        /// Number of valid entries in the range list
+        static size_t gNumRanges;
+
+        /// Bootloader reclaimable memory (only base and end are valid)
+        static Span gReclaimable[kMaxReclaimable];
+        /// Number of reclaimable ranges
+        static size_t gNumReclaimable;
+
+        /// Physical memory covered by each region added so far
+        static Span gSpans[kMaxSpans];
+        /// Number of regions added
+        static size_t gNumSpans;
+
+        /// Physical address range of the boot stack, which can never be reclaimed
+        static uintptr_t gStackBase, gStackEnd;
+};
+}
+
+#endif
@@ -54,6 +54,17 @@ enum KernelAddressLayout: uintptr_t {
     /// End of the kernel file image
     KernelImageEnd                                      = 0xffff'8200'41ff'0000,
 
+    /**
+     * @brief Page frame database
+     *
+     * Array of information about each physical page, indexed by page frame number. It is only
+     * partially backed by memory, where physical memory exists. This is 8G in size, which covers
+     * the 2T of physical memory accessible through the aperture, at 16 bytes per page.
+     */
+    PageFrameDbStart                                    = 0xffff'8280'0000'0000,
+    /// End of the page frame database
+    PageFrameDbEnd                                      = 0xffff'8281'ffff'ffff,
+
 
 
     /**
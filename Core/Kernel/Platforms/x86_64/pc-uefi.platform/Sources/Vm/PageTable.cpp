@@ -4,7 +4,6 @@
 
 #include <Logging/Console.h>
 #include <Memory/PhysicalAllocator.h>
-#include <Runtime/String.h>
 #include <Vm/Map.h>
 
 using Kernel::Logging::Console;
@@ -114,43 +113,16 @@ void PageTable::mapPhysAperture() {
 
 
 /**
- * @brief Maps a single page into the page table, allocating any intermediary paging structures as needed.
+ * @brief Locate the page directory covering an address, allocating paging structures as needed.
  *
- * @param phys Physical address to map to
- * @param _virt Virtual address to map
- * @param mode Page access mode
+ * @param _virt Canonical virtual address
+ * @param outPdtAddr Variable to receive the physical address of the page directory
  *
  * @return 0 on success or a negative error code
  */
-int PageTable::mapPage(const uint64_t phys, const uintptr_t _virt, const Kernel::Vm::Mode mode) {
-    uintptr_t ptAddr{0};
-    bool write, global{false}, user, execute;
-
-    user = TestFlags(mode & Kernel::Vm::Mode::UserMask);
-    write = TestFlags(mode & Kernel::Vm::Mode::Write);
-    execute = TestFlags(mode & Kernel::Vm::Mode::Execute);
-
-    // ensure virtual address is canonical
-    if(_virt > 0x00007FFFFFFFFFFF && _virt < 0xFFFF800000000000) {
-        // TODO: error code enum
-        return -1000;
-    }
-
-    // TODO: redirect all upper mapping requests to kernel map
-
-     /*
-     * Step through the PML4, PDPT, PDT, and eventually locate the address of the page table in
-     * physical memory. If needed, we'll allocate pages for all of these. If there exists a mapping
-     * for a larger page (for example, a 2M page in place of a page table pointer) we'll fail out.
-     */
+int PageTable::getPageDirectory(const uintptr_t _virt, uintptr_t &outPdtAddr) {
     const auto virt = _virt & 0xFFFFFFFFFFFF;
 
-    if(kLogMapAdd) {
-        Console::Trace("Adding mapping: virt $%016llx -> phys $%016llx r%s%s %s%s", _virt, phys,
-                write ? "w" : "", execute ? "x" : "", global ? "global " : "",
-                user ? "user" : "");
-    }
-
     // read the PML4 entry
     const auto pml4eIdx = (virt >> 39) & 0x1FF;
     auto pml4e = ReadTable(this->pml4Phys, pml4eIdx);
@@ -215,8 +187,55 @@ int PageTable::mapPage(const uint64_t phys, const uintptr_t _virt, const Kernel:
         return -1002;
     }
 
-    // read the page directory entry to find page table
-    const auto pdtAddr = (pdpte & ~0xFFF) & ~static_cast<uintptr_t>(PageFlags::FlagsMask);
+    outPdtAddr = (pdpte & ~0xFFF) & ~static_cast<uintptr_t>(PageFlags::FlagsMask);
+    return 0;
+}
+
+/**
+ * @brief Maps a single page into the page table, allocating any intermediary paging structures as needed.
+ *
+ * @param phys Physical address to map to
+ * @param _virt Virtual address to map
+ * @param mode Page access mode
+ *
+ * @return 0 on success or a negative error code
+ */
+int PageTable::mapPage(const uint64_t phys, const uintptr_t _virt, const Kernel::Vm::Mode mode) {
+    uintptr_t ptAddr{0};
+    bool write, global{false}, user, execute;
+
+    user = TestFlags(mode & Kernel::Vm::Mode::UserMask);
+    write = TestFlags(mode & Kernel::Vm::Mode::Write);
+    execute = TestFlags(mode & Kernel::Vm::Mode::Execute);
+
+    // ensure virtual address is canonical
+    if(_virt > 0x00007FFFFFFFFFFF && _virt < 0xFFFF800000000000) {
+        // TODO: error code enum
+        return -1000;
+    }
+
+    // TODO: redirect all upper mapping requests to kernel map
+
+     /*
+     * Step through the PML4, PDPT, PDT, and eventually locate the address of the page table in
+     * physical memory. If needed, we'll allocate pages for all of these. If there exists a mapping
+     * for a larger page (for example, a 2M page in place of a page table pointer) we'll fail out.
+     */
+    const auto virt = _virt & 0xFFFFFFFFFFFF;
+
+    if(kLogMapAdd) {
+        Console::Trace("Adding mapping: virt $%016llx -> phys $%016llx r%s%s %s%s", _virt, phys,
+                write ? "w" : "", execute ? "x" : "", global ? "global " : "",
+                user ? "user" : "");
+    }
+
+    // find (or allocate) the page directory
+    uintptr_t pdtAddr;
+    int err = this->getPageDirectory(_virt, pdtAddr);
+    if(err) {
+        return err;
+    }
+
     auto pdte = ReadTable(pdtAddr, (virt >> 21) & 0x1FF);
 
     if(!(pdte & (1 << 0))) { // allocate a page table
@@ -273,6 +292,79 @@ int PageTable::mapPage(const uint64_t phys, const uintptr_t _virt, const Kernel:
     return 0;
 }
 
+/**
+ * @brief Maps a single large page into the page table, using a page directory entry.
+ *
+ * Intermediary paging structures are allocated as needed. The page directory entry must not be in
+ * use yet: if there is already a page table (even an empty one) for the range, this fails and the
+ * caller should map the range with regular pages instead.
+ *
+ * @param phys Physical address to map to; must be aligned to the large page size
+ * @param _virt Virtual address to map; must be aligned to the large page size
+ * @param mode Page access mode
+ *
+ * @return 0 on success or a negative error code
+ */
+int PageTable::mapLargePage(const uint64_t phys, const uintptr_t _virt,
+        const Kernel::Vm::Mode mode) {
+    bool write, global{false}, user, execute;
+
+    user = TestFlags(mode & Kernel::Vm::Mode::UserMask);
+    write = TestFlags(mode & Kernel::Vm::Mode::Write);
+    execute = TestFlags(mode & Kernel::Vm::Mode::Execute);
+
+    // ensure virtual address is canonical and both addresses are aligned
+    if(_virt > 0x00007FFFFFFFFFFF && _virt < 0xFFFF800000000000) {
+        // TODO: error code enum
+        return -1000;
+    } else if((phys % LargePageSize()) || (_virt % LargePageSize())) {
+        return -1004;
+    }
+
+    const auto virt = _virt & 0xFFFFFFFFFFFF;
+
+    if(kLogMapAdd) {
+        Console::Trace("Adding large mapping: virt $%016llx -> phys $%016llx r%s%s %s%s", _virt,
+                phys, write ? "w" : "", execute ? "x" : "", global ? "global " : "",
+                user ? "user" : "");
+    }
+
+    // find (or allocate) the page directory
+    uintptr_t pdtAddr;
+    int err = this->getPageDirectory(_virt, pdtAddr);
+    if(err) {
+        return err;
+    }
+
+    // the page directory entry must be unused
+    if(ReadTable(pdtAddr, (virt >> 21) & 0x1FF) & (1 << 0)) {
+        // TODO: error code enum
+        return -1003;
+    }
+
+    // build the page directory entry
+    uint64_t pde = (phys & ~0x1FFFFF) & ~static_cast<uint64_t>(PageFlags::FlagsMask);
+
+    pde |= static_cast<uint64_t>(PageFlags::Present);
+    pde |= (1 << 7); // page size
+
+    if(write) {
+        pde |= static_cast<uint64_t>(PageFlags::Writable);
+    }
+    if(global) {
+        pde |= static_cast<uint64_t>(PageFlags::Global);
+    }
+    if(user) {
+        pde |= static_cast<uint64_t>(PageFlags::UserAccess);
+    }
+    if(!execute && kNoExecuteEnabled) {
+        pde |= static_cast<uint64_t>(PageFlags::NoExecute);
+    }
+
+    WriteTable(pdtAddr, (virt >> 21) & 0x1FF, pde);
+    return 0;
+}
+
 /**
  * @brief Unmap a single page
  *
@@ -432,6 +524,23 @@ int PageTable::unmap(const uintptr_t virt, const size_t length) {
  * @return 0 if the address is unmapped, 1 if it was mapped, or a negative error code.
  */
 int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm::Mode &outMode) {
+    size_t pageSize;
+    return this->getPhysAddr(_virt, outPhys, outMode, pageSize);
+}
+
+/**
+ * @brief Resolve a virtual address to physical, and get the size of the page it's mapped by
+ *
+ * @param _virt Virtual address to look up
+ * @param outPhys Variable to receive the corresponding physical address
+ * @param outMode Access permissions of the page
+ * @param outPageSize Variable to receive the size of the page (regular or large) mapping the
+ *        address
+ *
+ * @return 0 if the address is unmapped, 1 if it was mapped, or a negative error code.
+ */
+int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm::Mode &outMode,
+        size_t &outPageSize) {
     // ensure virtual address is canonical
     if(_virt > 0x00007FFFFFFFFFFF && _virt < 0xFFFF800000000000) {
         // TODO: error code enum
@@ -468,7 +577,8 @@ int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm:
         DecodePTE(pdpte, outPhys, outMode);
         outPhys &= ~0x3FFFFFFF;
         outPhys += (_virt & 0x3FFFFFFF);
-        return 0;
+        outPageSize = 0x40000000;
+        return 1;
     }
 
     // read the page directory entry to find page table
@@ -484,7 +594,8 @@ int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm:
         DecodePTE(pdte, outPhys, outMode);
         outPhys &= ~0x1FFFFF;
         outPhys += (_virt & 0x1FFFFF);
-        return 0;
+        outPageSize = LargePageSize();
+        return 1;
     }
 
     const auto ptAddr = (pdte & ~0xFFF) & ~static_cast<uintptr_t>(PageFlags::FlagsMask);
@@ -499,6 +610,7 @@ int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm:
     // decode the page information
     DecodePTE(pte, outPhys, outMode);
     outPhys += (_virt & 0xFFF);
+    outPageSize = PageSize();
 
     return 1;
 }
@@ -506,12 +618,22 @@ int PageTable::getPhysAddr(const uintptr_t _virt, uint64_t &outPhys, Kernel::Vm:
 /**
  * @brief Invalidate a range of virtual memory
  *
- * Invalidate the TLB for all addresses in the specified range.
+ * Invalidate the TLB for all addresses in the specified range. If the `InvalidateEntire` hint is
+ * given, the range is ignored and the whole TLB is flushed instead, by toggling the global pages
+ * enable bit in CR4.
  *
  * @TODO Benchmark and optimize if this naiive approach is too slow
  */
 int PageTable::invalidateTlb(const uintptr_t virt, const size_t length,
-        const Kernel::Vm::TlbInvalidateHint) {
+        const Kernel::Vm::TlbInvalidateHint hints) {
+    if(TestFlags(hints & Kernel::Vm::TlbInvalidateHint::InvalidateEntire)) {
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" : : "r"(cr4 ^ (1ULL << 7)) : "memory");
+        asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+        return 0;
+    }
+
     const size_t numPages = NearestPageSize(length) / PageSize();
 
     for(size_t i = 0; i < numPages; i++) {
@@ -557,16 +679,11 @@ uint64_t *PageTable::GetTableVmAddr(const uint64_t phys) {
  * @return Address of a physical memory page, or 0 on error.
  */
 uint64_t PageTable::AllocPage() {
-    // try to allocate page
+    // try to allocate a zeroed page
     uint64_t page;
-    int err = Kernel::PhysicalAllocator::AllocatePage(page);
+    int err = Kernel::PhysicalAllocator::AllocatePage(page, true);
     REQUIRE(err == 1, "failed to allocate page: %d", err);
 
-    // zeroize it
-    // TODO: physical allocator should zero memory for us!
-    auto ptr = GetTableVmAddr(page);
-    memset(ptr, 0, PageSize());
-
     return page;
 }
 
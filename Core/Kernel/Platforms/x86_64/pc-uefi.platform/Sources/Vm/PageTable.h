@@ -81,6 +81,17 @@ class PageTable {
             return 4096;
         }
 
+        /**
+         * @brief Get the size of large pages
+         *
+         * These are mapped by a single page directory entry.
+         *
+         * @return Large page size, in bytes
+         */
+        constexpr static inline size_t LargePageSize() {
+            return 0x200000;
+        }
+
         /**
          * @brief Round up a size to the nearest page multiple
          */
@@ -94,11 +105,15 @@ class PageTable {
 
         [[nodiscard]] int mapPage(const uint64_t phys, const uintptr_t virt,
                 const Kernel::Vm::Mode mode);
+        [[nodiscard]] int mapLargePage(const uint64_t phys, const uintptr_t virt,
+                const Kernel::Vm::Mode mode);
         [[nodiscard]] int unmapPage(const uintptr_t virt);
         [[nodiscard]] int unmap(const uintptr_t virt, const size_t length);
 
         [[nodiscard]] int getPhysAddr(const uintptr_t virt, uint64_t &outPhys,
                 Kernel::Vm::Mode &outMode);
+        [[nodiscard]] int getPhysAddr(const uintptr_t virt, uint64_t &outPhys,
+                Kernel::Vm::Mode &outMode, size_t &outPageSize);
         [[nodiscard]] int invalidateTlb(const uintptr_t virt, const size_t length,
                 const Kernel::Vm::TlbInvalidateHint hints);
 
@@ -109,6 +124,7 @@ class PageTable {
         void copyPml4Upper(PageTable *);
         void mapPhysAperture();
 
+        [[nodiscard]] int getPageDirectory(const uintptr_t virt, uintptr_t &outPdtAddr);
         [[nodiscard]] int unmapPage(const uintptr_t virt, const bool unmapLargePages);
 
         [[nodiscard]] static uint64_t AllocPage();
@@ -4,13 +4,20 @@
 #include <BuildInfo.h>
 #include <Init.h>
 #include <Logging/Console.h>
+#include <Memory/PageFrameDb.h>
+#include <Memory/PhysicalAllocator.h>
 #include <Vm/Map.h>
+#include <Vm/ZoneAllocator.h>
 
 #include "Vm/ContiguousPhysRegion.h"
+#include "Vm/Heap.h"
 #include "Vm/PageAllocator.h"
 
 using namespace Kernel;
 
+/// Number of physical pages to zero ahead of time during initialization
+constexpr static const size_t kInitialZeroedPages{256};
+
 /**
  * @brief Print the startup banner
  */
@@ -25,10 +32,16 @@ static void PrintBanner() {
  * @Brief Initialize memory allocators
  */
 static void InitAllocators() {
+    PhysicalAllocator::EnableCpuCaches();
+    Memory::PageFrameDb::Enable();
     Vm::PageAllocator::Init();
+    Vm::Heap::Init();
 
     Vm::Map::InitZone();
     Vm::ContiguousPhysRegion::InitZone();
+
+    Vm::ZoneAllocatorBase::EnableMagazines();
+    Vm::ZoneAllocatorBase::EnablePressureHandler();
 }
 
 /**
@@ -59,6 +72,15 @@ void Kernel::Start(Kernel::Vm::Map *map) {
 
     InitAllocators();
 
+    // TODO: move this into the idle thread once the scheduler exists
+    PhysicalAllocator::ZeroFreePages(kInitialZeroedPages);
+    Vm::PageAllocator::FlushDeferred();
+    Vm::ZoneAllocatorBase::ReleaseRetired();
+    PhysicalAllocator::DumpStats(PhysicalAllocator::kStatsDumpBoot);
+    if(PhysicalAllocator::WantsStatsDump(PhysicalAllocator::kStatsDumpBoot)) {
+        Vm::ZoneAllocatorBase::DumpStats();
+        Vm::PageAllocator::DumpStats();
+    }
 
     // TODO: initialize handle, object and syscall managers
 
@@ -1,5 +1,7 @@
 #include "Logging/Console.h"
+#include "Memory/PhysicalAllocator.h"
 #include "Runtime/Printf.h"
+#include "Vm/ZoneAllocator.h"
 #include "BuildInfo.h"
 
 #include <Platform.h>
@@ -86,6 +88,9 @@ void Console::Panic(const char *fmt, ...) {
     // format panic message
     static constexpr const size_t kMsgBufChars{1024};
     static char panicMsgBuf[kMsgBufChars];
+    // set once the first panic is underway, so a panic while dumping state doesn't recurse
+    static bool gPanicking{false};
+    const bool nested = __atomic_exchange_n(&gPanicking, true, __ATOMIC_RELAXED);
 
     va_start(va, fmt);
     vsnprintf_(panicMsgBuf, kMsgBufChars, fmt, va);
@@ -98,6 +103,13 @@ void Console::Panic(const char *fmt, ...) {
     Platform::Backtrace::Print(nullptr, panicMsgBuf, kMsgBufChars, true, 1);
     Error("Backtrace:%s", panicMsgBuf);
 
+    if(!nested) {
+        PhysicalAllocator::DumpStats(PhysicalAllocator::kStatsDumpPanic);
+        if(PhysicalAllocator::WantsStatsDump(PhysicalAllocator::kStatsDumpPanic)) {
+            Vm::ZoneAllocatorBase::DumpStats();
+        }
+    }
+
     // halt machine
     Hang();
 }
@@ -0,0 +1,704 @@
+#include "Memory/BuddyRegion.h"
+#include "Memory/PhysicalAllocator.h"
+#include "Memory/Pool.h"
+
+#include "Logging/Console.h"
+#include "Runtime/String.h"
+#include "Vm/Map.h"
+#include "Vm/ContiguousPhysRegion.h"
+
+#include <Intrinsics.h>
+#include <Platform.h>
+#include <new>
+
+using namespace Kernel::Memory;
+
+// space in .bss segment for VM objects
+static KUSH_ALIGNED(64) uint8_t gVmObjectAllocBuf[Pool::kStaticRegions][sizeof(Kernel::Vm::ContiguousPhysRegion)];
+// index for the next available VM object
+static size_t gVmObjectAllocNextFree{0};
+
+/**
+ * @brief Initialize a new buddy managed region of physical memory.
+ *
+ * The page information array is placed at the start of the region; the remaining pages are then
+ * split into the largest naturally aligned blocks possible, which are added to the free lists.
+ *
+ * We'll also allocate a VM object to represent the page information array in the kernel's address
+ * space. This is not yet mapped; a later call to applyVirtualMap() will do that.
+ *
+ * @param pool The allocation pool this region belongs to
+ * @param base Physical base address of this region
+ * @param length Number of bytes in this region
+ */
+BuddyRegion::BuddyRegion(Pool *pool, const uintptr_t base, const size_t length) :
+    physBase(base) {
+    int err;
+
+    REQUIRE(length, "invalid %s", "length");
+    REQUIRE(pool, "invalid %s", "pool");
+
+    // convert length into pages
+    const auto pageSz = pool->allocator->getPageSize();
+    this->numPages = length / pageSz;
+
+    // reserve space for the page information array (for the worst case of all pages)
+    const auto metadataBytes = this->numPages * sizeof(PageInfo);
+    const auto metadataPages = GetMetadataSize(pool->allocator, length) / pageSz;
+    REQUIRE(metadataPages < this->numPages, "region too small (%zu pages)", this->numPages);
+
+    this->totalPages = this->numPages - metadataPages;
+    REQUIRE(this->totalPages < kNone, "region too large (%zu pages)", this->totalPages);
+
+    this->metadataPhys = base;
+    this->metadataReserved = metadataPages * pageSz;
+
+    this->allocBasePhys = base + this->metadataReserved;
+    this->allocEndPhys = this->allocBasePhys + (this->totalPages * pageSz);
+    this->pfnBase = this->allocBasePhys / pageSz;
+
+    // map and clear the page information array
+    void *addr{nullptr};
+    err = Platform::Memory::PhysicalMap::Add(this->metadataPhys, this->metadataReserved, &addr);
+    REQUIRE(!err, "failed to map region metadata: %d", err);
+
+    this->setMetadataBase(addr);
+    memset(this->info, 0, metadataBytes);
+
+    for(size_t i = 0; i <= kMaxOrder; i++) {
+        this->freeHeads[i] = kNone;
+        this->freeCounts[i] = 0;
+    }
+
+    // carve the allocatable pages into naturally aligned blocks
+    for(size_t page = 0; page < this->totalPages; ) {
+        const auto pfn = this->pfnBase + page;
+        size_t order = pfn ? __builtin_ctzll(pfn) : kMaxOrder;
+        if(order > kMaxOrder) order = kMaxOrder;
+
+        while(page + (1ULL << order) > this->totalPages) order--;
+
+        this->pushFree(page, order);
+        page += (1ULL << order);
+    }
+
+    // count the naturally aligned frames of each extra page size
+    auto allocator = pool->allocator;
+    this->numLargeSizes = allocator->getNumExtraPageSizes();
+
+    for(size_t i = 0; i < this->numLargeSizes; i++) {
+        const auto order = allocator->getExtraPageSizeLog2(i);
+        const size_t frameMask = (1ULL << order) - 1;
+
+        const auto first = (this->pfnBase + frameMask) & ~frameMask;
+        const auto last = (this->pfnBase + this->totalPages) & ~frameMask;
+
+        this->largeOrders[i] = order;
+        this->largeFrames[i] = (last > first) ? ((last - first) >> order) : 0;
+        this->largeAllocated[i] = 0;
+    }
+
+    /*
+     * Allocate the VM object: the static buffer has room for the VM objects of all statically
+     * allocated regions; any further regions get theirs from the pool, the same way as the
+     * region itself.
+     */
+    void *vmRegionPtr;
+    if(gVmObjectAllocNextFree < Pool::kStaticRegions) {
+        vmRegionPtr = gVmObjectAllocBuf[gVmObjectAllocNextFree++];
+    } else {
+        vmRegionPtr = Pool::AllocStorage(sizeof(Vm::ContiguousPhysRegion));
+    }
+
+    this->metadataVm = new (vmRegionPtr) Vm::ContiguousPhysRegion(this->metadataPhys,
+            this->metadataReserved, Vm::Mode::KernelRW);
+}
+
+/**
+ * @brief Determine how much memory at the start of a region is reserved for its metadata.
+ *
+ * @param allocator Physical allocator the region would belong to
+ * @param length Length of the region, in bytes
+ *
+ * @return Number of bytes (a multiple of the page size) used for the page information array
+ */
+size_t BuddyRegion::GetMetadataSize(const PhysicalAllocator *allocator, const size_t length) {
+    const auto pageSz = allocator->getPageSize();
+    const auto bytes = (length / pageSz) * sizeof(PageInfo);
+
+    return (bytes + (pageSz - 1)) & ~(pageSz - 1);
+}
+
+/**
+ * @brief Clean up the region.
+ *
+ * This unmaps its page information array.
+ */
+BuddyRegion::~BuddyRegion() {
+    int err = Platform::Memory::PhysicalMap::Remove(this->info, this->metadataReserved);
+    if(err) {
+        Console::Warning("failed to unmap region %p metadata (%p): %d", this, this->info, err);
+    }
+}
+
+/**
+ * @brief Attempt to allocate pages from this region.
+ *
+ * Each page is allocated as an individual block, so it can be freed independently.
+ *
+ * @param pool Pool in which this region sits
+ * @param numPages Number of pages to attempt to allocate
+ * @param outAddrs Buffer to receive allocated physical addresses
+ *
+ * @return Number of allocated pages, or a negative error code.
+ *
+ * @remark This function may return (and in turn, allocate) fewer pages than requested.
+ */
+int BuddyRegion::alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    size_t satisfied{0}, page;
+    const auto pageSz = pool->allocator->getPageSize();
+
+    while(satisfied < numPages && this->allocBlock(0, page)) {
+        *outAddrs++ = this->allocBasePhys + (page * pageSz);
+        satisfied++;
+    }
+
+    return satisfied;
+}
+
+/**
+ * @brief Free the given pages.
+ *
+ * @param pool Pool in which this region sits
+ * @param numPages Number of pages in the specified buffer
+ * @param inAddrs Physical page addresses to free
+ *
+ * @remark Any page addresses that do not fall within this region, or that are not allocated, are
+ *         ignored.
+ *
+ * @return Number of freed pages
+ */
+int BuddyRegion::free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    int freed{0};
+    const auto pageSz = pool->allocator->getPageSize();
+
+    for(size_t i = 0; i < numPages; i++) {
+        const auto addr = *inAddrs++;
+        if(this->contains(addr)) {
+            freed += this->freeRun((addr - this->allocBasePhys) / pageSz, 1);
+        }
+    }
+
+    return freed;
+}
+
+/**
+ * @brief Allocate a physically contiguous, aligned run of pages.
+ *
+ * A single block large enough to satisfy both the size and alignment requirements is allocated;
+ * any pages at its end beyond the requested size are then freed again.
+ *
+ * @param pool Pool in which this region sits
+ * @param numPages Number of contiguous pages to allocate
+ * @param alignLog2 Required alignment of the physical base address, as a power of two multiple
+ *        of the page size (so `0` is page aligned)
+ * @param outBase Variable to receive the physical address of the first page
+ *
+ * @return Number of allocated pages (either 0 or `numPages`) or a negative error code.
+ */
+int BuddyRegion::allocContiguous(Pool *pool, const size_t numPages, const size_t alignLog2,
+        uintptr_t &outBase) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    if(!numPages || numPages > this->getTotalPages() - this->getAllocatedPages()) return 0;
+
+    size_t order = alignLog2;
+    while(order <= kMaxOrder && (1ULL << order) < numPages) order++;
+    if(order > kMaxOrder) return 0;
+
+    size_t page;
+    if(!this->allocBlock(order, page)) return 0;
+
+    // give back the excess pages
+    const auto blockPages = (1ULL << order);
+    if(numPages < blockPages) {
+        this->freeRun(page + numPages, blockPages - numPages);
+    }
+
+    outBase = this->allocBasePhys + (page * pageSz);
+    return numPages;
+}
+
+/**
+ * @brief Free a physically contiguous run of pages.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page
+ * @param numPages Number of pages to free
+ *
+ * @return Number of freed pages, or a negative error code if the run isn't inside this region.
+ */
+int BuddyRegion::freeContiguous(Pool *pool, const uintptr_t base, const size_t numPages) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    if(!numPages || !this->contains(base) ||
+            !this->contains(base + ((numPages - 1) * pageSz))) {
+        // TODO: standardized error codes
+        return -1;
+    }
+
+    return this->freeRun((base - this->allocBasePhys) / pageSz, numPages);
+}
+
+/**
+ * @brief Allocate a naturally aligned large frame.
+ *
+ * @param pool Pool in which this region sits
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param outAddr Variable to receive the physical address of the frame
+ *
+ * @return 1 if a frame was allocated, 0 if this region has no free frames of the given size.
+ */
+int BuddyRegion::allocLarge(Pool *pool, const size_t sizeIdx, uintptr_t &outAddr) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    REQUIRE(sizeIdx < this->numLargeSizes, "invalid large page size index %zu", sizeIdx);
+    const auto order = this->largeOrders[sizeIdx];
+
+    size_t page;
+    if(order > kMaxOrder || !this->allocBlock(order, page)) return 0;
+
+    this->largeAllocated[sizeIdx]++;
+
+    outAddr = this->allocBasePhys + (page * pageSz);
+    return 1;
+}
+
+/**
+ * @brief Free a large frame previously allocated with allocLarge().
+ *
+ * @param pool Pool in which this region sits
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param addr Physical address of the frame
+ *
+ * @return 1 if the frame was freed, or a negative error code if it isn't an allocated frame in
+ *         this region.
+ */
+int BuddyRegion::freeLarge(Pool *pool, const size_t sizeIdx, const uintptr_t addr) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    REQUIRE(sizeIdx < this->numLargeSizes, "invalid large page size index %zu", sizeIdx);
+    const auto order = this->largeOrders[sizeIdx];
+
+    // TODO: standardized error codes
+    if(!this->contains(addr)) return -1;
+
+    const auto page = (addr - this->allocBasePhys) / pageSz;
+    const auto &head = this->info[page];
+    if(!(head.flags & kFlagAllocated) || head.order != order) return -1;
+
+    REQUIRE(this->largeAllocated[sizeIdx], "region %p has no allocated large frames (size %zu)",
+            this, sizeIdx);
+
+    this->numAllocated -= (1ULL << order);
+    this->freeBlock(page, order);
+    this->largeAllocated[sizeIdx]--;
+
+    return 1;
+}
+
+/**
+ * @brief Permanently mark a range of pages as allocated.
+ *
+ * This is used for holes in regions that span several ranges of usable memory: the pages in the
+ * holes don't exist, so they must never be handed out. Reserved pages are counted neither as
+ * allocatable nor as allocated pages.
+ *
+ * Each free block overlapping the range is taken off the free lists and marked as allocated; the
+ * parts of it outside the range are then freed again.
+ *
+ * @remark This may only be called before any pages are allocated from the region.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page to reserve
+ * @param length Length of the range, in bytes; any part of it outside the region is ignored
+ *
+ * @return Number of pages reserved
+ */
+size_t BuddyRegion::reserve(Pool *pool, const uintptr_t base, const size_t length) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    const auto start = (base > this->allocBasePhys) ? base : this->allocBasePhys;
+    const auto end = ((base + length) < this->allocEndPhys) ? (base + length) : this->allocEndPhys;
+    if(start >= end) return 0;
+
+    const auto first = (start - this->allocBasePhys) / pageSz;
+    const auto last = (end - this->allocBasePhys) / pageSz;
+
+    for(size_t page = first, head; page < last; ) {
+        REQUIRE(this->findBlock(page, head), "region %p has no block for page %zu", this, page);
+
+        auto &headInfo = this->info[head];
+        const size_t order = headInfo.order;
+        const auto blockEnd = head + (1ULL << order);
+        REQUIRE(headInfo.flags & kFlagFree, "failed to reserve region %p page %zu", this, page);
+
+        this->removeFree(head, order);
+        headInfo.order = order;
+        headInfo.flags = kFlagAllocated;
+        this->numAllocated += (1ULL << order);
+
+        // give back the parts of the block outside the range
+        if(head < first) {
+            this->freeRun(head, first - head);
+        }
+        if(blockEnd > last) {
+            this->freeRun(last, blockEnd - last);
+        }
+
+        page = blockEnd;
+    }
+
+    this->numReserved += last - first;
+    return last - first;
+}
+
+/**
+ * @brief Make previously reserved pages available for allocation.
+ *
+ * This is used when memory in a hole becomes usable later on, such as memory reclaimed from the
+ * bootloader.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page
+ * @param length Length of the range, in bytes; any part of it outside the region is ignored. All
+ *        pages inside the region must have been reserved with reserve().
+ *
+ * @return Number of pages made available
+ */
+size_t BuddyRegion::unreserve(Pool *pool, const uintptr_t base, const size_t length) {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    const auto pageSz = pool->allocator->getPageSize();
+
+    const auto start = (base > this->allocBasePhys) ? base : this->allocBasePhys;
+    const auto end = ((base + length) < this->allocEndPhys) ? (base + length) : this->allocEndPhys;
+    if(start >= end) return 0;
+
+    const auto first = (start - this->allocBasePhys) / pageSz;
+    const auto freed = this->freeRun(first, (end - start) / pageSz);
+    this->numReserved -= freed;
+
+    return freed;
+}
+
+/**
+ * @brief Map the page information array into virtual address space.
+ *
+ * @param base Virtual base address
+ * @param map Memory map to receive the page information array
+ *
+ * @return Number of bytes required for the page information array
+ */
+size_t BuddyRegion::applyVirtualMap(uintptr_t base, Vm::Map *map) {
+    // remap the region
+    REQUIRE(this->metadataVm->isOrphaned(), "cannot re-map region %p metadata", this);
+    int err = map->add(base, this->metadataVm);
+    REQUIRE(!err, "failed to map region metadata: %d", err);
+
+    // update pointers
+    this->setMetadataBase(reinterpret_cast<void *>(base));
+
+    return this->metadataReserved;
+}
+
+/**
+ * @brief Get the size of the largest free block in the region.
+ *
+ * @return Number of pages in the largest free block
+ */
+size_t BuddyRegion::getLargestFreeRun() const {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    if(!this->freeOrders) return 0;
+    return 1ULL << (31 - __builtin_clz(this->freeOrders));
+}
+
+/**
+ * @brief Build a histogram of the free blocks in the region.
+ *
+ * Each free block is counted as one run in the bucket of its order, even if it happens to be
+ * physically adjacent to other free blocks; blocks of orders too large for the histogram are
+ * counted in the last bucket.
+ *
+ * Since statistics may be dumped while panicking, possibly from a processor that holds the lock,
+ * this does not wait for the lock to become available.
+ *
+ * @param outLargest Variable to receive the size of the largest free block, in pages
+ * @param outCounts Histogram to receive the number of free blocks of each order
+ * @param numBuckets Number of entries in the histogram
+ *
+ * @return Whether the histogram could be built, or `false` if the region is locked
+ */
+bool BuddyRegion::getFreeRuns(size_t &outLargest, size_t *outCounts,
+        const size_t numBuckets) const {
+    outLargest = 0;
+    for(size_t i = 0; i < numBuckets; i++) outCounts[i] = 0;
+
+    if(!this->lock.tryLock()) return false;
+
+    for(size_t order = 0; order <= kMaxOrder; order++) {
+        if(!this->freeCounts[order]) continue;
+
+        outLargest = 1ULL << order;
+        outCounts[(order < numBuckets) ? order : (numBuckets - 1)] += this->freeCounts[order];
+    }
+
+    this->lock.unlock();
+    return true;
+}
+
+/**
+ * @brief Get the number of entirely free large frames of the given size.
+ *
+ * Every free block of at least the frame's order consists of a power of two number of free
+ * frames, so this is calculated from the free block counts.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ *
+ * @return Number of large frames of this size that could be allocated
+ */
+size_t BuddyRegion::getFreeLargePages(const size_t sizeIdx) const {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    size_t sum{0};
+    for(size_t order = this->largeOrders[sizeIdx]; order <= kMaxOrder; order++) {
+        sum += this->freeCounts[order] << (order - this->largeOrders[sizeIdx]);
+    }
+    return sum;
+}
+
+/**
+ * @brief Update the pointer to the page information array.
+ *
+ * @param base Virtual address at which the region's metadata pages are accessible
+ */
+void BuddyRegion::setMetadataBase(void *base) {
+    this->info = reinterpret_cast<PageInfo *>(base);
+}
+
+/**
+ * @brief Allocate a block of the given order.
+ *
+ * The smallest free block of at least the requested order is taken off its free list; if it's
+ * larger than requested, it's split in halves until it's of the right size, with the upper
+ * halves going back on to the free lists.
+ *
+ * @param order Order of the block to allocate
+ * @param outPage Variable to receive the index of the block's first page
+ *
+ * @return Whether a block was allocated
+ */
+bool BuddyRegion::allocBlock(const size_t order, size_t &outPage) {
+    const auto available = this->freeOrders & ~((1U << order) - 1);
+    if(!available) return false;
+
+    size_t current = __builtin_ctz(available);
+    const auto page = this->freeHeads[current];
+    this->removeFree(page, current);
+
+    while(current > order) {
+        current--;
+        this->pushFree(page + (1ULL << current), current);
+    }
+
+    auto &head = this->info[page];
+    head.order = order;
+    head.flags = kFlagAllocated;
+
+    this->numAllocated += (1ULL << order);
+
+    outPage = page;
+    return true;
+}
+
+/**
+ * @brief Return a block to the free lists.
+ *
+ * The block is merged with its buddy for as long as the buddy is entirely free.
+ *
+ * @param page Index of the block's first page
+ * @param order Order of the block
+ *
+ * @remark The caller is responsible for updating the allocated page count.
+ */
+void BuddyRegion::freeBlock(size_t page, size_t order) {
+    while(order < kMaxOrder) {
+        const auto buddyPfn = (this->pfnBase + page) ^ (1ULL << order);
+        if(buddyPfn < this->pfnBase) break;
+
+        const auto buddy = buddyPfn - this->pfnBase;
+        if(buddy + (1ULL << order) > this->totalPages) break;
+
+        auto &buddyInfo = this->info[buddy];
+        if(!(buddyInfo.flags & kFlagFree) || buddyInfo.order != order) break;
+
+        // merge with the buddy; the lower of the two becomes the head of the merged block
+        this->removeFree(buddy, order);
+        buddyInfo.flags = 0;
+
+        if(buddy < page) {
+            this->info[page].flags = 0;
+            page = buddy;
+        }
+
+        order++;
+    }
+
+    this->pushFree(page, order);
+}
+
+/**
+ * @brief Free all allocated pages in the given range.
+ *
+ * Allocated blocks that extend past either end of the range are split until the range is covered
+ * by whole blocks. Pages in the range that are already free are skipped.
+ *
+ * @param start Index of the first page to free
+ * @param count Number of pages to free
+ *
+ * @return Number of pages freed
+ */
+size_t BuddyRegion::freeRun(const size_t start, const size_t count) {
+    size_t freed{0}, head;
+    const auto end = start + count;
+
+    for(size_t page = start; page < end; ) {
+        REQUIRE(this->findBlock(page, head), "region %p has no block for page %zu", this, page);
+
+        const auto &headInfo = this->info[head];
+        const auto blockPages = (1ULL << headInfo.order);
+
+        if(headInfo.flags & kFlagFree) {
+            page = head + blockPages;
+        } else if(head == page && head + blockPages <= end) {
+            this->numAllocated -= blockPages;
+            freed += blockPages;
+
+            this->freeBlock(head, headInfo.order);
+            page += blockPages;
+        } else {
+            this->splitAllocated(head);
+        }
+    }
+
+    return freed;
+}
+
+/**
+ * @brief Find the block containing the given page.
+ *
+ * Since blocks are naturally aligned, the head of the block containing a page must be at the
+ * page's index aligned down to the block's size. So, each possible order is checked in turn.
+ *
+ * @param page Index of the page
+ * @param outHead Variable to receive the index of the block's first page
+ *
+ * @return Whether the block was found
+ */
+bool BuddyRegion::findBlock(const size_t page, size_t &outHead) const {
+    const auto pfn = this->pfnBase + page;
+
+    for(size_t order = 0; order <= kMaxOrder; order++) {
+        const auto headPfn = pfn & ~((1ULL << order) - 1);
+        if(headPfn < this->pfnBase) break;
+
+        const auto head = headPfn - this->pfnBase;
+        const auto &headInfo = this->info[head];
+        if(headInfo.flags && page < head + (1ULL << headInfo.order)) {
+            outHead = head;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Split an allocated block into two allocated halves.
+ *
+ * @param head Index of the block's first page
+ */
+void BuddyRegion::splitAllocated(const size_t head) {
+    auto &headInfo = this->info[head];
+    REQUIRE((headInfo.flags & kFlagAllocated) && headInfo.order,
+            "cannot split region %p block %zu", this, head);
+
+    headInfo.order--;
+
+    auto &upper = this->info[head + (1ULL << headInfo.order)];
+    upper.order = headInfo.order;
+    upper.flags = kFlagAllocated;
+}
+
+/**
+ * @brief Add a block to the head of the free list for its order.
+ *
+ * @param page Index of the block's first page
+ * @param order Order of the block
+ */
+void BuddyRegion::pushFree(const size_t page, const size_t order) {
+    auto &pageInfo = this->info[page];
+    pageInfo.order = order;
+    pageInfo.flags = kFlagFree;
+    pageInfo.prev = kNone;
+    pageInfo.next = this->freeHeads[order];
+
+    if(pageInfo.next != kNone) {
+        this->info[pageInfo.next].prev = page;
+    }
+
+    this->freeHeads[order] = page;
+    this->freeCounts[order]++;
+    this->freeOrders |= (1U << order);
+}
+
+/**
+ * @brief Remove a block from the free list for its order.
+ *
+ * @param page Index of the block's first page
+ * @param order Order of the block
+ */
+void BuddyRegion::removeFree(const size_t page, const size_t order) {
+    auto &pageInfo = this->info[page];
+
+    if(pageInfo.prev != kNone) {
+        this->info[pageInfo.prev].next = pageInfo.next;
+    } else {
+        this->freeHeads[order] = pageInfo.next;
+    }
+    if(pageInfo.next != kNone) {
+        this->info[pageInfo.next].prev = pageInfo.prev;
+    }
+
+    pageInfo.flags = 0;
+
+    this->freeCounts[order]--;
+    if(this->freeHeads[order] == kNone) {
+        this->freeOrders &= ~(1U << order);
+    }
+}
@@ -0,0 +1,142 @@
+#include "Memory/PageCache.h"
+#include "Memory/Pool.h"
+
+#include "Logging/Console.h"
+#include "Runtime/String.h"
+
+using namespace Kernel::Memory;
+
+/**
+ * @brief Allocate pages through the cache.
+ *
+ * Pages are handed out from the cache for as long as it has any; the rest of the request is then
+ * satisfied by refilling the cache from the pool, or by going straight to the pool if the request
+ * is large.
+ *
+ * @param pool Pool backing this cache
+ * @param numPages Number of pages to allocate
+ * @param outAddrs Buffer to receive the physical addresses of the allocated pages
+ *
+ * @return Number of pages allocated (which may be less than requested) or a negative error code
+ */
+int PageCache::alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs) {
+    int err;
+    size_t satisfied{0};
+
+    // fast path: hand out cached pages
+    while(satisfied < numPages && this->numCached) {
+        outAddrs[satisfied++] = this->pages[--this->numCached];
+    }
+
+    if(satisfied == numPages) {
+        this->stats.hits++;
+        return satisfied;
+    }
+
+    this->stats.misses++;
+
+    // large requests go directly to the pool
+    const auto remaining = numPages - satisfied;
+    if(remaining > kBatchSize) {
+        err = pool->alloc(remaining, outAddrs + satisfied);
+        if(err < 0) goto fail;
+        return satisfied + err;
+    }
+
+    // otherwise, refill the cache and satisfy the rest of the request from it
+    err = this->refill(pool);
+    if(err < 0) goto fail;
+
+    while(satisfied < numPages && this->numCached) {
+        outAddrs[satisfied++] = this->pages[--this->numCached];
+    }
+
+    return satisfied;
+
+fail:;
+    // return the pages we already took back into the cache
+    while(satisfied) {
+        this->pages[this->numCached++] = outAddrs[--satisfied];
+    }
+    return err;
+}
+
+/**
+ * @brief Release pages into the cache.
+ *
+ * Pages are pushed on to the cache; whenever it fills up, its oldest entries are returned back to
+ * the pool in a batch.
+ *
+ * @param pool Pool backing this cache
+ * @param numPages Number of pages to free
+ * @param inAddrs Physical addresses of the pages to free
+ *
+ * @return Number of pages freed
+ *
+ * @remark Addresses that do not belong to the pool are ignored.
+ */
+int PageCache::free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs) {
+    int freed{0};
+
+    for(size_t i = 0; i < numPages; i++) {
+        const auto addr = inAddrs[i];
+        if(!pool->contains(addr)) continue;
+
+        if(this->numCached == kCapacity) {
+            this->drain(pool, kBatchSize);
+        }
+
+        this->pages[this->numCached++] = addr;
+        freed++;
+    }
+
+    return freed;
+}
+
+/**
+ * @brief Return all cached pages to the pool.
+ *
+ * @param pool Pool backing this cache
+ */
+void PageCache::flush(Pool *pool) {
+    if(this->numCached) {
+        this->drain(pool, this->numCached);
+    }
+}
+
+/**
+ * @brief Take a batch of pages from the pool.
+ *
+ * @param pool Pool backing this cache
+ *
+ * @return Number of pages added to the cache, or a negative error code
+ *
+ * @remark The cache must be empty when this is called.
+ */
+int PageCache::refill(Pool *pool) {
+    REQUIRE(!this->numCached, "cannot refill non-empty page cache %p", this);
+
+    int err = pool->alloc(kBatchSize, this->pages);
+    if(err <= 0) return err;
+
+    this->numCached = err;
+    this->stats.refills++;
+
+    return err;
+}
+
+/**
+ * @brief Return the oldest pages in the cache to the pool.
+ *
+ * @param pool Pool backing this cache
+ * @param numPages Number of pages to return
+ */
+void PageCache::drain(Pool *pool, const size_t numPages) {
+    int err = pool->free(numPages, this->pages);
+    REQUIRE(err == static_cast<int>(numPages), "failed to drain page cache %p: %d", this, err);
+
+    this->numCached -= numPages;
+    memmove(this->pages, this->pages + numPages, this->numCached * sizeof(uintptr_t));
+
+    this->stats.drains++;
+}
@@ -0,0 +1,215 @@
+#include "Memory/PageFrameDb.h"
+#include "Memory/PhysicalAllocator.h"
+#include "Memory/Pool.h"
+
+#include "Logging/Console.h"
+#include "Runtime/String.h"
+#include "Vm/Map.h"
+#include "Vm/ContiguousPhysRegion.h"
+
+#include <Intrinsics.h>
+#include <Platform.h>
+#include <new>
+
+using namespace Kernel::Memory;
+
+bool PageFrameDb::gEnabled{false};
+uint64_t PageFrameDb::gSections[(kMaxSections + 63) / 64];
+
+/**
+ * Number of VM objects for database mappings in the .bss segment
+ *
+ * Mappings created before the kernel's address space is active must come from here, since memory
+ * from the physical allocator can't be accessed through the aperture yet.
+ */
+constexpr static const size_t kStaticMappings{Pool::kStaticRegions * 2};
+
+// space in .bss segment for VM objects
+static KUSH_ALIGNED(64) uint8_t gVmObjectAllocBuf[kStaticMappings][sizeof(Kernel::Vm::ContiguousPhysRegion)];
+// index for the next available VM object
+static size_t gVmObjectAllocNextFree{0};
+
+/**
+ * @brief Ensure the database covers a range of physical memory.
+ *
+ * Any sections of the range that don't have their part of the database backed yet are allocated,
+ * zeroed, and mapped into the kernel map.
+ *
+ * @param map Kernel map to add the database mappings to
+ * @param base Physical base address of the range
+ * @param length Length of the range, in bytes
+ *
+ * @remark The caller must serialize calls to this method; the physical allocator's region lock is
+ *         used for that.
+ */
+void PageFrameDb::AddRange(Vm::Map *map, const uintptr_t base, const size_t length) {
+    if(!length) return;
+
+    const auto first = base / kSectionSize, last = (base + length - 1) / kSectionSize;
+    REQUIRE(last < kMaxSections, "physical memory %016zx - %016zx beyond page frame database",
+            base, base + length);
+
+    // map each run of sections that aren't yet backed
+    size_t section{first};
+    while(section <= last) {
+        if(gSections[section / 64] & (1ULL << (section % 64))) {
+            section++;
+            continue;
+        }
+
+        const auto runStart = section;
+        while(section <= last && !(gSections[section / 64] & (1ULL << (section % 64)))) {
+            section++;
+        }
+
+        MapSections(map, runStart, section);
+    }
+}
+
+/**
+ * @brief Allow the database to be accessed.
+ *
+ * Until this is called, all lookups fail, and the physical allocator doesn't maintain entries.
+ *
+ * @remark This must only be called once the kernel map that the database was mapped into is
+ *         active.
+ */
+void PageFrameDb::Enable() {
+    __atomic_store_n(&gEnabled, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Allocate and map the part of the database covering a run of sections.
+ *
+ * The backing memory is a single physically contiguous allocation, which is zeroed through the
+ * physical aperture before being mapped.
+ *
+ * @param map Kernel map to add the mapping to
+ * @param first Index of the first section to map
+ * @param last Index of the section past the end of the run
+ */
+void PageFrameDb::MapSections(Vm::Map *map, const size_t first, const size_t last) {
+    int err;
+    const auto pageSz = Platform::PageTable::PageSize();
+    const auto bytes = (last - first) * kSectionBytes;
+
+    // allocate and clear the backing memory
+    uintptr_t phys;
+    err = PhysicalAllocator::AllocateContiguous(bytes / pageSz, 0, phys);
+    REQUIRE(err > 0, "failed to allocate page frame database: %d", err);
+
+    void *ptr;
+    err = Platform::Memory::PhysicalMap::Add(phys, bytes, &ptr);
+    REQUIRE(!err, "failed to map page frame database: %d", err);
+
+    memset(ptr, 0, bytes);
+    Platform::Memory::PhysicalMap::Remove(ptr, bytes);
+
+    // create the VM object and map it
+    void *vmRegionPtr;
+    if(gVmObjectAllocNextFree < kStaticMappings) {
+        vmRegionPtr = gVmObjectAllocBuf[gVmObjectAllocNextFree++];
+    } else {
+        vmRegionPtr = Pool::AllocStorage(sizeof(Vm::ContiguousPhysRegion));
+    }
+
+    auto vm = new (vmRegionPtr) Vm::ContiguousPhysRegion(phys, bytes, Vm::Mode::KernelRW);
+
+    const auto virt = Platform::KernelAddressLayout::PageFrameDbStart + (first * kSectionBytes);
+    err = map->add(virt, vm);
+    REQUIRE(!err, "failed to map page frame database: %d", err);
+
+    // mark the sections as available
+    for(size_t section = first; section < last; section++) {
+        __atomic_or_fetch(&gSections[section / 64], (1ULL << (section % 64)), __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Initialize the entries of freshly allocated pages.
+ *
+ * Each page's reference count is set to 1; all other fields are cleared.
+ *
+ * @param addrs Physical addresses of the pages
+ * @param num Number of pages
+ */
+void PageFrameDb::InitFrames(const uintptr_t *addrs, const size_t num) {
+    if(!__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) return;
+
+    for(size_t i = 0; i < num; i++) {
+        auto frame = Get(addrs[i]);
+        if(!frame) continue;
+
+        *frame = {
+            .refCount = 1,
+        };
+    }
+}
+
+/**
+ * @brief Initialize the entries of a freshly allocated range of contiguous pages.
+ *
+ * @param base Physical address of the first page
+ * @param num Number of pages
+ */
+void PageFrameDb::InitContiguous(const uintptr_t base, const size_t num) {
+    if(!__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) return;
+
+    for(size_t i = 0; i < num; i++) {
+        auto frame = Get(base + (i << kFrameShift));
+        if(!frame) continue;
+
+        *frame = {
+            .refCount = 1,
+        };
+    }
+}
+
+/**
+ * @brief Initialize the entry of a freshly allocated large page.
+ *
+ * Only the entry of the page's first frame is used.
+ *
+ * @param base Physical address of the large page
+ * @param order Base 2 logarithm of the number of frames making up the page
+ */
+void PageFrameDb::InitLarge(const uintptr_t base, const uint8_t order) {
+    auto frame = Get(base);
+    if(!frame) return;
+
+    *frame = {
+        .refCount = 1,
+        .flags = PageFrame::kLargePage,
+        .order = order,
+    };
+}
+
+/**
+ * @brief Clear the entries of pages that are about to be freed.
+ *
+ * @param addrs Physical addresses of the pages
+ * @param num Number of pages
+ */
+void PageFrameDb::ClearFrames(const uintptr_t *addrs, const size_t num) {
+    if(!__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) return;
+
+    for(size_t i = 0; i < num; i++) {
+        auto frame = Get(addrs[i]);
+        if(frame) *frame = {};
+    }
+}
+
+/**
+ * @brief Clear the entries of a range of contiguous pages that is about to be freed.
+ *
+ * @param base Physical address of the first page
+ * @param num Number of pages
+ */
+void PageFrameDb::ClearContiguous(const uintptr_t base, const size_t num) {
+    if(!__atomic_load_n(&gEnabled, __ATOMIC_RELAXED)) return;
+
+    for(size_t i = 0; i < num; i++) {
+        auto frame = Get(base + (i << kFrameShift));
+        if(frame) *frame = {};
+    }
+}
@@ -1,11 +1,18 @@
 #include "Memory/PhysicalAllocator.h"
+#include "Memory/BuddyRegion.h"
+#include "Memory/PageCache.h"
+#include "Memory/PageFrameDb.h"
 #include "Memory/Pool.h"
+#include "Memory/Region.h"
 
 #include "Logging/Console.h"
 #include "Runtime/String.h"
+#include "Smp/CpuLocals.h"
 #include "Vm/Map.h"
 
+#include <Platform.h>
 #include <Intrinsics.h>
+#include <platform/ProcessorLocals.h>
 #include <new>
 
 using namespace Kernel;
@@ -15,7 +22,22 @@ static KUSH_ALIGNED(64) uint8_t gPhysAllocBuf[sizeof(PhysicalAllocator)];
 // space in .bss segment for pools
 static KUSH_ALIGNED(64) uint8_t gPoolAllocBuf[PhysicalAllocator::kMaxPools][sizeof(Memory::Pool)];
 
+// registered memory pressure handlers
+static struct {
+    PhysicalAllocator::PressureHandler handler;
+    void *context;
+} gPressureHandlers[PhysicalAllocator::kMaxPressureHandlers];
+// serializes registering and removing pressure handlers
+static Kernel::Runtime::Spinlock gPressureHandlersLock;
+
+// serializes adding ranges to the pool range table
+static Kernel::Runtime::Spinlock gPoolRangesLock;
+// set once virtual memory is available, after which the pool range table is replaced on updates
+static bool gPoolRangesMapped{false};
+
 PhysicalAllocator *PhysicalAllocator::gShared{nullptr};
+bool PhysicalAllocator::gCpuCachesEnabled{false};
+uint8_t PhysicalAllocator::gStatsDump{0};
 
 
 /**
@@ -60,31 +82,175 @@ PhysicalAllocator::PhysicalAllocator(const size_t _pageSz, const size_t extraSiz
             const auto power = (__builtin_ffsll(size) - 1) - base;
             this->extraPageSizes[i] = power;
         }
+
+        this->numExtraPageSizes = numExtraSizes;
     }
 
-    // initialize the primary pool
-    auto first = reinterpret_cast<Memory::Pool *>(&gPoolAllocBuf[0]);
-    new (first) Memory::Pool(this);
+    // initialize the primary pool, and any secondary pools
+    REQUIRE(numBonusPools < kMaxPools, "too many pools (max %zu, got %zu)", kMaxPools,
+            numBonusPools + 1);
+    this->numPools = 1 + numBonusPools;
+    this->numFallbackPools = this->numPools;
 
-    this->pools[0] = first;
+    for(size_t i = 0; i < this->numPools; i++) {
+        auto pool = reinterpret_cast<Memory::Pool *>(&gPoolAllocBuf[i]);
+        new (pool) Memory::Pool(this, i);
 
-    // TODO: initialize secondary/bonus pools
+        this->pools[i] = pool;
+    }
+
+    // until we know better, fall back to the other pools in order
+    for(size_t i = 0; i < this->numPools; i++) {
+        this->fallback[i][0] = i;
+        for(size_t j = 0, k = 1; j < this->numPools; j++) {
+            if(j != i) this->fallback[i][k++] = j;
+        }
+    }
 }
 
 /**
  * @brief Initialize a new region.of physical memory and adds it to a pool.
  *
+ * Regions may be added at any time, including after virtual memory is available (for example when
+ * memory is hot added) in which case the region is mapped right away.
+ *
+ * Regions may span holes in physical memory (to avoid creating many tiny regions); the holes are
+ * reserved before the region becomes visible to allocations.
+ *
  * @param base Physical base address (must be page aligned)
  * @param length Length of the region, in bytes
  * @param pool Pool to add the region to
+ * @param reserved Ranges inside the region that must never be allocated, if any
+ * @param numReserved Number of reserved ranges
  */
-void PhysicalAllocator::AddRegion(const uintptr_t base, const size_t length, const size_t pool) {
+void PhysicalAllocator::AddRegion(const uintptr_t base, const size_t length, const size_t pool,
+        const ReservedRange *reserved, const size_t numReserved) {
     REQUIRE(!(base & (gShared->pageSz - 1)), "invalid region %s: %016lx", "base", base);
     REQUIRE(length && !(length & (gShared->pageSz - 1)), "invalid region %s: %016lx", "length",
             length);
-    REQUIRE(pool < kMaxPools, "invalid pool");
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+    REQUIRE(reserved || !numReserved, "invalid reserved ranges");
+
+    for(size_t i = 0; i < numReserved; i++) {
+        REQUIRE(!(reserved[i].base & (gShared->pageSz - 1)), "invalid range %s: %016lx", "base",
+                reserved[i].base);
+        REQUIRE(reserved[i].length && !(reserved[i].length & (gShared->pageSz - 1)),
+                "invalid range %s: %016lx", "length", reserved[i].length);
+    }
+
+    // record the range first, so pages allocated from the region can be freed right away
+    AddPoolRange(base, length, pool);
+    gShared->pools[pool]->addRegion(base, length, reserved, numReserved);
+}
 
-    gShared->pools[pool]->addRegion(base, length);
+/**
+ * @brief Record that a range of physical memory belongs to a pool.
+ *
+ * Once virtual memory is available, the new table is allocated from the physical allocator and
+ * accessed through the physical aperture; the old table is never freed, since it may still be in
+ * use on other processors.
+ *
+ * @param base Physical base address of the range
+ * @param length Length of the range, in bytes
+ * @param pool Index of the pool the range belongs to
+ */
+void PhysicalAllocator::AddPoolRange(const uintptr_t base, const size_t length,
+        const size_t pool) {
+    Runtime::SpinlockGuard guard(gPoolRangesLock);
+    auto table = gShared->poolRanges;
+
+    if(gPoolRangesMapped) {
+        const auto pageSz = gShared->pageSz;
+        const auto bytes = sizeof(PoolRangeTable) + ((table->numRanges + 1) * sizeof(PoolRange));
+        const auto pages = (bytes + (pageSz - 1)) / pageSz;
+
+        uintptr_t phys;
+        int err = AllocateContiguous(pages, 0, phys);
+        REQUIRE(err > 0, "failed to allocate pool range table: %d", err);
+
+        void *ptr;
+        err = Platform::Memory::PhysicalMap::Add(phys, pages * pageSz, &ptr);
+        REQUIRE(!err, "failed to map pool range table: %d", err);
+
+        auto newTable = reinterpret_cast<PoolRangeTable *>(ptr);
+        newTable->capacity = ((pages * pageSz) - sizeof(PoolRangeTable)) / sizeof(PoolRange);
+        newTable->numRanges = table->numRanges;
+        newTable->ranges = reinterpret_cast<PoolRange *>(newTable + 1);
+        memcpy(newTable->ranges, table->ranges, table->numRanges * sizeof(PoolRange));
+
+        table = newTable;
+    } else {
+        REQUIRE(table->numRanges < table->capacity,
+                "pool range table full before VM is available");
+    }
+
+    // insert it, keeping the table sorted
+    auto pos = table->numRanges;
+    while(pos && table->ranges[pos - 1].base > base) {
+        table->ranges[pos] = table->ranges[pos - 1];
+        pos--;
+    }
+
+    table->ranges[pos] = {base, base + length, pool};
+    table->numRanges++;
+
+    __atomic_store_n(&gShared->poolRanges, table, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Permanently reserve a range of physical memory inside a pool's regions.
+ *
+ * Holes in regions should instead be passed to AddRegion(), so they are reserved before any pages
+ * can be allocated from the region.
+ *
+ * @param base Physical base address of the range (must be page aligned)
+ * @param length Length of the range, in bytes
+ * @param pool Pool containing the region(s) the range lies in
+ */
+void PhysicalAllocator::ReserveRange(const uintptr_t base, const size_t length,
+        const size_t pool) {
+    REQUIRE(!(base & (gShared->pageSz - 1)), "invalid range %s: %016lx", "base", base);
+    REQUIRE(length && !(length & (gShared->pageSz - 1)), "invalid range %s: %016lx", "length",
+            length);
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    gShared->pools[pool]->reserve(base, length);
+}
+
+/**
+ * @brief Make a range of reserved physical memory available for allocation.
+ *
+ * This is used when the memory in a hole that was reserved in a region becomes usable,
+ * for example because it was used by the bootloader.
+ *
+ * @param base Physical base address of the range (must be page aligned)
+ * @param length Length of the range, in bytes
+ * @param pool Pool containing the region(s) the range lies in
+ *
+ * @return Number of pages made available
+ */
+size_t PhysicalAllocator::UnreserveRange(const uintptr_t base, const size_t length,
+        const size_t pool) {
+    REQUIRE(!(base & (gShared->pageSz - 1)), "invalid range %s: %016lx", "base", base);
+    REQUIRE(length && !(length & (gShared->pageSz - 1)), "invalid range %s: %016lx", "length",
+            length);
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    return gShared->pools[pool]->unreserve(base, length);
+}
+
+/**
+ * @brief Get the amount of memory a region uses for its own metadata.
+ *
+ * This memory is taken from the start of the region; so if a region spans holes, at least this
+ * much memory must be available in front of the first hole.
+ *
+ * @param length Length of the region, in bytes
+ *
+ * @return Number of bytes at the start of the region reserved for metadata
+ */
+size_t PhysicalAllocator::GetRegionOverhead(const size_t length) {
+    return Memory::Pool::RegionType::GetMetadataSize(gShared, length);
 }
 
 /**
@@ -93,16 +259,93 @@ void PhysicalAllocator::AddRegion(const uintptr_t base, const size_t length, con
  * @param numPages Number of pages to allocate
  * @param outPageAddrs A buffer to hold the resulting physical addresses; it must have space for
  *        at least `numPages` entries.
- * @param pool Index of the pool to allocate from
+ * @param pool Index of the pool to allocate from, or `kLocalPool` to allocate from the calling
+ *        processor's local pool (falling back to other pools, in order of distance)
+ * @param zeroed When set, the contents of all returned pages are guaranteed to be zero. Pages
+ *        are taken from the pool's zeroed page stash first; any others are zeroed before they
+ *        are returned.
  *
  * @return The number of actually allocated pages, or a negative error code.
  */
 int PhysicalAllocator::AllocatePages(const size_t numPages, uintptr_t *outPageAddrs,
-        const size_t pool) {
+        const size_t pool, const bool zeroed) {
     REQUIRE(numPages && outPageAddrs, "invalid page address buffer");
-    REQUIRE(pool < kMaxPools, "invalid pool");
 
-    return gShared->pools[pool]->alloc(numPages, outPageAddrs);
+    if(pool != kLocalPool) {
+        REQUIRE(pool < gShared->numPools, "invalid pool");
+        const auto err = AllocateFrom(pool, numPages, outPageAddrs, zeroed);
+        if(err > 0) Memory::PageFrameDb::InitFrames(outPageAddrs, err);
+        return err;
+    }
+
+    // try the local pool first, then the others in order of distance
+    int err{0};
+    size_t satisfied{0};
+    const auto local = GetLocalPool();
+
+    for(size_t i = 0; i < gShared->numFallbackPools && satisfied < numPages; i++) {
+        err = AllocateFrom(gShared->fallback[local][i], numPages - satisfied,
+                outPageAddrs + satisfied, zeroed);
+        if(err > 0) satisfied += err;
+    }
+
+    if(!satisfied) return err;
+
+    Memory::PageFrameDb::InitFrames(outPageAddrs, satisfied);
+    return satisfied;
+}
+
+/**
+ * @brief Allocate pages from a particular pool.
+ *
+ * @param pool Index of the pool to allocate from
+ * @param numPages Number of pages to allocate
+ * @param outPageAddrs Buffer to receive the physical addresses
+ * @param zeroed Whether the pages must be zeroed
+ *
+ * @return The number of actually allocated pages, or a negative error code.
+ */
+int PhysicalAllocator::AllocateFrom(const size_t pool, const size_t numPages,
+        uintptr_t *outPageAddrs, const bool zeroed) {
+    int err;
+    size_t satisfied{0};
+    auto thePool = gShared->pools[pool];
+
+    if(zeroed) {
+        satisfied = thePool->allocZeroed(numPages, outPageAddrs);
+        if(satisfied == numPages) return satisfied;
+    }
+
+    // allocate the remaining pages as usual
+    auto cache = GetCpuCache(pool);
+    if(cache) {
+        cache->busy = true;
+        err = cache->alloc(thePool, numPages - satisfied, outPageAddrs + satisfied);
+        cache->busy = false;
+    } else {
+        err = thePool->alloc(numPages - satisfied, outPageAddrs + satisfied);
+    }
+
+    if(err < 0) {
+        return satisfied ? satisfied : err;
+    } else if(zeroed) {
+        thePool->zeroPages(err, outPageAddrs + satisfied);
+    }
+    satisfied += err;
+
+    // if the pool is exhausted, fall back to the dirty pages, then the zeroed pages
+    if(satisfied < numPages) {
+        const auto dirty = thePool->allocDirty(numPages - satisfied, outPageAddrs + satisfied);
+        if(zeroed && dirty > 0) {
+            thePool->zeroPages(dirty, outPageAddrs + satisfied);
+        }
+        satisfied += dirty;
+    }
+    if(satisfied < numPages) {
+        satisfied += thePool->allocZeroed(numPages - satisfied, outPageAddrs + satisfied);
+    }
+
+    return satisfied;
 }
 
 /**
@@ -110,21 +353,210 @@ int PhysicalAllocator::AllocatePages(const size_t numPages, uintptr_t *outPageAd
  *
  * @param numPages Number of pages to release
  * @param inPageAddrs Buffer containing `numPages` physical page addresses
- * @param pool Index of the pool from which all of these pages were allocated
+ * @param pool Index of the pool from which all of these pages were allocated, or `kLocalPool`
+ *        to return each page to the pool it belongs to
  *
  * @return Number of pages actually freed
  *
- * @remark All page addresses specified must have been allocated from the same pool of physical
- *         memory.
+ * @remark When a pool index is specified, all page addresses must have been allocated from that
+ *         pool of physical memory.
  */
 int PhysicalAllocator::FreePages(const size_t numPages, const uintptr_t *inPageAddrs,
         const size_t pool) {
     REQUIRE(numPages && inPageAddrs, "invalid page address buffer");
-    REQUIRE(pool < kMaxPools, "invalid pool");
+
+    Memory::PageFrameDb::ClearFrames(inPageAddrs, numPages);
+
+    if(pool != kLocalPool) {
+        REQUIRE(pool < gShared->numPools, "invalid pool");
+        return FreeTo(pool, numPages, inPageAddrs);
+    }
+
+    // hand each pool only its own pages; usually, an entire batch belongs to the same pool
+    int freed{0};
+    size_t owners[kFreeBatchSize];
+    uintptr_t batch[kFreeBatchSize];
+
+    for(size_t done = 0; done < numPages; ) {
+        const auto count = ((numPages - done) < kFreeBatchSize) ? (numPages - done) :
+            kFreeBatchSize;
+        const auto pages = inPageAddrs + done;
+        bool mixed{false};
+
+        for(size_t i = 0; i < count; i++) {
+            owners[i] = FindPool(pages[i]);
+            mixed |= (owners[i] != owners[0]);
+        }
+
+        if(!mixed) {
+            if(owners[0] != kLocalPool) freed += FreeTo(owners[0], count, pages);
+        } else {
+            // gather the pages of each pool in turn; pages not in any pool are skipped
+            for(size_t i = 0; i < count; i++) {
+                const auto pool = owners[i];
+                if(pool == kLocalPool) continue;
+
+                size_t numBatch{0};
+                for(size_t j = i; j < count; j++) {
+                    if(owners[j] != pool) continue;
+                    batch[numBatch++] = pages[j];
+                    owners[j] = kLocalPool;
+                }
+
+                freed += FreeTo(pool, numBatch, batch);
+            }
+        }
+
+        done += count;
+    }
+
+    return freed;
+}
+
+/**
+ * @brief Free pages belonging to a particular pool.
+ *
+ * @param pool Index of the pool to free to
+ * @param numPages Number of pages in the buffer
+ * @param inPageAddrs Physical page addresses; any not belonging to the pool are ignored
+ *
+ * @return Number of pages freed
+ */
+int PhysicalAllocator::FreeTo(const size_t pool, const size_t numPages,
+        const uintptr_t *inPageAddrs) {
+    auto cache = GetCpuCache(pool);
+    if(cache) {
+        cache->busy = true;
+        const auto freed = cache->free(gShared->pools[pool], numPages, inPageAddrs);
+        cache->busy = false;
+        return freed;
+    }
 
     return gShared->pools[pool]->free(numPages, inPageAddrs);
 }
 
+/**
+ * @brief Allocate physically contiguous pages with a particular alignment
+ *
+ * This is intended for allocations that need to be contiguous in physical memory, such as DMA
+ * buffers or backing for large pages. The per processor page caches are bypassed.
+ *
+ * @param numPages Number of pages to allocate
+ * @param alignLog2 Required alignment of the first page's physical address, as a power of two
+ *        multiple of the page size: `0` means page aligned, `9` means 2M aligned for 4K pages.
+ * @param outBase Variable to receive the physical address of the first page
+ * @param pool Index of the pool to allocate from, or `kLocalPool` for the closest pool with a
+ *        suitable run of pages
+ *
+ * @return `numPages` if the allocation succeeded, 0 if no suitable run of pages is available, or
+ *         a negative error code.
+ */
+int PhysicalAllocator::AllocateContiguous(const size_t numPages, const size_t alignLog2,
+        uintptr_t &outBase, const size_t pool) {
+    REQUIRE(numPages, "invalid page count");
+    REQUIRE(alignLog2 < 48, "invalid alignment: %zu", alignLog2);
+
+    int err{0};
+
+    if(pool != kLocalPool) {
+        REQUIRE(pool < gShared->numPools, "invalid pool");
+        err = gShared->pools[pool]->allocContiguous(numPages, alignLog2, outBase);
+    } else {
+        const auto local = GetLocalPool();
+        for(size_t i = 0; i < gShared->numFallbackPools && !err; i++) {
+            err = gShared->pools[gShared->fallback[local][i]]->allocContiguous(numPages,
+                    alignLog2, outBase);
+        }
+    }
+
+    if(err > 0) Memory::PageFrameDb::InitContiguous(outBase, numPages);
+    return err;
+}
+
+/**
+ * @brief Release physically contiguous pages.
+ *
+ * @param base Physical address of the first page, as returned by AllocateContiguous()
+ * @param numPages Number of pages to release; must match the allocation
+ * @param pool Index of the pool the pages were allocated from, or `kLocalPool` to look it up
+ *
+ * @return Number of pages freed, or a negative error code
+ */
+int PhysicalAllocator::FreeContiguous(const uintptr_t base, const size_t numPages,
+        const size_t pool) {
+    REQUIRE(numPages, "invalid page count");
+
+    const auto index = (pool == kLocalPool) ? FindPool(base) : pool;
+    // TODO: standardized error codes
+    if(index == kLocalPool) return -1;
+    REQUIRE(index < gShared->numPools, "invalid pool");
+
+    Memory::PageFrameDb::ClearContiguous(base, numPages);
+    return gShared->pools[index]->freeContiguous(base, numPages);
+}
+
+/**
+ * @brief Allocate a naturally aligned page of one of the extra page sizes
+ *
+ * The page is physically contiguous, and aligned to its size, so that it may be mapped using a
+ * single large page table entry. The per processor page caches are bypassed.
+ *
+ * @param pageSize Size of the page, in bytes; it must be one of the extra page sizes the
+ *        allocator was initialized with.
+ * @param outPageAddress Variable to receive the physical address of the page
+ * @param pool Index of the pool to allocate from, or `kLocalPool` for the closest pool with a
+ *        free page of that size
+ *
+ * @return 1 if the page was allocated, 0 if no free page of that size is available, or a
+ *         negative error code.
+ */
+int PhysicalAllocator::AllocateLargePage(const size_t pageSize, uintptr_t &outPageAddress,
+        const size_t pool) {
+    const auto idx = gShared->getExtraPageSizeIndex(pageSize);
+    if(idx < 0) return idx;
+
+    int err{0};
+
+    if(pool != kLocalPool) {
+        REQUIRE(pool < gShared->numPools, "invalid pool");
+        err = gShared->pools[pool]->allocLarge(idx, outPageAddress);
+    } else {
+        const auto local = GetLocalPool();
+        for(size_t i = 0; i < gShared->numFallbackPools && !err; i++) {
+            err = gShared->pools[gShared->fallback[local][i]]->allocLarge(idx, outPageAddress);
+        }
+    }
+
+    if(err > 0) {
+        const auto order = __builtin_ctzll(pageSize) - __builtin_ctzll(gShared->pageSz);
+        Memory::PageFrameDb::InitLarge(outPageAddress, static_cast<uint8_t>(order));
+    }
+    return err;
+}
+
+/**
+ * @brief Release a page allocated with AllocateLargePage().
+ *
+ * @param pageAddress Physical address of the page
+ * @param pageSize Size of the page, in bytes; this must match the allocation
+ * @param pool Index of the pool the page was allocated from, or `kLocalPool` to look it up
+ *
+ * @return 1 if the page was freed, or a negative error code
+ */
+int PhysicalAllocator::FreeLargePage(const uintptr_t pageAddress, const size_t pageSize,
+        const size_t pool) {
+    const auto idx = gShared->getExtraPageSizeIndex(pageSize);
+    if(idx < 0) return idx;
+
+    const auto index = (pool == kLocalPool) ? FindPool(pageAddress) : pool;
+    // TODO: standardized error codes
+    if(index == kLocalPool) return -1;
+    REQUIRE(index < gShared->numPools, "invalid pool");
+
+    Memory::PageFrameDb::ClearContiguous(pageAddress, 1);
+    return gShared->pools[index]->freeLarge(idx, pageAddress);
+}
+
 /**
  * @brief Return the total number of allocatable pages in the given pool.
  *
@@ -133,7 +565,7 @@ int PhysicalAllocator::FreePages(const size_t numPages, const uintptr_t *inPageA
  * @return Number of total allocatable pages
  */
 size_t PhysicalAllocator::GetTotalPages(const size_t pool) {
-    REQUIRE(pool < kMaxPools, "invalid pool");
+    REQUIRE(pool < gShared->numPools, "invalid pool");
 
     return gShared->pools[pool]->getTotalPages();
 }
@@ -141,16 +573,304 @@ size_t PhysicalAllocator::GetTotalPages(const size_t pool) {
 /**
  * @brief Returns the total number of pages currently allocated in the given pool.
  *
+ * @remark Pages held in per processor page caches are counted as allocated.
+ *
  * @param pool Pool index to query
  *
  * @return Number of total allocatable pages
  */
 size_t PhysicalAllocator::GetAllocPages(const size_t pool) {
-    REQUIRE(pool < kMaxPools, "invalid pool");
+    REQUIRE(pool < gShared->numPools, "invalid pool");
 
     return gShared->pools[pool]->getAllocatedPages();
 }
 
+/**
+ * @brief Return the size of the largest contiguous block of free pages in the given pool.
+ *
+ * This is an upper bound on the size of an allocation that AllocateContiguous() could currently
+ * satisfy.
+ *
+ * @param pool Pool index to query
+ *
+ * @return Number of pages in the largest free block
+ */
+size_t PhysicalAllocator::GetLargestFreeRun(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    return gShared->pools[pool]->getLargestFreeRun();
+}
+
+/**
+ * @brief Get the number of bitmap words examined by allocations in a pool.
+ *
+ * This is mostly useful to judge how well the allocator's search hints are working; the average
+ * number of words examined per allocation should stay low even after a long time.
+ *
+ * @param outAllocs Variable to receive the number of allocations made from the pool's regions
+ * @param outWords Variable to receive the number of summary and bitmap words they examined
+ * @param pool Pool index to query
+ */
+void PhysicalAllocator::GetScanStats(size_t &outAllocs, size_t &outWords, const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    gShared->pools[pool]->getScanStats(outAllocs, outWords);
+}
+
+/**
+ * @brief Write the statistics of all pools to the console.
+ *
+ * For each pool, this prints the number of allocations and frees (and how many allocations could
+ * only be partially satisfied), their latency histograms, the watermarks and how often they were
+ * hit, the average number of bitmap words examined per allocation, and a histogram of the free
+ * runs in each region.
+ *
+ * @remark Since the free runs are determined by scanning all regions, this can take a while.
+ */
+void PhysicalAllocator::DumpStats() {
+    if(!gShared) return;
+
+    for(size_t i = 0; i < gShared->numPools; i++) {
+        gShared->pools[i]->dumpStats(i);
+    }
+}
+
+/**
+ * @brief Write the statistics of all pools to the console, if requested for this occasion.
+ *
+ * @param reason Occasion for dumping the statistics
+ */
+void PhysicalAllocator::DumpStats(const StatsDump reason) {
+    if(!(gStatsDump & reason)) return;
+
+    Console::Notice("Physical allocator statistics (%s):",
+            (reason == kStatsDumpPanic) ? "panic" : "boot");
+    DumpStats();
+}
+
+/**
+ * @brief Set the watermarks of a pool.
+ *
+ * This replaces the default watermarks, which are derived from the size of the pool.
+ *
+ * @param pool Pool index to modify
+ * @param min Number of free pages below which the pool is at `kPressureMin`
+ * @param low Number of free pages below which the pool is at `kPressureLow`
+ * @param high Number of free pages above which the pool returns to `kPressureNone`
+ */
+void PhysicalAllocator::SetWatermarks(const size_t pool, const size_t min, const size_t low,
+        const size_t high) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    gShared->pools[pool]->setWatermarks(min, low, high);
+}
+
+/**
+ * @brief Get the watermarks of a pool.
+ *
+ * @param pool Pool index to query
+ * @param outMin Variable to receive the min watermark, in pages
+ * @param outLow Variable to receive the low watermark, in pages
+ * @param outHigh Variable to receive the high watermark, in pages
+ */
+void PhysicalAllocator::GetWatermarks(const size_t pool, size_t &outMin, size_t &outLow,
+        size_t &outHigh) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    gShared->pools[pool]->getWatermarks(outMin, outLow, outHigh);
+}
+
+/**
+ * @brief Get the memory pressure level of a pool.
+ *
+ * @param pool Pool index to query
+ */
+PhysicalAllocator::Pressure PhysicalAllocator::GetPressure(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    return gShared->pools[pool]->getPressure();
+}
+
+/**
+ * @brief Get the number of free pages in a pool.
+ *
+ * This is the count the watermarks are compared against: pages in the zeroed page stash and the
+ * per processor caches aren't included.
+ *
+ * @param pool Pool index to query
+ */
+size_t PhysicalAllocator::GetFreePages(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    return gShared->pools[pool]->getFreePages();
+}
+
+/**
+ * @brief Register a function to be invoked when the memory pressure level of any pool changes.
+ *
+ * This may be called before the allocator is initialized.
+ *
+ * @param handler Function to invoke; see PressureHandler for the restrictions that apply to it
+ * @param context Arbitrary value passed to the handler
+ *
+ * @return 0 on success, or a negative error code
+ */
+int PhysicalAllocator::AddPressureHandler(PressureHandler handler, void *context) {
+    REQUIRE(handler, "invalid %s", "handler");
+
+    Runtime::SpinlockGuard guard(gPressureHandlersLock);
+
+    for(auto &entry : gPressureHandlers) {
+        if(entry.handler) continue;
+
+        __atomic_store_n(&entry.context, context, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry.handler, handler, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // TODO: standardized error codes
+    return -1;
+}
+
+/**
+ * @brief Remove a previously registered pressure handler.
+ *
+ * @param handler Function that was registered
+ * @param context Context value it was registered with
+ *
+ * @return 0 on success, or a negative error code if no such handler is registered
+ *
+ * @remark A handler that's currently being invoked on another processor may still run once the
+ *         call returns, so the context must remain valid for a little while longer.
+ */
+int PhysicalAllocator::RemovePressureHandler(PressureHandler handler, void *context) {
+    Runtime::SpinlockGuard guard(gPressureHandlersLock);
+
+    for(auto &entry : gPressureHandlers) {
+        if(entry.handler != handler || entry.context != context) continue;
+
+        __atomic_store_n(&entry.handler, nullptr, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // TODO: standardized error codes
+    return -1;
+}
+
+/**
+ * @brief Invoke all registered pressure handlers.
+ *
+ * @param pool Index of the pool whose pressure level changed
+ * @param level New pressure level
+ */
+void PhysicalAllocator::NotifyPressure(const size_t pool, const Pressure level) {
+    for(auto &entry : gPressureHandlers) {
+        const auto handler = __atomic_load_n(&entry.handler, __ATOMIC_ACQUIRE);
+        if(!handler) continue;
+
+        handler(pool, level, __atomic_load_n(&entry.context, __ATOMIC_RELAXED));
+    }
+}
+
+/**
+ * @brief Return the number of pages in the given pool's zeroed page stash.
+ *
+ * @param pool Pool index to query
+ *
+ * @return Number of pre-zeroed pages available
+ */
+size_t PhysicalAllocator::GetZeroedPages(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    return gShared->pools[pool]->getNumZeroed();
+}
+
+/**
+ * @brief Zero free pages ahead of time.
+ *
+ * Tops up the zeroed page stash of each pool in turn, until either all stashes are full or the
+ * given number of pages has been zeroed. Recently freed pages on each pool's dirty list are zeroed
+ * first. This is intended to be called periodically, whenever the system is idle; the budget
+ * bounds how long a single call takes.
+ *
+ * @remark Pages in the zeroed page stash and on the dirty list are counted as allocated.
+ *
+ * @param budget Maximum number of pages to zero
+ *
+ * @return Number of pages zeroed
+ */
+size_t PhysicalAllocator::ZeroFreePages(const size_t budget) {
+    size_t zeroed{0};
+
+    for(size_t i = 0; i < kMaxPools && zeroed < budget; i++) {
+        if(!gShared->pools[i]) continue;
+
+        const auto err = gShared->pools[i]->fillZeroed(budget - zeroed);
+        if(err > 0) zeroed += err;
+    }
+
+    return zeroed;
+}
+
+/**
+ * @brief Return the total number of pages of a large page size in the given pool.
+ *
+ * This is the number of naturally aligned frames of that size that lie entirely inside the
+ * pool's allocatable memory. They overlap with the standard sized pages counted by
+ * GetTotalPages().
+ *
+ * @param pageSize Size of the page, in bytes
+ * @param pool Pool index to query
+ *
+ * @return Number of large pages, or 0 if the page size isn't supported
+ */
+size_t PhysicalAllocator::GetTotalLargePages(const size_t pageSize, const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    const auto idx = gShared->getExtraPageSizeIndex(pageSize);
+    if(idx < 0) return 0;
+
+    return gShared->pools[pool]->getTotalLargePages(idx);
+}
+
+/**
+ * @brief Return the number of large pages of the given size that could currently be allocated.
+ *
+ * @param pageSize Size of the page, in bytes
+ * @param pool Pool index to query
+ *
+ * @return Number of entirely free large frames, or 0 if the page size isn't supported
+ */
+size_t PhysicalAllocator::GetFreeLargePages(const size_t pageSize, const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    const auto idx = gShared->getExtraPageSizeIndex(pageSize);
+    if(idx < 0) return 0;
+
+    return gShared->pools[pool]->getFreeLargePages(idx);
+}
+
+/**
+ * @brief Return the number of large pages of the given size currently allocated.
+ *
+ * @remark The standard sized pages making up these large pages are also counted as allocated by
+ *         GetAllocPages().
+ *
+ * @param pageSize Size of the page, in bytes
+ * @param pool Pool index to query
+ *
+ * @return Number of large pages allocated via AllocateLargePage(), or 0 if the page size isn't
+ *         supported
+ */
+size_t PhysicalAllocator::GetAllocLargePages(const size_t pageSize, const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+
+    const auto idx = gShared->getExtraPageSizeIndex(pageSize);
+    if(idx < 0) return 0;
+
+    return gShared->pools[pool]->getAllocatedLargePages(idx);
+}
+
 /**
  * @brief Add VM objects for each pool's bitmap.
  *
@@ -164,4 +884,282 @@ void PhysicalAllocator::RemapTo(Vm::Map *map) {
         if(!gShared->pools[i]) continue;
         gShared->pools[i]->applyVirtualMap(map);
     }
+
+    // ranges added from now on replace the range table
+    Runtime::SpinlockGuard guard(gPoolRangesLock);
+    gPoolRangesMapped = true;
+}
+
+
+
+/**
+ * @brief Set the relative distances between pools.
+ *
+ * This is used to determine the order in which pools are tried when allocating from the local
+ * pool: after the local pool itself, all other pools are tried in order of increasing distance.
+ *
+ * Pools that aren't covered by the matrix are tried after all others; the DMA pool is never tried.
+ *
+ * @param distances Matrix of distances between pools (row major; entry `i * numPools + j` is the
+ *        distance from pool `i` to pool `j`.) The values are relative; smaller is closer.
+ * @param numPools Number of pools in the matrix; these must be the first pools.
+ */
+void PhysicalAllocator::SetPoolDistances(const uint8_t *distances, const size_t numPools) {
+    REQUIRE(distances, "invalid %s", "distances");
+    REQUIRE(numPools <= gShared->numPools, "invalid pool count %zu (max %zu)", numPools,
+            gShared->numPools);
+
+    for(size_t i = 0; i < numPools; i++) {
+        auto order = gShared->fallback[i];
+        const auto row = distances + (i * numPools);
+
+        // insertion sort the other pools by distance; the local pool always comes first
+        order[0] = i;
+        size_t num{1};
+
+        for(size_t j = 0; j < numPools; j++) {
+            if(j == i || j == gShared->dmaPool) continue;
+
+            auto k = num++;
+            while(k > 1 && row[order[k - 1]] > row[j]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = j;
+        }
+
+        // then all pools without a known distance, and the DMA pool last
+        for(size_t j = numPools; j < gShared->numPools; j++) {
+            if(j != gShared->dmaPool) order[num++] = j;
+        }
+        if(gShared->dmaPool != kLocalPool && gShared->dmaPool != i) {
+            order[num++] = gShared->dmaPool;
+        }
+    }
+}
+
+/**
+ * @brief Designate a pool as the DMA pool.
+ *
+ * The pool is moved to the end of all fallback lists, so it's no longer used to satisfy
+ * allocations for the local pool. Pages from it can only be allocated by requesting the pool
+ * explicitly; see GetDmaPool().
+ *
+ * @remark The DMA pool may not be any processor's local pool.
+ *
+ * @param pool Index of the pool holding memory for devices with limited addressing capabilities
+ */
+void PhysicalAllocator::SetDmaPool(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+    REQUIRE(gShared->numPools > 1, "DMA pool cannot be the only pool");
+    REQUIRE(gShared->dmaPool == kLocalPool, "DMA pool already set");
+
+    gShared->dmaPool = pool;
+    gShared->numFallbackPools = gShared->numPools - 1;
+
+    for(size_t i = 0; i < gShared->numPools; i++) {
+        if(i == pool) continue;
+        auto order = gShared->fallback[i];
+
+        size_t j{0};
+        while(order[j] != pool) j++;
+        for(; j < gShared->numPools - 1; j++) {
+            order[j] = order[j + 1];
+        }
+        order[j] = pool;
+    }
+}
+
+/**
+ * @brief Get the index of the DMA pool.
+ *
+ * @return Index of the DMA pool, or `kLocalPool` if the platform doesn't have one; in either case,
+ *         the result can be passed as the pool index to any of the allocation functions.
+ */
+size_t PhysicalAllocator::GetDmaPool() {
+    return gShared->dmaPool;
+}
+
+/**
+ * @brief Set the calling processor's local pool.
+ *
+ * Any pages held in the processor's page cache are returned to their pool first, since the cache
+ * holds pages from the local pool only.
+ *
+ * @remark This must be called after processor local storage has been set up for the processor.
+ *
+ * @param pool Index of the pool closest to the calling processor
+ */
+void PhysicalAllocator::SetLocalPool(const size_t pool) {
+    REQUIRE(pool < gShared->numPools, "invalid pool");
+    REQUIRE(pool != gShared->dmaPool, "DMA pool cannot be a local pool");
+
+    auto locals = Platform::ProcessorLocals::GetKernelData();
+    auto cache = &locals->pageCache;
+
+    if(cache->pool != pool) {
+        cache->flush(gShared->pools[cache->pool]);
+        cache->pool = pool;
+    }
+    locals->physPool = pool;
+}
+
+/**
+ * @brief Get the calling processor's local pool.
+ *
+ * @return Index of the pool closest to the calling processor; this is always the first pool if
+ *         processor local storage isn't available yet.
+ */
+size_t PhysicalAllocator::GetLocalPool() {
+    // processor local storage is available once the caches are enabled
+    if(!gCpuCachesEnabled) return 0;
+
+    return Platform::ProcessorLocals::GetKernelData()->physPool;
+}
+
+/**
+ * @brief Get the index of the calling processor.
+ *
+ * @return Index of the calling processor; this is always 0 if processor local storage isn't
+ *         available yet.
+ */
+uint32_t PhysicalAllocator::GetCpuId() {
+    if(!gCpuCachesEnabled) return 0;
+
+    return Platform::ProcessorLocals::GetKernelData()->cpuId;
+}
+
+/**
+ * @brief Get the number of pools that have been initialized.
+ */
+size_t PhysicalAllocator::GetNumPools() {
+    return gShared->numPools;
+}
+
+/**
+ * @brief Find the pool that a physical page belongs to.
+ *
+ * @param address Physical address of the page
+ *
+ * @return Index of the pool containing the page, or `kLocalPool` if there is none.
+ */
+size_t PhysicalAllocator::FindPool(const uintptr_t address) {
+    const auto table = __atomic_load_n(&gShared->poolRanges, __ATOMIC_ACQUIRE);
+
+    // find the last range starting at or below the address
+    size_t low{0}, high{table->numRanges};
+    while(low < high) {
+        const auto mid = low + ((high - low) / 2);
+        if(table->ranges[mid].base <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if(low && address < table->ranges[low - 1].end) {
+        return table->ranges[low - 1].pool;
+    }
+    return kLocalPool;
+}
+
+/**
+ * @brief Start using the per processor page caches.
+ *
+ * This must be called only once processor local storage has been set up on all processors that
+ * may allocate memory, since the caches live there. A pressure handler is installed that drains
+ * the caches when memory runs low.
+ */
+void PhysicalAllocator::EnableCpuCaches() {
+    gCpuCachesEnabled = true;
+
+    const auto err = AddPressureHandler(&DrainCpuCache);
+    REQUIRE(!err, "failed to install page cache pressure handler: %d", err);
+}
+
+/**
+ * @brief Return all pages held by the calling processor's cache to its pool.
+ */
+void PhysicalAllocator::FlushCpuCache() {
+    if(!gCpuCachesEnabled) return;
+
+    auto cache = &Platform::ProcessorLocals::GetKernelData()->pageCache;
+    if(cache->busy) return;
+
+    cache->busy = true;
+    cache->flush(gShared->pools[cache->pool]);
+    cache->busy = false;
+}
+
+/**
+ * @brief Pressure handler that drains the calling processor's page cache
+ *
+ * When a pool comes under pressure, the pages cached by the processor that noticed it are
+ * returned to the pool. Other processors' caches are only accessed by their owners, so they keep
+ * their pages; they hold at most `PageCache::kCapacity` pages each.
+ *
+ * Nothing happens if the handler was invoked from within an operation on the cache itself.
+ */
+void PhysicalAllocator::DrainCpuCache(const size_t pool, const Pressure level, void *) {
+    if(level == kPressureNone) return;
+
+    auto cache = GetCpuCache(pool);
+    if(!cache) return;
+
+    cache->busy = true;
+    cache->flush(gShared->pools[pool]);
+    cache->busy = false;
+}
+
+/**
+ * @brief Read the calling processor's page cache counters.
+ *
+ * @param outHits Number of allocations satisfied entirely from the cache
+ * @param outMisses Number of allocations that had to consult the pool
+ *
+ * @return Whether the per processor caches are enabled (counters are only valid if so)
+ */
+bool PhysicalAllocator::GetCpuCacheStats(size_t &outHits, size_t &outMisses) {
+    if(!gCpuCachesEnabled) return false;
+
+    const auto &stats = Platform::ProcessorLocals::GetKernelData()->pageCache.getStats();
+    outHits = stats.hits;
+    outMisses = stats.misses;
+
+    return true;
+}
+
+/**
+ * @brief Get the calling processor's page cache, if it caches pages from the given pool.
+ *
+ * @param pool Index of the pool an allocation is to be made from
+ *
+ * @return Page cache to use, or `nullptr` if the pool should be accessed directly (including when
+ *         the cache is already in use further up the call stack)
+ */
+Memory::PageCache *PhysicalAllocator::GetCpuCache(const size_t pool) {
+    if(!gCpuCachesEnabled) return nullptr;
+
+    auto cache = &Platform::ProcessorLocals::GetKernelData()->pageCache;
+    return (cache->pool == pool && !cache->busy) ? cache : nullptr;
+}
+
+/**
+ * @brief Look up the index of an extra page size.
+ *
+ * @param pageSize Page size, in bytes
+ *
+ * @return Index into the extra page sizes array, or a negative error code if the page size is not
+ *         supported.
+ */
+int PhysicalAllocator::getExtraPageSizeIndex(const size_t pageSize) const {
+    if(pageSize <= this->pageSz || __builtin_popcountll(pageSize) != 1) return -1;
+
+    const size_t power = __builtin_ctzll(pageSize) - __builtin_ctzll(this->pageSz);
+    for(size_t i = 0; i < this->numExtraPageSizes; i++) {
+        if(this->extraPageSizes[i] == power) return i;
+    }
+
+    // TODO: standardized error codes
+    return -1;
 }
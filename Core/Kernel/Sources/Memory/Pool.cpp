@@ -1,7 +1,13 @@
 #include "Memory/Pool.h"
+#include "Memory/BuddyRegion.h"
 #include "Memory/Region.h"
 
 #include "Logging/Console.h"
+#include "Memory/PageFrameDb.h"
+#include "Memory/PhysicalAllocator.h"
+#include "Runtime/Printf.h"
+#include "Runtime/String.h"
+#include "Vm/Map.h"
 
 #include <Platform.h>
 #include <Intrinsics.h>
@@ -10,38 +16,323 @@
 using namespace Kernel::Memory;
 
 // space in .bss segment for regions
-static KUSH_ALIGNED(64) uint8_t gRegionAllocBuf[Pool::kMaxGlobalRegions][sizeof(Region)];
+static KUSH_ALIGNED(64) uint8_t gRegionAllocBuf[Pool::kStaticRegions][sizeof(Pool::RegionType)];
 // next free index in the allocation buffer
 static size_t gRegionAllocBufNextFree{0};
 
+// page from which region objects are allocated once the static buffers are exhausted
+static uint8_t *gStoragePage{nullptr};
+// number of bytes of the storage page that are in use
+static size_t gStoragePageUsed{0};
+
+// serializes adding regions to all pools
+static Kernel::Runtime::Spinlock gRegionLock;
+
+// kernel map that region metadata is mapped into, once virtual memory is available
+static Kernel::Vm::Map *gMetadataMap{nullptr};
+// virtual address at which the next region's metadata is mapped
+static uintptr_t gMetadataNext{Platform::KernelAddressLayout::PhysAllocatorMetadataStart};
+
+/**
+ * @brief Sort an array of physical addresses in ascending order.
+ *
+ * This is a simple insertion sort; it's only used on small batches of addresses.
+ *
+ * @param addrs Addresses to sort
+ * @param num Number of addresses
+ */
+static void SortAddresses(uintptr_t *addrs, const size_t num) {
+    for(size_t i = 1; i < num; i++) {
+        const auto addr = addrs[i];
+
+        size_t j = i;
+        while(j && addrs[j - 1] > addr) {
+            addrs[j] = addrs[j - 1];
+            j--;
+        }
+
+        addrs[j] = addr;
+    }
+}
+
+/**
+ * @brief Get the logarithmic histogram bucket for a value.
+ *
+ * @param value Value to look up; zero is counted in the first bucket
+ *
+ * @return Index of the bucket, which is always less than `Pool::kHistogramBuckets`
+ */
+static size_t GetHistogramBucket(const uint64_t value) {
+    if(!value) return 0;
+
+    const size_t bucket = 63 - __builtin_clzll(value);
+    return (bucket < Pool::kHistogramBuckets) ? bucket : (Pool::kHistogramBuckets - 1);
+}
+
+/**
+ * @brief Write a logarithmic histogram to the console.
+ *
+ * Only buckets with a nonzero count are printed, as `bucket:count` pairs.
+ *
+ * @param label Text to print in front of the histogram
+ * @param counts Histogram to print; it has `Pool::kHistogramBuckets` entries
+ */
+static void PrintHistogram(const char *label, const size_t *counts) {
+    constexpr static const size_t kBufChars{384};
+    char buf[kBufChars];
+    size_t used{0};
+
+    for(size_t i = 0; i < Pool::kHistogramBuckets && used < kBufChars; i++) {
+        const auto count = __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+        if(!count) continue;
+
+        used += snprintf_(buf + used, kBufChars - used, " %zu:%zu", i, count);
+    }
+
+    buf[(used < kBufChars) ? used : (kBufChars - 1)] = '\0';
+    Kernel::Console::Notice("%s%s", label, used ? buf : " (empty)");
+}
+
 /**
  * @brief Adds a region of physical memory to the pool.
  *
+ * Before virtual memory is available, the region is added to the pool's built in region table;
+ * there is no concurrent access to the pool at that point. Afterwards, the region's metadata is
+ * mapped right away, and a new region table containing it replaces the current one.
+ *
+ * Any reserved ranges are claimed before the region is added to the region table, so that they
+ * can never be allocated, not even by page table allocations made while it is being mapped.
+ *
  * @param base Base address of the region
  * @param length Length of the region, in bytes
+ * @param reserved Ranges inside the region to reserve (may be `nullptr` if there are none)
+ * @param numReserved Number of reserved ranges
  *
  * @remark Base and length should be page aligned.
+ *
+ * @remark Replaced region tables are never freed, since other processors may still be using
+ *         them; this costs a few pages each time memory is hot added.
  */
-void Pool::addRegion(const uintptr_t base, const size_t length) {
-    REQUIRE(gRegionAllocBufNextFree < kMaxGlobalRegions, "region buffer exhausted");
+void Pool::addRegion(const uintptr_t base, const size_t length,
+        const PhysicalAllocator::ReservedRange *reserved, const size_t numReserved) {
+    Runtime::SpinlockGuard guard(gRegionLock);
 
-    // find a free index
-    size_t freeIndex{kMaxRegions};
-    for(freeIndex = 0; freeIndex < kMaxRegions; freeIndex++) {
-        if(!this->regions[freeIndex]) goto beach;
+    // get storage for the region
+    void *storage;
+    if(gRegionAllocBufNextFree < kStaticRegions) {
+        storage = gRegionAllocBuf[gRegionAllocBufNextFree++];
+    } else {
+        storage = AllocStorage(sizeof(RegionType));
     }
 
-beach:;
-    REQUIRE(freeIndex < kMaxRegions, "pool cannot accept any more regions");
+    auto ptr = new (storage) RegionType(this, base, length);
+
+    // early boot: the region is mapped later, in applyVirtualMap()
+    auto table = this->table;
+    if(!gMetadataMap) {
+        REQUIRE(table->numRegions < table->capacity,
+                "pool cannot accept any more regions before VM is available");
+        this->reserveRanges(ptr, reserved, numReserved);
+        InsertRegion(table, ptr);
+    } else {
+        // map its metadata now, then replace the region table
+        const auto used = ptr->applyVirtualMap(gMetadataNext, gMetadataMap);
+        REQUIRE(used, "failed to map region %p", ptr);
+
+        gMetadataNext += used + Platform::PageTable::PageSize();
+        REQUIRE(gMetadataNext < Platform::KernelAddressLayout::PhysAllocatorMetadataEnd,
+                "physical allocator metadata overflow (%016zx)", gMetadataNext);
+
+        this->reserveRanges(ptr, reserved, numReserved);
+
+        auto newTable = AllocRegionTable(table->numRegions + 1);
+        memcpy(newTable->regions, table->regions, table->numRegions * sizeof(RegionType *));
+        memcpy(newTable->sorted, table->sorted, table->numRegions * sizeof(uint32_t));
+        newTable->numRegions = table->numRegions;
+
+        InsertRegion(newTable, ptr);
+        __atomic_store_n(&this->table, newTable, __ATOMIC_RELEASE);
+
+        // the region's pages may be allocated immediately, so they need page frame entries now
+        PageFrameDb::AddRange(gMetadataMap, ptr->getAllocBase(),
+                ptr->getAllocEnd() - ptr->getAllocBase());
+    }
+
+    // account for its free pages
+    this->adjustFree(ptr->getTotalPages() - ptr->getAllocatedPages());
+    this->updateWatermarks();
+}
+
+/**
+ * @brief Append a region to a region table.
+ *
+ * @param table Region table to modify; it must have room for another region
+ * @param region Region to append
+ */
+void Pool::InsertRegion(RegionTable *table, RegionType *region) {
+    const auto index = table->numRegions;
+    table->regions[index] = region;
+
+    // insert it into the sorted region index
+    size_t pos = index;
+    const auto regionBase = region->getAllocBase();
+
+    while(pos && table->regions[table->sorted[pos - 1]]->getAllocBase() > regionBase) {
+        table->sorted[pos] = table->sorted[pos - 1];
+        pos--;
+    }
+
+    table->sorted[pos] = index;
+    table->numRegions++;
+}
+
+/**
+ * @brief Reserve ranges inside a region that is about to be added.
+ *
+ * The region must not be in the region table yet, so the free page count is not adjusted here;
+ * reserved pages are counted as allocated when the region's free pages are accounted for.
+ *
+ * @param region Region to reserve the ranges in
+ * @param reserved Ranges to reserve; they must lie within the region
+ * @param numReserved Number of ranges
+ */
+void Pool::reserveRanges(RegionType *region, const PhysicalAllocator::ReservedRange *reserved,
+        const size_t numReserved) {
+    for(size_t i = 0; i < numReserved; i++) {
+        region->reserve(this, reserved[i].base, reserved[i].length);
+    }
+}
+
+/**
+ * @brief Allocate a region table from the physical allocator.
+ *
+ * The table header and both arrays are placed in a single physically contiguous allocation, which
+ * is accessed through the physical aperture.
+ *
+ * @param minCapacity Minimum number of regions the table must be able to hold; the actual capacity
+ *        is however many regions fit into the allocated pages.
+ *
+ * @return An empty region table
+ */
+Pool::RegionTable *Pool::AllocRegionTable(const size_t minCapacity) {
+    constexpr static const size_t kPerRegion{sizeof(RegionType *) + sizeof(uint32_t)};
+
+    const auto pageSz = Platform::PageTable::PageSize();
+    const auto bytes = sizeof(RegionTable) + (minCapacity * kPerRegion);
+    const auto pages = (bytes + (pageSz - 1)) / pageSz;
+
+    uintptr_t phys;
+    int err = PhysicalAllocator::AllocateContiguous(pages, 0, phys);
+    REQUIRE(err > 0, "failed to allocate region table: %d", err);
+
+    void *ptr;
+    err = Platform::Memory::PhysicalMap::Add(phys, pages * pageSz, &ptr);
+    REQUIRE(!err, "failed to map region table: %d", err);
+
+    // the region pointers come right after the header, followed by the indices
+    auto table = reinterpret_cast<RegionTable *>(ptr);
+    table->capacity = ((pages * pageSz) - sizeof(RegionTable)) / kPerRegion;
+    table->numRegions = 0;
+    table->regions = reinterpret_cast<RegionType **>(table + 1);
+    table->sorted = reinterpret_cast<uint32_t *>(table->regions + table->capacity);
+
+    return table;
+}
+
+/**
+ * @brief Get memory for a region related object.
+ *
+ * This is used for the region objects, as well as their metadata VM objects, once the static
+ * buffers for them are exhausted: the memory is carved out of pages from the physical allocator,
+ * and never freed. The caller must hold the region lock.
+ *
+ * @remark This can only be used once the kernel's address space is active, since the pages are
+ *         accessed through the physical aperture.
+ *
+ * @param bytes Size of the object; it must be smaller than a page
+ *
+ * @return Memory to construct the object in (aligned to 64 bytes)
+ */
+void *Pool::AllocStorage(const size_t bytes) {
+    const auto pageSz = Platform::PageTable::PageSize();
+    const auto size = (bytes + 63) & ~63ULL;
+
+    REQUIRE(gMetadataMap && !Platform::Memory::PhysicalMap::IsEarlyBoot(),
+            "region buffer exhausted");
+    REQUIRE(size <= pageSz, "invalid storage size %zu", bytes);
+
+    // get a new page if the current one is full
+    if(!gStoragePage || (gStoragePageUsed + size) > pageSz) {
+        uintptr_t phys;
+        int err = PhysicalAllocator::AllocatePages(1, &phys);
+        REQUIRE(err == 1, "failed to allocate region storage: %d", err);
+
+        void *ptr;
+        err = Platform::Memory::PhysicalMap::Add(phys, pageSz, &ptr);
+        REQUIRE(!err, "failed to map region storage: %d", err);
+
+        gStoragePage = reinterpret_cast<uint8_t *>(ptr);
+        gStoragePageUsed = 0;
+    }
+
+    auto ptr = gStoragePage + gStoragePageUsed;
+    gStoragePageUsed += size;
+    return ptr;
+}
+
+/**
+ * @brief Permanently reserve a range of physical memory in the pool's regions.
+ *
+ * This is used to mark holes in regions that span multiple ranges of usable memory.
+ *
+ * @param base Physical address of the first page to reserve
+ * @param length Length of the range, in bytes
+ *
+ * @return Number of pages reserved
+ */
+size_t Pool::reserve(const uintptr_t base, const size_t length) {
+    size_t reserved{0};
+    const auto table = this->getRegionTable();
+
+    for(size_t i = 0; i < table->numRegions; i++) {
+        reserved += table->regions[i]->reserve(this, base, length);
+    }
+
+    if(reserved) {
+        this->adjustFree(-static_cast<int64_t>(reserved));
+        this->updateWatermarks();
+    }
+
+    return reserved;
+}
+
+/**
+ * @brief Make a range of previously reserved physical memory available for allocation.
+ *
+ * @param base Physical address of the first page
+ * @param length Length of the range, in bytes
+ *
+ * @return Number of pages made available
+ */
+size_t Pool::unreserve(const uintptr_t base, const size_t length) {
+    size_t released{0};
+    const auto table = this->getRegionTable();
+
+    for(size_t i = 0; i < table->numRegions; i++) {
+        const auto regionReleased = table->regions[i]->unreserve(this, base, length);
 
-    // allocate and store it
-    const auto idx = gRegionAllocBufNextFree++;
-    auto ptr = reinterpret_cast<Region *>(gRegionAllocBuf[idx]);
-    new (ptr) Region(this, base, length);
+        if(regionReleased) {
+            this->lowerRegionHint(i);
+        }
+        released += regionReleased;
+    }
 
-    // TODO: apply virtual memory mapping immediately if VM is already activated
+    if(released) {
+        this->adjustFree(released);
+        this->updateWatermarks();
+    }
 
-    this->regions[freeIndex] = ptr;
+    return released;
 }
 
 /**
@@ -51,23 +342,36 @@ beach:;
  * provided by the platform code. Bitmaps are placed sequentially, one after another, with a single
  * guard page between each allocation to catch out of bounds accesses.
  *
+ * This also marks virtual memory as available: regions added after this call are mapped
+ * immediately, and may be allocated from the physical allocator. Finally, the page frame database
+ * is backed for the memory covered by all regions.
+ *
  * @param map Kernel memory map to receive the bitmaps.
  */
 void Pool::applyVirtualMap(Vm::Map *map) {
-    // start address of the bitmaps
-    static uintptr_t gBitmapStart{Platform::KernelAddressLayout::PhysAllocatorMetadataStart};
+    Runtime::SpinlockGuard guard(gRegionLock);
 
     // map each region
-    for(size_t i = 0; i < kMaxRegions; i++) {
-        auto region = this->regions[i];
-        if(!region) break;
+    const auto table = this->table;
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
 
-        const auto used = region->applyVirtualMap(gBitmapStart, map);
+        const auto used = region->applyVirtualMap(gMetadataNext, map);
         REQUIRE(used, "failed to map region %p", region);
 
-        gBitmapStart += used + Platform::PageTable::PageSize();
-        REQUIRE(gBitmapStart < Platform::KernelAddressLayout::PhysAllocatorMetadataEnd,
-                "physical allocator metadata overflow (%016zx)", gBitmapStart);
+        gMetadataNext += used + Platform::PageTable::PageSize();
+        REQUIRE(gMetadataNext < Platform::KernelAddressLayout::PhysAllocatorMetadataEnd,
+                "physical allocator metadata overflow (%016zx)", gMetadataNext);
+    }
+
+    // any regions added from now on are mapped right away
+    gMetadataMap = map;
+
+    // back the page frame database for all of them
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+        PageFrameDb::AddRange(map, region->getAllocBase(),
+                region->getAllocEnd() - region->getAllocBase());
     }
 }
 
@@ -76,7 +380,7 @@ void Pool::applyVirtualMap(Vm::Map *map) {
  *
  * This consults each of the regions in the pool sequentially to satisfy however many pages are
  * remaining to allocate. So it's possible the allocations are satisfied from different regions of
- * physical memory.
+ * physical memory. Regions below the region hint are known to be full, so they're skipped.
  *
  * @param num Number of pages to allocate
  * @param outAddrs Buffer to receive the physical addresses of pages; it must be large enough to
@@ -88,56 +392,670 @@ void Pool::applyVirtualMap(Vm::Map *map) {
 int Pool::alloc(const size_t num, uintptr_t *outAddrs) {
     int allocated{0}, err;
     auto outPtr = outAddrs;
+    const auto start = Platform::Processor::GetCycleCount();
+
+    const auto hint = __atomic_load_n(&this->regionHint, __ATOMIC_SEQ_CST);
+    const auto table = this->getRegionTable();
 
-    for(size_t i = 0; i < kMaxRegions; i++) {
-        auto region = this->regions[i];
-        if(!region) break;
+    for(size_t i = hint; i < table->numRegions; i++) {
+        auto region = table->regions[i];
 
         // request allocation
         err = region->alloc(this, (num - allocated), outPtr);
         if(err < 0) goto error;
 
         allocated += err;
+        outPtr += err;
 
         // were all pages allocated?
         if(allocated == num) break;
-        // otherwise, check the next entry into the region list
-        region++;
+        // otherwise, the region is full; check the next entry into the region list
+        this->advanceRegionHint(i);
     }
 
+    if(allocated) {
+        this->adjustFree(-static_cast<int64_t>(allocated));
+    }
+
+    this->recordAlloc(num, allocated, start);
     return allocated;
 
 error:;
     // an allocation failed; we'll have to free any existing pages
     if(allocated) {
-        this->free(allocated, outAddrs);
+        this->adjustFree(-static_cast<int64_t>(allocated));
+        this->freeToRegions(allocated, outAddrs);
     }
 
+    this->recordAlloc(num, err, start);
     return err;
 }
 
 /**
  * @brief Free the provided physical pages.
  *
+ * While the zeroed page stash has room, the pages are set aside on the dirty list (so that they
+ * are the next to be zeroed) rather than being returned to the regions.
+ *
  * @param num Number of pages to free
  * @param inAddrs Buffer containing physical addresses of pages to deallocate
  *
+ * @remark Any addresses that don't belong to this pool are ignored.
+ *
  * @return Total number of deallocated pages
  */
 int Pool::free(const size_t num, const uintptr_t *inAddrs) {
     int freed{0};
+    uintptr_t rest[kFreeBatchSize];
+
+    for(size_t done = 0; done < num; ) {
+        // avoid checking ownership of each page if there's no room on the dirty list
+        if(this->getPressure() != PhysicalAllocator::kPressureNone ||
+                this->getNumDirty() >= kDirtyCapacity ||
+                (this->getNumZeroed() + this->getNumDirty()) >= kZeroedCapacity) {
+            const auto err = this->freeToRegions(num - done, inAddrs + done);
+            return (err < 0) ? err : (freed + err);
+        }
 
-    for(size_t i = 0; i < kMaxRegions; i++) {
-        auto region = this->regions[i];
-        if(!region) break;
+        const auto count = ((num - done) < kFreeBatchSize) ? (num - done) : kFreeBatchSize;
+        size_t numRest;
 
-        freed += region->free(this, num, inAddrs);
-        if(freed == num) break;
+        freed += this->holdDirty(count, inAddrs + done, rest, numRest);
+        if(numRest) {
+            const auto err = this->freeToRegions(numRest, rest);
+            if(err < 0) return err;
+            freed += err;
+        }
+
+        done += count;
     }
 
     return freed;
 }
 
+/**
+ * @brief Return the provided physical pages to the pool's regions.
+ *
+ * Addresses are sorted in small batches, so that each run of addresses belonging to the same
+ * region can be handed to it at once; this also places pages in the same bitmap word next to
+ * each other, so the region can free them together.
+ *
+ * @param num Number of pages to free
+ * @param inAddrs Buffer containing physical addresses of pages to deallocate
+ *
+ * @remark Any addresses that don't belong to this pool are ignored.
+ *
+ * @return Total number of deallocated pages
+ */
+int Pool::freeToRegions(const size_t num, const uintptr_t *inAddrs) {
+    int freed{0};
+    uintptr_t batch[kFreeBatchSize];
+    const auto start = Platform::Processor::GetCycleCount();
+
+    for(size_t done = 0; done < num; ) {
+        const auto count = ((num - done) < kFreeBatchSize) ? (num - done) : kFreeBatchSize;
+
+        memcpy(batch, inAddrs + done, count * sizeof(uintptr_t));
+        SortAddresses(batch, count);
+
+        for(size_t i = 0; i < count; ) {
+            size_t index;
+            auto region = this->findRegion(batch[i], index);
+            if(!region) {
+                i++;
+                continue;
+            }
+
+            size_t end = i + 1;
+            while(end < count && region->contains(batch[end])) end++;
+
+            const auto regionFreed = region->free(this, end - i, batch + i);
+            if(regionFreed) {
+                this->lowerRegionHint(index);
+            }
+
+            freed += regionFreed;
+            i = end;
+        }
+
+        done += count;
+    }
+
+    if(freed) {
+        this->adjustFree(freed);
+    }
+
+    this->recordFree(start);
+    return freed;
+}
+
+/**
+ * @brief Allocate a physically contiguous run of pages from one of this pool's regions.
+ *
+ * @param num Number of pages to allocate
+ * @param alignLog2 Required alignment of the first page, as a power of two multiple of the page
+ *        size
+ * @param outBase Variable to receive the physical address of the first page
+ *
+ * @return Number of allocated pages (either 0 or `num`) or a negative error code
+ */
+int Pool::allocContiguous(const size_t num, const size_t alignLog2, uintptr_t &outBase) {
+    const auto table = this->getRegionTable();
+
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        const auto err = region->allocContiguous(this, num, alignLog2, outBase);
+        if(err > 0) this->adjustFree(-static_cast<int64_t>(num));
+        if(err) return err;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free a physically contiguous run of pages.
+ *
+ * @param base Physical address of the first page
+ * @param num Number of pages in the run
+ *
+ * @return Number of pages freed, or a negative error code
+ */
+int Pool::freeContiguous(const uintptr_t base, const size_t num) {
+    size_t index;
+    auto region = this->findRegion(base, index);
+    if(region) {
+        this->lowerRegionHint(index);
+
+        const auto err = region->freeContiguous(this, base, num);
+        if(err > 0) this->adjustFree(err);
+        return err;
+    }
+
+    // TODO: standardized error codes
+    return -1;
+}
+
+/**
+ * @brief Allocate a large frame from one of this pool's regions.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param outAddr Variable to receive the physical address of the frame
+ *
+ * @return 1 if a frame was allocated, 0 if none are free, or a negative error code
+ */
+int Pool::allocLarge(const size_t sizeIdx, uintptr_t &outAddr) {
+    const auto table = this->getRegionTable();
+
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        const auto err = region->allocLarge(this, sizeIdx, outAddr);
+        if(err > 0) {
+            this->adjustFree(-(1LL << this->allocator->getExtraPageSizeLog2(sizeIdx)));
+        }
+        if(err) return err;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free a large frame.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param addr Physical address of the frame
+ *
+ * @return 1 if the frame was freed, or a negative error code
+ */
+int Pool::freeLarge(const size_t sizeIdx, const uintptr_t addr) {
+    size_t index;
+    auto region = this->findRegion(addr, index);
+    if(region) {
+        this->lowerRegionHint(index);
+
+        const auto err = region->freeLarge(this, sizeIdx, addr);
+        if(err > 0) this->adjustFree(1LL << this->allocator->getExtraPageSizeLog2(sizeIdx));
+        return err;
+    }
+
+    // TODO: standardized error codes
+    return -1;
+}
+
+/**
+ * @brief Move the region hint past a region that ran out of free pages.
+ *
+ * If pages were freed to the region in the meantime, the hint is lowered again.
+ *
+ * @param from Index of the region that is full
+ */
+void Pool::advanceRegionHint(size_t from) {
+    const auto index = from;
+
+    if(!__atomic_compare_exchange_n(&this->regionHint, &from, index + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    auto region = this->getRegionTable()->regions[index];
+    if(region->getAllocatedPages() < region->getTotalPages()) {
+        this->lowerRegionHint(index);
+    }
+}
+
+/**
+ * @brief Lower the region hint after pages were freed to a region.
+ *
+ * @param index Index of the region that received free pages
+ */
+void Pool::lowerRegionHint(const size_t index) {
+    auto hint = __atomic_load_n(&this->regionHint, __ATOMIC_SEQ_CST);
+
+    while(index < hint && !__atomic_compare_exchange_n(&this->regionHint, &hint, index, true,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+}
+
+/**
+ * @brief Update the statistics after an allocation.
+ *
+ * @param requested Number of pages that were requested
+ * @param allocated Number of pages allocated, or a negative error code
+ * @param start Cycle counter value at the start of the allocation
+ */
+void Pool::recordAlloc(const size_t requested, const int allocated, const uint64_t start) {
+    const auto ticks = Platform::Processor::GetCycleCount() - start;
+
+    __atomic_add_fetch(&this->stats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->stats.allocLatency[GetHistogramBucket(ticks)], 1,
+            __ATOMIC_RELAXED);
+
+    if(allocated <= 0) {
+        __atomic_add_fetch(&this->stats.failedAllocs, 1, __ATOMIC_RELAXED);
+    } else if(static_cast<size_t>(allocated) < requested) {
+        __atomic_add_fetch(&this->stats.partialAllocs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Update the statistics after pages were freed.
+ *
+ * @param start Cycle counter value at the start of the free operation
+ */
+void Pool::recordFree(const uint64_t start) {
+    const auto ticks = Platform::Processor::GetCycleCount() - start;
+
+    __atomic_add_fetch(&this->stats.frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->stats.freeLatency[GetHistogramBucket(ticks)], 1,
+            __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Update the number of free pages, and check it against the watermarks.
+ *
+ * @param delta Number of pages that became free (positive) or were allocated (negative)
+ */
+void Pool::adjustFree(const int64_t delta) {
+    const auto free = __atomic_add_fetch(&this->numFree, static_cast<size_t>(delta),
+            __ATOMIC_RELAXED);
+    this->updatePressure(free);
+}
+
+/**
+ * @brief Determine the pool's pressure level for the given number of free pages.
+ *
+ * The level rises to the highest watermark that free memory dropped below; it's lowered when free
+ * memory rises above the next watermark, except that it only returns to `kPressureNone` once
+ * free memory is above the high watermark. If the level changed, the pressure handlers are
+ * invoked.
+ *
+ * @param free Number of free pages in the pool
+ */
+void Pool::updatePressure(const size_t free) {
+    const auto min = __atomic_load_n(&this->watermarks.min, __ATOMIC_RELAXED),
+          low = __atomic_load_n(&this->watermarks.low, __ATOMIC_RELAXED),
+          high = __atomic_load_n(&this->watermarks.high, __ATOMIC_RELAXED);
+
+    auto current = __atomic_load_n(&this->pressure, __ATOMIC_RELAXED);
+    PhysicalAllocator::Pressure next;
+
+    do {
+        if(free < min) {
+            next = PhysicalAllocator::kPressureMin;
+        } else if(free < low) {
+            next = (current == PhysicalAllocator::kPressureNone) ?
+                PhysicalAllocator::kPressureLow : current;
+        } else if(free >= high) {
+            next = PhysicalAllocator::kPressureNone;
+        } else {
+            next = (current == PhysicalAllocator::kPressureMin) ?
+                PhysicalAllocator::kPressureLow : current;
+        }
+
+        if(next == current) return;
+    } while(!__atomic_compare_exchange_n(&this->pressure, &current, next, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // update the statistics
+    if(next == PhysicalAllocator::kPressureMin) {
+        __atomic_add_fetch(&this->stats.minHits, 1, __ATOMIC_RELAXED);
+    } else if(next == PhysicalAllocator::kPressureNone) {
+        __atomic_add_fetch(&this->stats.highHits, 1, __ATOMIC_RELAXED);
+    } else if(current == PhysicalAllocator::kPressureNone) {
+        __atomic_add_fetch(&this->stats.lowHits, 1, __ATOMIC_RELAXED);
+    }
+
+    if(next != PhysicalAllocator::kPressureNone) {
+        this->flushDirty();
+    }
+    this->notifyPressure();
+}
+
+/**
+ * @brief Inform the pressure handlers of the pool's current pressure level.
+ *
+ * Only one processor invokes the handlers for a pool at a time. If the level changes while they
+ * are running (including because of memory freed by a handler) the handlers are invoked again
+ * with the latest level once they return, rather than recursively.
+ */
+void Pool::notifyPressure() {
+    __atomic_store_n(&this->notifyPending, true, __ATOMIC_RELEASE);
+
+    while(__atomic_load_n(&this->notifyPending, __ATOMIC_ACQUIRE) &&
+            !__atomic_exchange_n(&this->notifying, true, __ATOMIC_ACQUIRE)) {
+        while(__atomic_exchange_n(&this->notifyPending, false, __ATOMIC_ACQ_REL)) {
+            PhysicalAllocator::NotifyPressure(this->index, this->getPressure());
+        }
+
+        __atomic_store_n(&this->notifying, false, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Recalculate the default watermarks after the pool's size changed.
+ *
+ * Nothing happens if the watermarks were set explicitly.
+ */
+void Pool::updateWatermarks() {
+    if(this->watermarks.fixed) return;
+
+    const auto total = this->getTotalPages();
+    __atomic_store_n(&this->watermarks.min, (total * kDefaultMinWatermark) / 1024,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&this->watermarks.low, (total * kDefaultLowWatermark) / 1024,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&this->watermarks.high, (total * kDefaultHighWatermark) / 1024,
+            __ATOMIC_RELAXED);
+
+    this->updatePressure(this->getFreePages());
+}
+
+/**
+ * @brief Set the pool's watermarks.
+ *
+ * They replace the default watermarks for good, and are not adjusted when the pool's size
+ * changes.
+ *
+ * @param min Number of free pages below which the pool is under severe pressure
+ * @param low Number of free pages below which the pool is under pressure
+ * @param high Number of free pages above which the pool is no longer under pressure
+ */
+void Pool::setWatermarks(const size_t min, const size_t low, const size_t high) {
+    REQUIRE(min <= low && low <= high, "invalid watermarks (%zu, %zu, %zu)", min, low, high);
+
+    this->watermarks.fixed = true;
+    __atomic_store_n(&this->watermarks.min, min, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->watermarks.low, low, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->watermarks.high, high, __ATOMIC_RELAXED);
+
+    this->updatePressure(this->getFreePages());
+}
+
+/**
+ * @brief Get the pool's watermarks.
+ *
+ * @param outMin Variable to receive the min watermark, in pages
+ * @param outLow Variable to receive the low watermark, in pages
+ * @param outHigh Variable to receive the high watermark, in pages
+ */
+void Pool::getWatermarks(size_t &outMin, size_t &outLow, size_t &outHigh) const {
+    outMin = __atomic_load_n(&this->watermarks.min, __ATOMIC_RELAXED);
+    outLow = __atomic_load_n(&this->watermarks.low, __ATOMIC_RELAXED);
+    outHigh = __atomic_load_n(&this->watermarks.high, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Take pages from the zeroed page stash.
+ *
+ * @param num Maximum number of pages to take
+ * @param outAddrs Buffer to receive the physical addresses of the pages
+ *
+ * @return Number of pages taken from the stash, which may be less than requested
+ */
+int Pool::allocZeroed(const size_t num, uintptr_t *outAddrs) {
+    int taken{0};
+
+    // avoid taking the lock if the stash is empty
+    if(!this->getNumZeroed()) return 0;
+
+    Runtime::SpinlockGuard guard(this->zeroedLock);
+    auto count = this->numZeroed;
+
+    while(taken < num && count) {
+        outAddrs[taken++] = this->zeroed[--count];
+    }
+
+    __atomic_store_n(&this->numZeroed, count, __ATOMIC_RELAXED);
+    return taken;
+}
+
+/**
+ * @brief Take pages from the dirty list.
+ *
+ * @param num Maximum number of pages to take
+ * @param outAddrs Buffer to receive the physical addresses of the pages
+ *
+ * @return Number of pages taken from the list, which may be less than requested
+ */
+int Pool::allocDirty(const size_t num, uintptr_t *outAddrs) {
+    int taken{0};
+
+    if(!this->getNumDirty()) return 0;
+
+    Runtime::SpinlockGuard guard(this->zeroedLock);
+    auto count = this->numDirty;
+
+    while(taken < num && count) {
+        outAddrs[taken++] = this->dirty[--count];
+    }
+
+    __atomic_store_n(&this->numDirty, count, __ATOMIC_RELAXED);
+    return taken;
+}
+
+/**
+ * @brief Set freed pages aside on the dirty list.
+ *
+ * Only pages that belong to one of the pool's regions are considered; of those, only as many are
+ * held as the zeroed page stash could take after zeroing the dirty list.
+ *
+ * @param num Number of freed pages, at most `kFreeBatchSize`
+ * @param inAddrs Physical addresses of the freed pages
+ * @param outRest Buffer (of `kFreeBatchSize` entries) to receive the addresses of pages owned by
+ *        the pool that did not fit on the dirty list; these must be freed to the regions
+ * @param outNumRest Variable to receive the number of addresses written to `outRest`
+ *
+ * @return Number of pages that were added to the dirty list
+ */
+size_t Pool::holdDirty(const size_t num, const uintptr_t *inAddrs, uintptr_t *outRest,
+        size_t &outNumRest) {
+    size_t held{0}, owned{0};
+
+    // drop any pages that belong to other pools
+    for(size_t i = 0; i < num; i++) {
+        if(this->contains(inAddrs[i])) {
+            outRest[owned++] = inAddrs[i];
+        }
+    }
+
+    if(owned) {
+        Runtime::SpinlockGuard guard(this->zeroedLock);
+        auto count = this->numDirty;
+
+        while(owned && count < kDirtyCapacity && (this->numZeroed + count) < kZeroedCapacity) {
+            this->dirty[count++] = outRest[--owned];
+            held++;
+        }
+
+        __atomic_store_n(&this->numDirty, count, __ATOMIC_RELAXED);
+    }
+
+    outNumRest = owned;
+    return held;
+}
+
+/**
+ * @brief Return all pages on the dirty list to the pool's regions.
+ *
+ * This is done when the pool comes under memory pressure. Since that may happen while the list's
+ * lock is held further up the call stack, nothing happens if it can't be acquired right away.
+ */
+void Pool::flushDirty() {
+    size_t count;
+    uintptr_t pages[kDirtyCapacity];
+
+    if(!this->getNumDirty() || !this->zeroedLock.tryLock()) return;
+
+    count = this->numDirty;
+    memcpy(pages, this->dirty, count * sizeof(uintptr_t));
+    __atomic_store_n(&this->numDirty, 0, __ATOMIC_RELAXED);
+
+    this->zeroedLock.unlock();
+
+    this->freeToRegions(count, pages);
+}
+
+/**
+ * @brief Top up the zeroed page stash.
+ *
+ * Pages from the dirty list, then free pages allocated from the pool's regions, are zeroed, until
+ * either the stash is full or the given number of pages has been zeroed.
+ *
+ * Pages are zeroed in small batches without holding the stash lock; if the stash filled up in the
+ * meantime, the excess pages are returned to the regions.
+ *
+ * @param budget Maximum number of pages to zero
+ *
+ * @return Number of pages added to the stash, or a negative error code
+ */
+int Pool::fillZeroed(const size_t budget) {
+    int err;
+    size_t added{0};
+    uintptr_t batch[kZeroedBatchSize];
+
+    while(added < budget) {
+        auto num = kZeroedCapacity - this->getNumZeroed();
+        if(num > budget - added) num = budget - added;
+        if(num > kZeroedBatchSize) num = kZeroedBatchSize;
+        if(!num) break;
+
+        // prefer pages that were freed recently, so free pages stay in the regions
+        err = this->allocDirty(num, batch);
+        if(!err) {
+            err = this->alloc(num, batch);
+        }
+        if(err <= 0) return added ? added : err;
+
+        this->zeroPages(err, batch);
+
+        size_t stored;
+        {
+            Runtime::SpinlockGuard guard(this->zeroedLock);
+            stored = kZeroedCapacity - this->numZeroed;
+            if(stored > static_cast<size_t>(err)) stored = err;
+
+            memcpy(this->zeroed + this->numZeroed, batch, stored * sizeof(uintptr_t));
+            __atomic_store_n(&this->numZeroed, this->numZeroed + stored, __ATOMIC_RELAXED);
+        }
+
+        added += stored;
+
+        if(stored < static_cast<size_t>(err)) {
+            this->freeToRegions(err - stored, batch + stored);
+            break;
+        }
+    }
+
+    return added;
+}
+
+/**
+ * @brief Fill the given pages with zeros.
+ *
+ * @param num Number of pages
+ * @param addrs Physical addresses of the pages
+ */
+void Pool::zeroPages(const size_t num, const uintptr_t *addrs) {
+    int err;
+    const auto pageSz = this->allocator->getPageSize();
+
+    for(size_t i = 0; i < num; i++) {
+        void *ptr{nullptr};
+        err = Platform::Memory::PhysicalMap::Add(addrs[i], pageSz, &ptr);
+        REQUIRE(!err, "failed to map page %016zx for zeroing: %d", addrs[i], err);
+
+        memset(ptr, 0, pageSz);
+
+        Platform::Memory::PhysicalMap::Remove(ptr, pageSz);
+    }
+}
+
+/**
+ * @brief Test whether a physical page belongs to one of this pool's regions.
+ *
+ * @param address Physical address of the page to test
+ *
+ * @return Whether the page may be allocated from (or freed to) this pool
+ */
+bool Pool::contains(const uintptr_t address) const {
+    size_t index;
+    return !!this->findRegion(address, index);
+}
+
+/**
+ * @brief Find the region that a physical page belongs to.
+ *
+ * This is a binary search over the regions, sorted by their base address.
+ *
+ * @param address Physical address of the page
+ * @param outIndex Variable to receive the index of the region (into the region table)
+ *
+ * @return Region containing the page, or `nullptr` if no region contains it
+ */
+Pool::RegionType *Pool::findRegion(const uintptr_t address, size_t &outIndex) const {
+    const auto table = this->getRegionTable();
+    size_t low{0}, high{table->numRegions};
+
+    // find the last region whose base is at or below the address
+    while(low < high) {
+        const auto mid = (low + high) / 2;
+        if(table->regions[table->sorted[mid]]->getAllocBase() <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if(!low) return nullptr;
+
+    const auto index = table->sorted[low - 1];
+    auto region = table->regions[index];
+    if(!region->contains(address)) return nullptr;
+
+    outIndex = index;
+    return region;
+}
+
 /**
  * @brief Get the total number of physical pages available across all regions.
  *
@@ -145,11 +1063,11 @@ int Pool::free(const size_t num, const uintptr_t *inAddrs) {
  */
 size_t Pool::getTotalPages() const {
     size_t sum{0};
-    for(size_t i = 0; i < kMaxRegions; i++) {
-        auto region = this->regions[i];
-        if(!region) break;
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
 
-        sum += region->bitmapSize;
+        sum += region->getTotalPages();
     }
     return sum;
 }
@@ -161,11 +1079,161 @@ size_t Pool::getTotalPages() const {
  */
 size_t Pool::getAllocatedPages() const {
     size_t sum{0};
-    for(size_t i = 0; i < kMaxRegions; i++) {
-        auto region = this->regions[i];
-        if(!region) break;
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        sum += region->getAllocatedPages();
+    }
+    return sum;
+}
+
+/**
+ * @brief Get the size of the largest physically contiguous block of free pages.
+ *
+ * @remark With the bitmap engine, this needs to scan the bitmaps of all regions.
+ *
+ * @return Number of pages in the largest free block in any of the pool's regions
+ */
+size_t Pool::getLargestFreeRun() const {
+    size_t largest{0};
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        const auto run = region->getLargestFreeRun();
+        if(run > largest) largest = run;
+    }
+    return largest;
+}
+
+/**
+ * @brief Get the search statistics of all regions.
+ *
+ * Dividing the number of words by the number of allocations gives the average number of bitmap
+ * words that had to be examined per allocation.
+ *
+ * @param outAllocs Variable to receive the number of allocations made from regions
+ * @param outWords Variable to receive the number of words examined by those allocations
+ */
+void Pool::getScanStats(size_t &outAllocs, size_t &outWords) const {
+    outAllocs = outWords = 0;
+
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        size_t allocs, words;
+        region->getScanStats(allocs, words);
+
+        outAllocs += allocs;
+        outWords += words;
+    }
+}
+
+/**
+ * @brief Write the pool's statistics to the console.
+ *
+ * This includes the allocation counters and latency histograms, the watermarks and how often they
+ * were hit, the bitmap search statistics, and a histogram of free runs for each region.
+ * Histograms are printed as `bucket:count` pairs, where bucket `n` covers values from `2^n` up to
+ * `2^(n+1) - 1`.
+ *
+ * @remark Building the free run histograms requires scanning all regions.
+ *
+ * @param index Index of the pool, used to label the output
+ */
+void Pool::dumpStats(const size_t index) const {
+    size_t scanAllocs, scanWords;
+    this->getScanStats(scanAllocs, scanWords);
+
+    Console::Notice("Pool %zu: %zu/%zu pages allocated, %zu zeroed, %zu dirty", index,
+            this->getAllocatedPages(), this->getTotalPages(), this->getNumZeroed(),
+            this->getNumDirty());
+    Console::Notice("  alloc: %zu calls (%zu partial, %zu failed), free: %zu calls",
+            __atomic_load_n(&this->stats.allocs, __ATOMIC_RELAXED),
+            __atomic_load_n(&this->stats.partialAllocs, __ATOMIC_RELAXED),
+            __atomic_load_n(&this->stats.failedAllocs, __ATOMIC_RELAXED),
+            __atomic_load_n(&this->stats.frees, __ATOMIC_RELAXED));
+    Console::Notice("  free: %zu pages, watermarks %zu/%zu/%zu (hit %zu/%zu/%zu times), "
+            "pressure %u", this->getFreePages(), this->watermarks.min, this->watermarks.low,
+            this->watermarks.high, __atomic_load_n(&this->stats.minHits, __ATOMIC_RELAXED),
+            __atomic_load_n(&this->stats.lowHits, __ATOMIC_RELAXED),
+            __atomic_load_n(&this->stats.highHits, __ATOMIC_RELAXED), this->getPressure());
+    Console::Notice("  scan: %zu words in %zu region allocs (%zu.%02zu words/alloc)",
+            scanWords, scanAllocs, scanAllocs ? (scanWords / scanAllocs) : 0,
+            scanAllocs ? (((scanWords % scanAllocs) * 100) / scanAllocs) : 0);
+
+    PrintHistogram("  alloc latency (log2 ticks):", this->stats.allocLatency);
+    PrintHistogram("  free latency (log2 ticks):", this->stats.freeLatency);
+
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        size_t largest, runs[kHistogramBuckets];
+        if(!region->getFreeRuns(largest, runs, kHistogramBuckets)) {
+            Console::Notice("  region %zu (%016zx): busy", i, region->getAllocBase());
+            continue;
+        }
+
+        Console::Notice("  region %zu (%016zx): %zu/%zu pages allocated, largest free "
+                "run %zu pages", i, region->getAllocBase(), region->getAllocatedPages(),
+                region->getTotalPages(), largest);
+        PrintHistogram("    free runs (log2 pages):", runs);
+    }
+}
+
+/**
+ * @brief Get the total number of large frames of the given size across all regions.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ *
+ * @return Number of naturally aligned frames of this size in the pool
+ */
+size_t Pool::getTotalLargePages(const size_t sizeIdx) const {
+    size_t sum{0};
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        sum += region->getTotalLargePages(sizeIdx);
+    }
+    return sum;
+}
+
+/**
+ * @brief Get the number of entirely free large frames of the given size.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ *
+ * @return Number of frames of this size that can currently be allocated
+ */
+size_t Pool::getFreeLargePages(const size_t sizeIdx) const {
+    size_t sum{0};
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
+
+        sum += region->getFreeLargePages(sizeIdx);
+    }
+    return sum;
+}
+
+/**
+ * @brief Get the number of large frames of the given size that are allocated as large pages.
+ *
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ *
+ * @return Number of allocated large pages of this size
+ */
+size_t Pool::getAllocatedLargePages(const size_t sizeIdx) const {
+    size_t sum{0};
+    const auto table = this->getRegionTable();
+    for(size_t i = 0; i < table->numRegions; i++) {
+        auto region = table->regions[i];
 
-        sum += region->numAllocated;
+        sum += region->getAllocatedLargePages(sizeIdx);
     }
     return sum;
 }
@@ -14,18 +14,37 @@
 using namespace Kernel::Memory;
 
 // space in .bss segment for VM objects
-static KUSH_ALIGNED(64) uint8_t gVmObjectAllocBuf[Pool::kMaxGlobalRegions][sizeof(Kernel::Vm::ContiguousPhysRegion)];
+static KUSH_ALIGNED(64) uint8_t gVmObjectAllocBuf[Pool::kStaticRegions][sizeof(Kernel::Vm::ContiguousPhysRegion)];
 // index for the next available VM object
 static size_t gVmObjectAllocNextFree{0};
 
+/**
+ * @brief Get the bitmap word mask for a run of pages
+ *
+ * Builds the mask of bits covering the pages from `page` up to (but not including) `end` that
+ * fall into the same bitmap word as `page`.
+ *
+ * @param page Index of the first page in the run
+ * @param end Index of the page past the end of the run
+ * @param outBits Variable to receive the number of pages covered by the mask
+ */
+static inline uint64_t RunMask(const size_t page, const size_t end, size_t &outBits) {
+    const auto bit = page % 64;
+    const auto bits = ((end - page) < (64 - bit)) ? (end - page) : (64 - bit);
+
+    outBits = bits;
+    return ((bits == 64) ? ~0ULL : ((1ULL << bits) - 1)) << bit;
+}
+
 /**
  * @brief Initialize a new region of physical memory.
  *
  * This sets up the associated bitmap: all pages are initially marked as available, except for
- * those used to actually store the bitmap itself.
+ * those used to actually store the bitmap itself. The summary bitmap is placed directly after the
+ * page bitmap, in the same reserved pages, followed by the tables for each large page size.
  *
  * We'll also allocate a VM object to represent the bitmap in the kernel's address space. This is
- * not yet mapped; a later call to 
+ * not yet mapped; a later call to applyVirtualMap() will do that.
  *
  * @param pool The allocation pool this region belongs to
  * @param base Physical base address of this region
@@ -42,9 +61,19 @@ Region::Region(Pool *pool, const uintptr_t base, const size_t length) :
     const auto pageSz = pool->allocator->getPageSize();
     this->numPages = length / pageSz;
 
-    // calculate bitmap location and size
-    const auto bitmapBytes = (this->numPages + (8 - 1)) / 8;
-    const auto bitmapPages = (bitmapBytes + (pageSz - 1)) / pageSz;
+    // calculate bitmap location and size (for the worst case of all pages being allocatable)
+    this->bitmapWords = (this->numPages + (64 - 1)) / 64;
+    this->summaryWords = (this->bitmapWords + (64 - 1)) / 64;
+
+    // reserve space for large frame tracking (again, assuming the worst case)
+    auto allocator = pool->allocator;
+    this->numLargeSizes = allocator->getNumExtraPageSizes();
+
+    const auto metadataBytes = LayoutMetadata(allocator, this->numPages, this->large);
+
+    const auto bitmapPages = (metadataBytes + (pageSz - 1)) / pageSz;
+    REQUIRE(bitmapPages < this->numPages, "region too small (%zu pages)", this->numPages);
+
     const auto allocatablePages = this->numPages - bitmapPages;
 
     this->bitmapPhys = base;
@@ -52,23 +81,133 @@ Region::Region(Pool *pool, const uintptr_t base, const size_t length) :
     this->bitmapReserved = (bitmapPages * pageSz);
 
     this->allocBasePhys = base + this->bitmapReserved;
+    this->allocEndPhys = this->allocBasePhys + (allocatablePages * pageSz);
+
+    // figure out which naturally aligned large frames fit into the allocatable range
+    const size_t pfnBase = this->allocBasePhys / pageSz;
+    const size_t pfnEnd = pfnBase + allocatablePages;
+
+    for(size_t i = 0; i < this->numLargeSizes; i++) {
+        auto &info = this->large[i];
+        const size_t frameMask = (1ULL << info.pageSizeLog2) - 1;
+
+        const auto first = (pfnBase + frameMask) & ~frameMask;
+        const auto last = pfnEnd & ~frameMask;
+
+        info.firstPage = first - pfnBase;
+        info.numFrames = (last > first) ? ((last - first) >> info.pageSizeLog2) : 0;
+    }
 
     // initialize bitmap
     void *addr{nullptr};
     err = Platform::Memory::PhysicalMap::Add(this->bitmapPhys, this->bitmapReserved, &addr);
     REQUIRE(!err, "failed to map region bitmap: %d", err);
 
-    this->bitmap = reinterpret_cast<uint64_t *>(addr);
+    this->setMetadataBase(addr);
+
+    memset(this->bitmap, 0, metadataBytes);
+
+    const auto fullWords = allocatablePages / 64;
+    memset(this->bitmap, 0xFF, fullWords * sizeof(uint64_t));
+    if(allocatablePages % 64) {
+        this->bitmap[fullWords] = (1ULL << (allocatablePages % 64)) - 1;
+    }
+
+    const auto usedWords = (allocatablePages + (64 - 1)) / 64;
+    memset(this->summary, 0xFF, (usedWords / 64) * sizeof(uint64_t));
+    if(usedWords % 64) {
+        this->summary[usedWords / 64] = (1ULL << (usedWords % 64)) - 1;
+    }
 
-    memset(this->bitmap, 0xFF, bitmapBytes);
+    // all large frames start out entirely free
+    for(size_t i = 0; i < this->numLargeSizes; i++) {
+        auto &info = this->large[i];
+
+        for(size_t frame = 0; frame < info.numFrames; frame++) {
+            info.freePages[frame] = (1U << info.pageSizeLog2);
+        }
+
+        memset(info.freeMap, 0xFF, (info.numFrames / 64) * sizeof(uint64_t));
+        if(info.numFrames % 64) {
+            info.freeMap[info.numFrames / 64] = (1ULL << (info.numFrames % 64)) - 1;
+        }
+
+        info.numFree = info.numFrames;
+    }
+
+    /*
+     * Allocate the VM object: the static buffer has room for the VM objects of all statically
+     * allocated regions; any further regions get theirs from the pool, the same way as the
+     * region itself.
+     */
+    void *vmRegionPtr;
+    if(gVmObjectAllocNextFree < Pool::kStaticRegions) {
+        vmRegionPtr = gVmObjectAllocBuf[gVmObjectAllocNextFree++];
+    } else {
+        vmRegionPtr = Pool::AllocStorage(sizeof(Vm::ContiguousPhysRegion));
+    }
 
-    // allocate the VM object (TODO: check if alternate allocator is available)
-    const auto idx = gVmObjectAllocNextFree++;
-    auto vmRegionPtr = reinterpret_cast<Vm::ContiguousPhysRegion *>(gVmObjectAllocBuf[idx]);
     this->bitmapVm = new (vmRegionPtr) Vm::ContiguousPhysRegion(this->bitmapPhys,
             this->bitmapReserved, Vm::Mode::KernelRW);
 }
 
+/**
+ * @brief Determine how much memory at the start of a region is reserved for its metadata.
+ *
+ * @param allocator Physical allocator the region would belong to
+ * @param length Length of the region, in bytes
+ *
+ * @return Number of bytes (a multiple of the page size) used for the region's bitmaps
+ */
+size_t Region::GetMetadataSize(const PhysicalAllocator *allocator, const size_t length) {
+    const auto pageSz = allocator->getPageSize();
+    const auto bytes = LayoutMetadata(allocator, length / pageSz, nullptr);
+
+    return (bytes + (pageSz - 1)) & ~(pageSz - 1);
+}
+
+/**
+ * @brief Lay out a region's metadata area.
+ *
+ * The page bitmap comes first, followed by the summary bitmap and then the free page counts and
+ * free frame bitmap for each of the allocator's extra page sizes.
+ *
+ * @param allocator Physical allocator the region belongs to
+ * @param numPages Total number of pages in the region (including the metadata pages)
+ * @param large If not `nullptr`, large frame bookkeeping to receive the page size and offsets of
+ *        the tables for each extra page size
+ *
+ * @return Number of bytes required for the metadata
+ */
+size_t Region::LayoutMetadata(const PhysicalAllocator *allocator, const size_t numPages,
+        LargeFrames *large) {
+    const size_t bitmapWords = (numPages + (64 - 1)) / 64;
+    const size_t summaryWords = (bitmapWords + (64 - 1)) / 64;
+
+    size_t metadataBytes = (bitmapWords + summaryWords) * sizeof(uint64_t);
+
+    for(size_t i = 0; i < allocator->getNumExtraPageSizes(); i++) {
+        const auto pageSizeLog2 = allocator->getExtraPageSizeLog2(i);
+        REQUIRE(pageSizeLog2 && pageSizeLog2 < 32, "invalid large page size %u", pageSizeLog2);
+
+        const auto maxFrames = (numPages >> pageSizeLog2) + 1;
+
+        if(large) {
+            large[i].pageSizeLog2 = pageSizeLog2;
+            large[i].countsOffset = metadataBytes;
+        }
+        metadataBytes += ((maxFrames * sizeof(uint32_t)) + (sizeof(uint64_t) - 1)) &
+            ~(sizeof(uint64_t) - 1);
+
+        if(large) {
+            large[i].mapOffset = metadataBytes;
+        }
+        metadataBytes += ((maxFrames + (64 - 1)) / 64) * sizeof(uint64_t);
+    }
+
+    return metadataBytes;
+}
+
 /**
  * @brief Clean up the region.
  *
@@ -84,6 +223,10 @@ Region::~Region() {
 /**
  * @brief Attempt to allocate pages from this region.
  *
+ * The search for free pages starts at the calling processor's offset into the bitmap (but never
+ * below the free hint) and wraps around to the free hint if needed. A search that started at the
+ * free hint moves it up past the words it filled.
+ *
  * @param pool Pool in which this region sits
  * @param numPages Number of pages to attempt to allocate
  * @param outAddrs Buffer to receive allocated physical addresses
@@ -93,55 +236,37 @@ Region::~Region() {
  * @remark This function may return (and in turn, allocate) fewer pages than requested.
  */
 int Region::alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs) {
-    size_t satisfied{0};
-    const auto pageSz = pool->allocator->getPageSize();
-
-    // read the bitmap 64 bits at a time
-    auto readPtr = this->bitmap;
-
-    for(size_t off = 0; off < this->bitmapSize; off += 64) {
-        // read this chunk; skip if zero (all pages allocated)
-        auto val = *readPtr;
-        if(!val) {
-            readPtr++;
-            continue;
-        }
+    size_t scanned{0}, next;
 
-        // calculate the physical base address for this chunk
-        const uintptr_t base = this->allocBasePhys + (off * pageSz);
+    const auto hint = __atomic_load_n(&this->freeHint, __ATOMIC_SEQ_CST);
+    auto start = this->getStartWord();
+    if(start < hint) start = hint;
 
-        // allocate pages until this chunk is full or allocations succeeded
-        do {
-            // mark page as allocated
-            const auto i = __builtin_ffsll(val);
-            REQUIRE(i, "wtf");
-
-            val &= ~(1ULL << (i - 1));
-            *readPtr = val;
-
-            // store its address
-            *outAddrs++ = base + ((i - 1) * pageSz);
-            satisfied++;
-
-            this->numAllocated++;
-        } while(val && satisfied < numPages);
-
-        // if we've satisfied all requested allocations, return
-        if(satisfied == numPages) {
-            return satisfied;
-        }
+    auto satisfied = this->allocFromWords(pool, start, this->bitmapWords, numPages, outAddrs,
+            scanned, next);
 
-        // otherwise, go to the next chunk
-        readPtr++;
+    if(start == hint) {
+        this->advanceFreeHint(hint, next);
+    } else if(satisfied < numPages) {
+        // wrap around to the words between the free hint and our start offset
+        satisfied += this->allocFromWords(pool, hint, start, numPages - satisfied,
+                outAddrs + satisfied, scanned, next);
+        this->advanceFreeHint(hint, next);
     }
 
-    // we were only able to partially satisfy this request
+    __atomic_add_fetch(&this->numAllocated, satisfied, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->scanStats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&this->scanStats.words, scanned, __ATOMIC_RELAXED);
+
     return satisfied;
 }
 
 /**
  * @brief Free the given pages.
  *
+ * Consecutive addresses whose pages are in the same bitmap word are freed together; so it's best
+ * to pass sorted addresses.
+ *
  * @param pool Pool in which this region sits
  * @param numPages Number of pages in the specified buffer
  * @param inAddrs Physical page addresses to free
@@ -152,24 +277,261 @@ int Region::alloc(Pool *pool, const size_t numPages, uintptr_t *outAddrs) {
  */
 int Region::free(Pool *pool, const size_t numPages, const uintptr_t *inAddrs) {
     int freed{0};
+    size_t released{0};
     const auto pageSz = pool->allocator->getPageSize();
 
-    for(size_t i = 0; i < numPages; i++) {
-        const auto addr = *inAddrs++;
-        if(this->contains(addr)) {
-            const auto offset = addr - this->allocBasePhys;
-            const auto page = offset / pageSz;
+    for(size_t i = 0; i < numPages; ) {
+        if(!this->contains(inAddrs[i])) {
+            i++;
+            continue;
+        }
+
+        // collect all following pages in the same bitmap word
+        const auto word = ((inAddrs[i] - this->allocBasePhys) / pageSz) / 64;
+        uint64_t mask{0};
 
-            this->bitmap[page / 64] |= (1ULL << (page % 64));
+        for(; i < numPages && this->contains(inAddrs[i]); i++) {
+            const auto page = (inAddrs[i] - this->allocBasePhys) / pageSz;
+            if(page / 64 != word) break;
 
+            mask |= (1ULL << (page % 64));
             freed++;
-            this->numAllocated--;
         }
+
+        const auto old = __atomic_fetch_or(&this->bitmap[word], mask, __ATOMIC_ACQ_REL);
+        __atomic_fetch_or(&this->summary[word / 64], (1ULL << (word % 64)), __ATOMIC_SEQ_CST);
+        this->lowerFreeHint(word);
+
+        // pages that were already free don't affect the counters
+        const auto changed = ~old & mask;
+        if(this->numLargeSizes && changed) {
+            this->updateLargeFrames(word, changed, true);
+        }
+        released += __builtin_popcountll(changed);
     }
 
+    __atomic_sub_fetch(&this->numAllocated, released, __ATOMIC_RELAXED);
     return freed;
 }
 
+/**
+ * @brief Allocate a physically contiguous, aligned run of pages.
+ *
+ * The bitmap is searched a word at a time: we find the first free page at or after the current
+ * candidate, round it up to the requested alignment, then check whether the run of pages from
+ * there is entirely free. If not, the search resumes after the first allocated page in the run.
+ * Since other processors may be allocating at the same time, claiming a run that appeared free
+ * can still fail, in which case the search continues at the next aligned page.
+ *
+ * @param pool Pool in which this region sits
+ * @param numPages Number of contiguous pages to allocate
+ * @param alignLog2 Required alignment of the physical base address, as a power of two multiple
+ *        of the page size (so `0` is page aligned)
+ * @param outBase Variable to receive the physical address of the first page
+ *
+ * @return Number of allocated pages (either 0 or `numPages`) or a negative error code.
+ */
+int Region::allocContiguous(Pool *pool, const size_t numPages, const size_t alignLog2,
+        uintptr_t &outBase) {
+    const auto pageSz = pool->allocator->getPageSize();
+    const size_t align = 1ULL << alignLog2;
+
+    if(!numPages || numPages > this->getTotalPages() - this->getAllocatedPages()) return 0;
+
+    // alignment is relative to physical addresses, not to the start of the bitmap
+    const size_t pfnBase = this->allocBasePhys / pageSz;
+    const auto alignUp = [&](const size_t page) -> size_t {
+        return (((pfnBase + page + (align - 1)) & ~(align - 1)) - pfnBase);
+    };
+
+    size_t candidate{0};
+    while(candidate < this->bitmapSize) {
+        // find the next free page, then align it
+        auto start = this->findFreePage(candidate);
+        if(start == this->bitmapSize) break;
+
+        start = alignUp(start);
+        if(start + numPages > this->bitmapSize || start + numPages < start) break;
+
+        // is the entire run free?
+        const auto allocated = this->findAllocatedPage(start, start + numPages);
+        if(allocated == (start + numPages)) {
+            if(this->claimRun(start, numPages)) {
+                outBase = this->allocBasePhys + (start * pageSz);
+                return numPages;
+            }
+
+            candidate = start + 1;
+            continue;
+        }
+
+        candidate = allocated + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free a physically contiguous run of pages.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page
+ * @param numPages Number of pages to free
+ *
+ * @return Number of freed pages, or a negative error code if the run isn't inside this region.
+ */
+int Region::freeContiguous(Pool *pool, const uintptr_t base, const size_t numPages) {
+    const auto pageSz = pool->allocator->getPageSize();
+
+    if(!numPages || !this->contains(base) ||
+            !this->contains(base + ((numPages - 1) * pageSz))) {
+        // TODO: standardized error codes
+        return -1;
+    }
+
+    this->markFree((base - this->allocBasePhys) / pageSz, numPages);
+    return numPages;
+}
+
+/**
+ * @brief Allocate an entirely free, naturally aligned large frame.
+ *
+ * Frames are located via the free frame map, but only handed out once all of their pages could
+ * be claimed; if that fails (because the map was out of date) the next free frame is tried.
+ *
+ * @param pool Pool in which this region sits
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param outAddr Variable to receive the physical address of the frame
+ *
+ * @return 1 if a frame was allocated, 0 if this region has no free frames of the given size.
+ */
+int Region::allocLarge(Pool *pool, const size_t sizeIdx, uintptr_t &outAddr) {
+    const auto pageSz = pool->allocator->getPageSize();
+
+    REQUIRE(sizeIdx < this->numLargeSizes, "invalid large page size index %zu", sizeIdx);
+    auto &info = this->large[sizeIdx];
+    if(!this->getFreeLargePages(sizeIdx)) return 0;
+
+    for(size_t i = 0; i < (info.numFrames + (64 - 1)) / 64; i++) {
+        auto val = __atomic_load_n(&info.freeMap[i], __ATOMIC_ACQUIRE);
+
+        while(val) {
+            const auto bit = __builtin_ctzll(val);
+            val &= ~(1ULL << bit);
+
+            const auto frame = (i * 64) + bit;
+            const auto start = info.firstPage + (frame << info.pageSizeLog2);
+
+            if(!this->claimRun(start, (1ULL << info.pageSizeLog2))) continue;
+            __atomic_add_fetch(&info.numAllocated, 1, __ATOMIC_RELAXED);
+
+            outAddr = this->allocBasePhys + (start * pageSz);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Free a large frame previously allocated with allocLarge().
+ *
+ * @param pool Pool in which this region sits
+ * @param sizeIdx Index of the large page size (into the allocator's extra page sizes)
+ * @param addr Physical address of the frame
+ *
+ * @return 1 if the frame was freed, or a negative error code if it isn't a valid frame in this
+ *         region.
+ */
+int Region::freeLarge(Pool *pool, const size_t sizeIdx, const uintptr_t addr) {
+    const auto pageSz = pool->allocator->getPageSize();
+
+    REQUIRE(sizeIdx < this->numLargeSizes, "invalid large page size index %zu", sizeIdx);
+    auto &info = this->large[sizeIdx];
+
+    // TODO: standardized error codes
+    if(!this->contains(addr)) return -1;
+
+    const auto page = (addr - this->allocBasePhys) / pageSz;
+    if(page < info.firstPage) return -1;
+
+    const auto offset = page - info.firstPage;
+    if((offset & ((1ULL << info.pageSizeLog2) - 1)) ||
+            (offset >> info.pageSizeLog2) >= info.numFrames) {
+        return -1;
+    }
+
+    REQUIRE(this->getAllocatedLargePages(sizeIdx),
+            "region %p has no allocated large frames (size %zu)", this, sizeIdx);
+
+    this->markFree(page, (1ULL << info.pageSizeLog2));
+    __atomic_sub_fetch(&info.numAllocated, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+/**
+ * @brief Permanently mark a range of pages as allocated.
+ *
+ * This is used for holes in regions that span several ranges of usable memory: the pages in the
+ * holes don't exist, so they must never be handed out. Reserved pages are counted neither as
+ * allocatable nor as allocated pages.
+ *
+ * @remark This may only be called before any pages are allocated from the region.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page to reserve
+ * @param length Length of the range, in bytes; any part of it outside the region is ignored
+ *
+ * @return Number of pages reserved
+ */
+size_t Region::reserve(Pool *pool, const uintptr_t base, const size_t length) {
+    const auto pageSz = pool->allocator->getPageSize();
+
+    const auto start = (base > this->allocBasePhys) ? base : this->allocBasePhys;
+    const auto end = ((base + length) < this->allocEndPhys) ? (base + length) : this->allocEndPhys;
+    if(start >= end) return 0;
+
+    const auto first = (start - this->allocBasePhys) / pageSz;
+    const auto count = (end - start) / pageSz;
+
+    REQUIRE(this->claimRun(first, count), "failed to reserve region %p pages %zu - %zu", this,
+            first, first + count);
+    __atomic_add_fetch(&this->numReserved, count, __ATOMIC_RELAXED);
+
+    return count;
+}
+
+/**
+ * @brief Make previously reserved pages available for allocation.
+ *
+ * This is used when memory in a hole becomes usable later on, such as memory reclaimed from the
+ * bootloader.
+ *
+ * @param pool Pool in which this region sits
+ * @param base Physical address of the first page
+ * @param length Length of the range, in bytes; any part of it outside the region is ignored. All
+ *        pages inside the region must have been reserved with reserve().
+ *
+ * @return Number of pages made available
+ */
+size_t Region::unreserve(Pool *pool, const uintptr_t base, const size_t length) {
+    const auto pageSz = pool->allocator->getPageSize();
+
+    const auto start = (base > this->allocBasePhys) ? base : this->allocBasePhys;
+    const auto end = ((base + length) < this->allocEndPhys) ? (base + length) : this->allocEndPhys;
+    if(start >= end) return 0;
+
+    const auto first = (start - this->allocBasePhys) / pageSz;
+    const auto count = (end - start) / pageSz;
+
+    // count the pages as allocated until they're actually free
+    __atomic_sub_fetch(&this->numReserved, count, __ATOMIC_RELAXED);
+    this->markFree(first, count);
+
+    return count;
+}
+
 /**
  * @brief Map the bitmap into virtual address space.
  *
@@ -185,7 +547,549 @@ size_t Region::applyVirtualMap(uintptr_t base, Vm::Map *map) {
     REQUIRE(!err, "failed to map region bitmap: %d", err);
 
     // update pointers
-    this->bitmap = reinterpret_cast<uint64_t *>(base);
+    this->setMetadataBase(reinterpret_cast<void *>(base));
 
     return this->bitmapReserved;
 }
+
+/**
+ * @brief Determine the length of the longest run of free pages in the region.
+ *
+ * @remark This scans the entire bitmap, so it's rather slow on large regions. If pages are
+ *         allocated or freed concurrently, the result is only approximate.
+ *
+ * @return Number of pages in the longest run of free pages
+ */
+size_t Region::getLargestFreeRun() const {
+    size_t largest{0};
+
+    auto page = this->findFreePage(0);
+    while(page < this->bitmapSize) {
+        const auto end = this->findAllocatedPage(page, this->bitmapSize);
+        if(end - page > largest) largest = end - page;
+
+        page = this->findFreePage(end);
+    }
+
+    return largest;
+}
+
+/**
+ * @brief Build a histogram of the runs of free pages in the region.
+ *
+ * Runs are counted in the bucket corresponding to the power of two at or below their length;
+ * that is, bucket `n` counts the runs of `2^n` up to `2^(n+1) - 1` pages. Runs that are too long
+ * for the histogram are counted in the last bucket.
+ *
+ * @remark This scans the entire bitmap; see getLargestFreeRun(). The region is not locked, so
+ *         the histogram is only a snapshot, and may be slightly off if pages are allocated or
+ *         freed concurrently.
+ *
+ * @param outLargest Variable to receive the length of the longest free run, in pages
+ * @param outCounts Histogram to receive the number of free runs of each size
+ * @param numBuckets Number of entries in the histogram
+ *
+ * @return Whether the histogram could be built
+ */
+bool Region::getFreeRuns(size_t &outLargest, size_t *outCounts, const size_t numBuckets) const {
+    outLargest = 0;
+    for(size_t i = 0; i < numBuckets; i++) outCounts[i] = 0;
+
+    auto page = this->findFreePage(0);
+    while(page < this->bitmapSize) {
+        const auto end = this->findAllocatedPage(page, this->bitmapSize);
+        const size_t run = end - page;
+
+        // the bitmap isn't locked, so the page may have been allocated since it was found
+        if(!run) {
+            page = this->findFreePage(end + 1);
+            continue;
+        }
+
+        if(run > outLargest) outLargest = run;
+
+        size_t bucket = 63 - __builtin_clzll(run);
+        if(bucket >= numBuckets) bucket = numBuckets - 1;
+        outCounts[bucket]++;
+
+        page = this->findFreePage(end);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Update the pointers to the region's metadata structures.
+ *
+ * @param base Virtual address at which the region's metadata pages are accessible
+ */
+void Region::setMetadataBase(void *base) {
+    this->bitmap = reinterpret_cast<uint64_t *>(base);
+    this->summary = this->bitmap + this->bitmapWords;
+
+    auto bytes = reinterpret_cast<uint8_t *>(base);
+    for(size_t i = 0; i < this->numLargeSizes; i++) {
+        auto &info = this->large[i];
+        info.freePages = reinterpret_cast<uint32_t *>(bytes + info.countsOffset);
+        info.freeMap = reinterpret_cast<uint64_t *>(bytes + info.mapOffset);
+    }
+}
+
+/**
+ * @brief Get the bitmap word at which the calling processor starts searching for free pages.
+ *
+ * The offsets are spread out over the bitmap by reversing the bits of the processor's index, so
+ * that any number of processors end up roughly evenly spaced: the first processor starts at the
+ * beginning of the region, the second halfway into it, the third and fourth at one and three
+ * quarters, and so on.
+ */
+size_t Region::getStartWord() const {
+    auto cpu = PhysicalAllocator::GetCpuId();
+    size_t reversed{0};
+
+    for(size_t i = 0; i < 8; i++) {
+        reversed = (reversed << 1) | (cpu & 1);
+        cpu >>= 1;
+    }
+
+    return (reversed * this->bitmapWords) >> 8;
+}
+
+/**
+ * @brief Allocate pages from a range of bitmap words.
+ *
+ * Words with free pages are located via the summary bitmap, in ascending order.
+ *
+ * @param pool Pool in which this region sits
+ * @param first Index of the first bitmap word to consider
+ * @param last Index of the bitmap word past the last one to consider
+ * @param numPages Number of pages to allocate
+ * @param outAddrs Buffer to receive the allocated physical addresses
+ * @param scanned Incremented by the number of summary and bitmap words examined
+ * @param outNext Variable to receive the index of the first word in the range that may still have
+ *        free pages (or `last`, if all of them were used up)
+ *
+ * @return Number of allocated pages
+ */
+size_t Region::allocFromWords(Pool *pool, const size_t first, const size_t last,
+        const size_t numPages, uintptr_t *outAddrs, size_t &scanned, size_t &outNext) {
+    size_t satisfied{0};
+    const auto pageSz = pool->allocator->getPageSize();
+
+    for(size_t word = first; word < last; ) {
+        const auto summaryIdx = word / 64;
+        auto summaryVal = __atomic_load_n(&this->summary[summaryIdx], __ATOMIC_ACQUIRE) &
+            (~0ULL << (word % 64));
+        if(summaryIdx == last / 64) {
+            summaryVal &= (1ULL << (last % 64)) - 1;
+        }
+        scanned++;
+
+        while(summaryVal) {
+            const auto summaryBit = __builtin_ctzll(summaryVal);
+            summaryVal &= ~(1ULL << summaryBit);
+
+            const auto freeWord = (summaryIdx * 64) + summaryBit;
+            scanned++;
+
+            uint64_t taken;
+            if(!this->claimFromWord(freeWord, numPages - satisfied, taken)) continue;
+
+            // calculate the physical base address for this chunk
+            const uintptr_t base = this->allocBasePhys + ((freeWord * 64) * pageSz);
+
+            while(taken) {
+                const auto bit = __builtin_ctzll(taken);
+                taken &= ~(1ULL << bit);
+
+                *outAddrs++ = base + (bit * pageSz);
+                satisfied++;
+            }
+
+            if(satisfied == numPages) {
+                const auto remaining = __atomic_load_n(&this->bitmap[freeWord], __ATOMIC_RELAXED);
+                outNext = remaining ? freeWord : (freeWord + 1);
+                return satisfied;
+            }
+        }
+
+        word = (summaryIdx + 1) * 64;
+    }
+
+    outNext = last;
+    return satisfied;
+}
+
+/**
+ * @brief Move the free hint up after a search that started at it.
+ *
+ * If pages below the new hint were freed while searching, the hint is lowered again; so the hint
+ * never ends up above a free page.
+ *
+ * @param from Value of the free hint at which the search started
+ * @param to Index of the first word that may still contain free pages
+ */
+void Region::advanceFreeHint(size_t from, const size_t to) {
+    const auto oldHint = from;
+    if(to <= from) return;
+
+    // someone else moved the hint in the meantime
+    if(!__atomic_compare_exchange_n(&this->freeHint, &from, to, false, __ATOMIC_SEQ_CST,
+                __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    for(size_t word = oldHint; word < to; ) {
+        const auto summaryIdx = word / 64;
+        auto summaryVal = __atomic_load_n(&this->summary[summaryIdx], __ATOMIC_SEQ_CST) &
+            (~0ULL << (word % 64));
+        if(summaryIdx == to / 64) {
+            summaryVal &= (1ULL << (to % 64)) - 1;
+        }
+
+        if(summaryVal) {
+            this->lowerFreeHint((summaryIdx * 64) + __builtin_ctzll(summaryVal));
+            return;
+        }
+
+        word = (summaryIdx + 1) * 64;
+    }
+}
+
+/**
+ * @brief Lower the free hint, after pages in the given word were freed.
+ *
+ * @param word Index of the bitmap word that has free pages
+ */
+void Region::lowerFreeHint(const size_t word) {
+    auto hint = __atomic_load_n(&this->freeHint, __ATOMIC_SEQ_CST);
+
+    while(word < hint && !__atomic_compare_exchange_n(&this->freeHint, &hint, word, true,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+}
+
+/**
+ * @brief Claim free pages from a single bitmap word.
+ *
+ * The lowest free pages in the word are atomically marked as allocated. If this leaves the word
+ * without any free pages, its summary bit is cleared.
+ *
+ * @param word Index of the bitmap word
+ * @param max Maximum number of pages to claim
+ * @param outTaken Variable to receive the mask of claimed pages in the word
+ *
+ * @return Number of claimed pages; 0 if the word didn't have any free pages.
+ */
+size_t Region::claimFromWord(const size_t word, const size_t max, uint64_t &outTaken) {
+    uint64_t taken;
+    auto old = __atomic_load_n(&this->bitmap[word], __ATOMIC_RELAXED);
+
+    do {
+        // the summary was out of date: another processor took the last pages
+        if(!old) {
+            this->clearSummaryBit(word);
+            return 0;
+        }
+
+        if(static_cast<size_t>(__builtin_popcountll(old)) <= max) {
+            taken = old;
+        } else {
+            taken = 0;
+            auto val = old;
+
+            for(size_t i = 0; i < max; i++) {
+                const auto lowest = val & (~val + 1);
+                taken |= lowest;
+                val &= ~lowest;
+            }
+        }
+    } while(!__atomic_compare_exchange_n(&this->bitmap[word], &old, old & ~taken, true,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if(old == taken) {
+        this->clearSummaryBit(word);
+    }
+    if(this->numLargeSizes) {
+        this->updateLargeFrames(word, taken, false);
+    }
+
+    outTaken = taken;
+    return __builtin_popcountll(taken);
+}
+
+/**
+ * @brief Clear the summary bit of a bitmap word that has no free pages.
+ *
+ * If a page in the word is freed concurrently, the bit is set again, so that free pages are never
+ * hidden from the summary.
+ *
+ * @param word Index of the bitmap word
+ */
+void Region::clearSummaryBit(const size_t word) {
+    const auto bit = (1ULL << (word % 64));
+    auto summaryWord = &this->summary[word / 64];
+
+    __atomic_fetch_and(summaryWord, ~bit, __ATOMIC_ACQ_REL);
+    if(__atomic_load_n(&this->bitmap[word], __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_or(summaryWord, bit, __ATOMIC_ACQ_REL);
+    }
+}
+
+/**
+ * @brief Find the first free page at or after the given page.
+ *
+ * Words without any free pages are skipped by consulting the summary bitmap.
+ *
+ * @param start Index of the page at which to begin the search
+ *
+ * @return Index of the first free page, or `bitmapSize` if there are none.
+ */
+size_t Region::findFreePage(const size_t start) const {
+    if(start >= this->bitmapSize) return this->bitmapSize;
+
+    // check the remainder of the word containing the start page
+    auto word = start / 64;
+    const auto val = __atomic_load_n(&this->bitmap[word], __ATOMIC_RELAXED) &
+        (~0ULL << (start % 64));
+    if(val) {
+        return (word * 64) + __builtin_ctzll(val);
+    }
+
+    // then use the summary to find the next word with free pages
+    word++;
+
+    while(word < this->bitmapWords) {
+        const auto summaryIdx = word / 64;
+        const auto summaryVal = __atomic_load_n(&this->summary[summaryIdx], __ATOMIC_ACQUIRE) &
+            (~0ULL << (word % 64));
+        if(!summaryVal) {
+            word = (summaryIdx + 1) * 64;
+            continue;
+        }
+
+        const auto freeWord = (summaryIdx * 64) + __builtin_ctzll(summaryVal);
+        const auto freeVal = __atomic_load_n(&this->bitmap[freeWord], __ATOMIC_RELAXED);
+        if(freeVal) {
+            return (freeWord * 64) + __builtin_ctzll(freeVal);
+        }
+
+        // the word was allocated since its summary bit was read
+        word = freeWord + 1;
+    }
+
+    return this->bitmapSize;
+}
+
+/**
+ * @brief Find the first allocated page in the given range.
+ *
+ * @param start Index of the first page to check
+ * @param end Index of the page past the last one to check
+ *
+ * @return Index of the first allocated page, or `end` if all pages in the range are free.
+ */
+size_t Region::findAllocatedPage(const size_t start, const size_t end) const {
+    for(size_t page = start; page < end; ) {
+        size_t bits;
+        const auto word = page / 64;
+        const auto mask = RunMask(page, end, bits);
+
+        const auto allocated = ~__atomic_load_n(&this->bitmap[word], __ATOMIC_RELAXED) & mask;
+        if(allocated) {
+            return (word * 64) + __builtin_ctzll(allocated);
+        }
+
+        page += bits;
+    }
+
+    return end;
+}
+
+/**
+ * @brief Claim a run of free pages.
+ *
+ * The pages are marked as allocated one bitmap word at a time. If any of them turn out to have
+ * been allocated already (by another processor), the pages claimed so far are given back.
+ *
+ * @param start Index of the first page
+ * @param count Number of pages
+ *
+ * @return Whether all pages in the run were claimed
+ */
+bool Region::claimRun(const size_t start, const size_t count) {
+    const auto end = start + count;
+
+    for(size_t page = start; page < end; ) {
+        size_t bits;
+        const auto word = page / 64;
+        const auto mask = RunMask(page, end, bits);
+
+        auto old = __atomic_load_n(&this->bitmap[word], __ATOMIC_RELAXED);
+        do {
+            if((old & mask) != mask) {
+                for(size_t undo = start; undo < page; ) {
+                    size_t undoBits;
+                    const auto undoWord = undo / 64;
+                    const auto undoMask = RunMask(undo, page, undoBits);
+
+                    __atomic_fetch_or(&this->bitmap[undoWord], undoMask, __ATOMIC_ACQ_REL);
+                    __atomic_fetch_or(&this->summary[undoWord / 64], (1ULL << (undoWord % 64)),
+                            __ATOMIC_SEQ_CST);
+
+                    undo += undoBits;
+                }
+
+                if(page > start) {
+                    this->lowerFreeHint(start / 64);
+                }
+
+                return false;
+            }
+        } while(!__atomic_compare_exchange_n(&this->bitmap[word], &old, old & ~mask, true,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+        page += bits;
+    }
+
+    // all pages are ours; update the summary and large frames
+    for(size_t page = start; page < end; ) {
+        size_t bits;
+        const auto word = page / 64;
+        const auto mask = RunMask(page, end, bits);
+
+        if(!__atomic_load_n(&this->bitmap[word], __ATOMIC_RELAXED)) {
+            this->clearSummaryBit(word);
+        }
+        if(this->numLargeSizes) {
+            this->updateLargeFrames(word, mask, false);
+        }
+
+        page += bits;
+    }
+
+    __atomic_add_fetch(&this->numAllocated, count, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief Mark a run of pages as free.
+ *
+ * @param start Index of the first page
+ * @param count Number of pages
+ */
+void Region::markFree(const size_t start, const size_t count) {
+    size_t released{0};
+
+    for(size_t page = start; page < start + count; ) {
+        size_t bits;
+        const auto word = page / 64;
+        const auto mask = RunMask(page, start + count, bits);
+
+        const auto old = __atomic_fetch_or(&this->bitmap[word], mask, __ATOMIC_ACQ_REL);
+        __atomic_fetch_or(&this->summary[word / 64], (1ULL << (word % 64)), __ATOMIC_SEQ_CST);
+
+        const auto changed = ~old & mask;
+        if(this->numLargeSizes && changed) {
+            this->updateLargeFrames(word, changed, true);
+        }
+        released += __builtin_popcountll(changed);
+
+        page += bits;
+    }
+
+    this->lowerFreeHint(start / 64);
+    __atomic_sub_fetch(&this->numAllocated, released, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Update the large frame bookkeeping after pages in a bitmap word changed state.
+ *
+ * The free page count of every large frame covering the pages is adjusted; frames that become
+ * entirely free (or stop being so) are updated in the free frame map.
+ *
+ * This is called after the page bitmap has been updated, so the counts may briefly lag behind.
+ *
+ * @param word Index of the bitmap word that changed
+ * @param mask Bits in the word whose state changed
+ * @param freed Whether the pages were freed (`true`) or allocated (`false`)
+ */
+void Region::updateLargeFrames(const size_t word, const uint64_t mask, const bool freed) {
+    const auto wordStart = word * 64;
+
+    for(size_t i = 0; i < this->numLargeSizes; i++) {
+        auto &info = this->large[i];
+        const auto shift = info.pageSizeLog2;
+        const auto framesEnd = info.firstPage + (info.numFrames << shift);
+
+        // ignore pages outside of any frame
+        if(!info.numFrames || wordStart >= framesEnd || wordStart + 64 <= info.firstPage) {
+            continue;
+        }
+
+        auto bits = mask;
+        if(wordStart < info.firstPage) {
+            bits &= (~0ULL << (info.firstPage - wordStart));
+        }
+        if(framesEnd < wordStart + 64) {
+            bits &= (1ULL << (framesEnd - wordStart)) - 1;
+        }
+
+        // a word may straddle the boundary between (small) frames
+        while(bits) {
+            const auto page = wordStart + __builtin_ctzll(bits);
+            const auto frame = (page - info.firstPage) >> shift;
+            const auto frameEnd = info.firstPage + ((frame + 1) << shift);
+
+            auto frameBits = bits;
+            if(frameEnd < wordStart + 64) {
+                frameBits &= (1ULL << (frameEnd - wordStart)) - 1;
+            }
+            bits &= ~frameBits;
+
+            const uint32_t count = __builtin_popcountll(frameBits);
+
+            if(freed) {
+                __atomic_add_fetch(&info.freePages[frame], count, __ATOMIC_ACQ_REL);
+            } else {
+                __atomic_sub_fetch(&info.freePages[frame], count, __ATOMIC_ACQ_REL);
+            }
+
+            this->syncLargeFrame(info, frame);
+        }
+    }
+}
+
+/**
+ * @brief Update a frame's bit in the free frame map to match its free page count.
+ *
+ * Several processors may change the count of the same frame at once. Each of them re-reads the
+ * count after updating the map, and goes again if it changed in the meantime; so whoever finishes
+ * last leaves the map in the correct state.
+ *
+ * @param info Large frame bookkeeping for the frame's page size
+ * @param frame Index of the frame
+ */
+void Region::syncLargeFrame(LargeFrames &info, const size_t frame) {
+    const uint32_t full = (1U << info.pageSizeLog2);
+    const auto mapBit = (1ULL << (frame % 64));
+    auto mapWord = &info.freeMap[frame / 64];
+
+    auto count = __atomic_load_n(&info.freePages[frame], __ATOMIC_ACQUIRE);
+    for(;;) {
+        const bool isSet = __atomic_load_n(mapWord, __ATOMIC_ACQUIRE) & mapBit;
+
+        if(count == full && !isSet) {
+            if(!(__atomic_fetch_or(mapWord, mapBit, __ATOMIC_ACQ_REL) & mapBit)) {
+                __atomic_add_fetch(&info.numFree, 1, __ATOMIC_RELAXED);
+            }
+        } else if(count != full && isSet) {
+            if(__atomic_fetch_and(mapWord, ~mapBit, __ATOMIC_ACQ_REL) & mapBit) {
+                __atomic_sub_fetch(&info.numFree, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        const auto now = __atomic_load_n(&info.freePages[frame], __ATOMIC_ACQUIRE);
+        if(now == count) break;
+        count = now;
+    }
+}
@@ -0,0 +1,452 @@
+#include "Vm/Arena.h"
+#include "Vm/PageAllocator.h"
+
+#include "Logging/Console.h"
+#include "Runtime/String.h"
+
+#include <Platform.h>
+
+using namespace Kernel::Vm;
+
+/**
+ * @brief Initialize an arena covering the given range of address space.
+ *
+ * @param base Base address of the arena; must be aligned to the quantum
+ * @param length Length of the arena, in bytes; must be a multiple of the quantum
+ * @param quantum Allocation granularity; must be a power of two, no larger than a page
+ */
+Arena::Arena(const uintptr_t base, const size_t length, const size_t quantum) : quantum(quantum) {
+    REQUIRE(__builtin_popcountll(quantum) == 1 && quantum <= Platform::PageTable::PageSize(),
+            "invalid arena quantum %zx", quantum);
+    REQUIRE(!(base % quantum) && !(length % quantum) && length, "invalid arena %016zx (%zx)",
+            base, length);
+
+    for(auto &seg : this->staticSegments) {
+        this->releaseSegment(&seg);
+    }
+
+    // a single free segment covers the entire arena
+    auto seg = this->newSegment();
+    seg->base = base;
+    seg->length = length;
+    seg->isFree = true;
+
+    this->insertAfter(nullptr, seg);
+    this->pushFree(seg);
+    this->bytesFree = length;
+}
+
+/**
+ * @brief Allocate a range of address space.
+ *
+ * @param length Length of the range, in bytes; rounded up to the quantum
+ * @param alignment Required alignment of the range's base address; must be a power of two. Pass 0
+ *        if the quantum is sufficient.
+ * @param outBase Variable to receive the base address of the range
+ *
+ * @return 0 on success, or a negative error code
+ */
+int Arena::alloc(const size_t length, const size_t alignment, uintptr_t &outBase) {
+    REQUIRE(!alignment || __builtin_popcountll(alignment) == 1, "invalid alignment %zx",
+            alignment);
+    if(!length) return -1;
+
+    Runtime::SpinlockGuard guard(this->lock);
+    return this->allocLocked(length, alignment, outBase);
+}
+
+/**
+ * @brief Release a previously allocated range of address space.
+ *
+ * The range's segment is merged with adjacent free segments.
+ *
+ * @param base Base address of the range, as returned by alloc()
+ * @param length Length of the range; it must match the length passed to alloc().
+ *
+ * @return 0 on success, or a negative error code if the range wasn't allocated
+ */
+int Arena::free(const uintptr_t base, const size_t length) {
+    Runtime::SpinlockGuard guard(this->lock);
+    return this->freeLocked(base, length);
+}
+
+/**
+ * @brief Get the arena's usage counters.
+ *
+ * @param outAllocated Number of bytes allocated (including boundary tag pages)
+ * @param outFree Number of bytes free
+ * @param outSegments Number of segments the arena is divided into
+ */
+void Arena::getStats(size_t &outAllocated, size_t &outFree, size_t &outSegments) const {
+    Runtime::SpinlockGuard guard(this->lock);
+
+    outAllocated = this->bytesAllocated;
+    outFree = this->bytesFree;
+    outSegments = this->numSegments;
+}
+
+/**
+ * @brief Allocate a range of address space.
+ *
+ * A suitable free segment is found, and any space in front of (for alignment) or after the
+ * allocation is split off into new free segments.
+ *
+ * @remark The arena's lock must be held.
+ */
+int Arena::allocLocked(const size_t inLength, const size_t inAlignment, uintptr_t &outBase) {
+    const auto length = (inLength + (this->quantum - 1)) & ~(this->quantum - 1);
+    const auto alignment = (inAlignment > this->quantum) ? inAlignment : 0;
+
+    // ensure we've got boundary tags for splitting the segment
+    if(!this->internalAlloc && this->numSpare < kMinSpareSegments) {
+        this->refillSegments();
+    }
+    if(this->numSpare < 2) {
+        return -1;
+    }
+
+    auto seg = this->findFree(length, alignment);
+    if(!seg) {
+        return -1;
+    }
+
+    this->removeFree(seg);
+
+    // split off the space in front of an aligned base
+    const auto base = alignment ? ((seg->base + (alignment - 1)) & ~(alignment - 1)) : seg->base;
+    if(base != seg->base) {
+        auto lead = this->newSegment();
+        lead->base = seg->base;
+        lead->length = base - seg->base;
+        lead->isFree = true;
+
+        this->insertAfter(seg->prev, lead);
+        this->pushFree(lead);
+
+        seg->base = base;
+        seg->length -= lead->length;
+    }
+
+    // and the space past the end of the allocation
+    if(seg->length != length) {
+        auto tail = this->newSegment();
+        tail->base = seg->base + length;
+        tail->length = seg->length - length;
+        tail->isFree = true;
+
+        this->insertAfter(seg, tail);
+        this->pushFree(tail);
+
+        seg->length = length;
+    }
+
+    // record the allocation
+    seg->isFree = false;
+
+    auto &bucket = this->hash[this->hashFor(seg->base)];
+    seg->listPrev = nullptr;
+    seg->listNext = bucket;
+    bucket = seg;
+
+    this->bytesAllocated += length;
+    this->bytesFree -= length;
+    this->numAllocated++;
+
+    outBase = seg->base;
+
+    if(!this->internalAlloc && this->numAllocated > (kMaxHashLoad << this->hashShift)) {
+        this->growHash();
+    }
+    return 0;
+}
+
+/**
+ * @brief Release a previously allocated range of address space.
+ *
+ * @remark The arena's lock must be held.
+ */
+int Arena::freeLocked(const uintptr_t base, const size_t inLength) {
+    const auto length = (inLength + (this->quantum - 1)) & ~(this->quantum - 1);
+
+    // find the segment and remove it from the hash table
+    auto link = &this->hash[this->hashFor(base)];
+    while(*link && (*link)->base != base) {
+        link = &(*link)->listNext;
+    }
+
+    auto seg = *link;
+    if(!seg || seg->length != length) {
+        return -1;
+    }
+
+    *link = seg->listNext;
+
+    seg->isFree = true;
+    this->bytesAllocated -= length;
+    this->bytesFree += length;
+    this->numAllocated--;
+
+    // merge with the free neighbors
+    auto prev = seg->prev;
+    if(prev && prev->isFree) {
+        this->removeFree(prev);
+
+        prev->length += seg->length;
+        this->unlink(seg);
+        this->releaseSegment(seg);
+
+        seg = prev;
+    }
+
+    auto next = seg->next;
+    if(next && next->isFree) {
+        this->removeFree(next);
+
+        seg->length += next->length;
+        this->unlink(next);
+        this->releaseSegment(next);
+    }
+
+    this->pushFree(seg);
+    return 0;
+}
+
+/**
+ * @brief Find a free segment that can hold an allocation.
+ *
+ * First, the free lists for sizes of at least the next power of two above the request (including
+ * any slack for alignment) are checked; any segment on those lists will do. Otherwise, the lists
+ * from the one holding the request's own power of two up to (but not including) those are
+ * searched for a segment that fits; with alignment slack, this may be several lists.
+ *
+ * @param length Length of the allocation, in bytes; a multiple of the quantum
+ * @param alignment Required alignment, or 0 if the quantum is sufficient
+ *
+ * @return A free segment, or `nullptr` if there is none large enough
+ */
+Arena::Segment *Arena::findFree(const size_t length, const size_t alignment) {
+    const auto need = length + (alignment ? (alignment - this->quantum) : 0);
+
+    // instant fit
+    auto list = this->freeListFor(need);
+    if((need / this->quantum) & ((need / this->quantum) - 1)) {
+        list++;
+    }
+
+    if(list < kNumFreeLists) {
+        const auto mask = this->freeListMask & (~0ULL << list);
+        if(mask) {
+            return this->freeLists[__builtin_ctzll(mask)];
+        }
+    }
+
+    // search the lists that may hold segments that are just large enough
+    const auto last = (list < kNumFreeLists) ? list : kNumFreeLists;
+    for(auto i = this->freeListFor(length); i < last; i++) {
+        for(auto seg = this->freeLists[i]; seg; seg = seg->listNext) {
+            const auto base = alignment ? ((seg->base + (alignment - 1)) & ~(alignment - 1)) :
+                seg->base;
+            if(base + length <= seg->base + seg->length) {
+                return seg;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief Add a page worth of boundary tags to the spare tags.
+ *
+ * The page is allocated from the arena itself, and backed with memory by the page allocator.
+ * Failures are ignored; the arena simply continues with the spare tags it has.
+ *
+ * @remark The arena's lock must be held.
+ */
+void Arena::refillSegments() {
+    const auto pageSz = Platform::PageTable::PageSize();
+    uintptr_t page;
+
+    this->internalAlloc = true;
+
+    if(!this->allocLocked(pageSz, 0, page)) {
+        if(PageAllocator::MapPages(page, 1)) {
+            auto segs = reinterpret_cast<Segment *>(page);
+            for(size_t i = 0; i < (pageSz / sizeof(Segment)); i++) {
+                this->releaseSegment(&segs[i]);
+            }
+        } else {
+            this->freeLocked(page, pageSz);
+        }
+    }
+
+    this->internalAlloc = false;
+}
+
+/**
+ * @brief Grow the allocated segment hash table.
+ *
+ * A table with four times as many buckets is allocated from the arena, and all allocated segments
+ * are moved over to it. If the old table was allocated from the arena, it's released afterwards.
+ * Failures are ignored; the old table simply remains in use.
+ *
+ * @remark The arena's lock must be held.
+ */
+void Arena::growHash() {
+    if(this->hashShift >= kMaxHashShift) {
+        return;
+    }
+
+    const auto pageSz = Platform::PageTable::PageSize();
+    const auto oldShift = this->hashShift, newShift = oldShift + 2;
+    const auto oldBytes = (1ULL << oldShift) * sizeof(Segment *),
+          newBytes = (1ULL << newShift) * sizeof(Segment *);
+    static_assert(!(((1ULL << (kStaticHashShift + 2)) * sizeof(Segment *)) %
+                Platform::PageTable::PageSize()), "hash tables must be whole pages");
+
+    // allocate and map the new table
+    uintptr_t table;
+
+    this->internalAlloc = true;
+    if(this->allocLocked(newBytes, pageSz, table)) {
+        this->internalAlloc = false;
+        return;
+    }
+    if(!PageAllocator::MapPages(table, newBytes / pageSz)) {
+        this->freeLocked(table, newBytes);
+        this->internalAlloc = false;
+        return;
+    }
+
+    // move all allocated segments over
+    auto oldHash = this->hash;
+    auto newHash = reinterpret_cast<Segment **>(table);
+    memset(newHash, 0, newBytes);
+
+    this->hash = newHash;
+    this->hashShift = newShift;
+
+    for(size_t i = 0; i < (1ULL << oldShift); i++) {
+        auto seg = oldHash[i];
+        while(seg) {
+            auto next = seg->listNext;
+
+            auto &bucket = newHash[this->hashFor(seg->base)];
+            seg->listNext = bucket;
+            bucket = seg;
+
+            seg = next;
+        }
+    }
+
+    // release the old table
+    if(oldHash != this->staticHash) {
+        const auto oldTable = reinterpret_cast<uintptr_t>(oldHash);
+        PageAllocator::UnmapPages(oldTable, oldBytes);
+        this->freeLocked(oldTable, oldBytes);
+    }
+
+    this->internalAlloc = false;
+}
+
+/**
+ * @brief Take a boundary tag from the spare tags.
+ *
+ * @remark The caller must ensure that there is a spare tag.
+ */
+Arena::Segment *Arena::newSegment() {
+    auto seg = this->spare;
+    REQUIRE(seg, "arena %p out of boundary tags", this);
+
+    this->spare = seg->listNext;
+    this->numSpare--;
+
+    *seg = {};
+    return seg;
+}
+
+/**
+ * @brief Return a boundary tag to the spare tags.
+ */
+void Arena::releaseSegment(Segment *seg) {
+    seg->listNext = this->spare;
+    this->spare = seg;
+    this->numSpare++;
+}
+
+/**
+ * @brief Add a free segment to the free list for its size.
+ */
+void Arena::pushFree(Segment *seg) {
+    const auto list = this->freeListFor(seg->length);
+
+    seg->listPrev = nullptr;
+    seg->listNext = this->freeLists[list];
+    if(seg->listNext) {
+        seg->listNext->listPrev = seg;
+    }
+
+    this->freeLists[list] = seg;
+    this->freeListMask |= (1ULL << list);
+}
+
+/**
+ * @brief Remove a free segment from its free list.
+ */
+void Arena::removeFree(Segment *seg) {
+    const auto list = this->freeListFor(seg->length);
+
+    if(seg->listPrev) {
+        seg->listPrev->listNext = seg->listNext;
+    } else {
+        this->freeLists[list] = seg->listNext;
+        if(!seg->listNext) {
+            this->freeListMask &= ~(1ULL << list);
+        }
+    }
+
+    if(seg->listNext) {
+        seg->listNext->listPrev = seg->listPrev;
+    }
+
+    seg->listPrev = seg->listNext = nullptr;
+}
+
+/**
+ * @brief Insert a segment into the address ordered segment list.
+ *
+ * @param after Segment to insert after, or `nullptr` to insert at the start
+ * @param seg Segment to insert
+ */
+void Arena::insertAfter(Segment *after, Segment *seg) {
+    seg->prev = after;
+    seg->next = after ? after->next : this->segments;
+
+    if(seg->next) {
+        seg->next->prev = seg;
+    }
+    if(after) {
+        after->next = seg;
+    } else {
+        this->segments = seg;
+    }
+
+    this->numSegments++;
+}
+
+/**
+ * @brief Remove a segment from the address ordered segment list.
+ */
+void Arena::unlink(Segment *seg) {
+    if(seg->prev) {
+        seg->prev->next = seg->next;
+    } else {
+        this->segments = seg->next;
+    }
+
+    if(seg->next) {
+        seg->next->prev = seg->prev;
+    }
+
+    this->numSegments--;
+}
@@ -0,0 +1,155 @@
+#ifndef KERNEL_VM_ARENA_H
+#define KERNEL_VM_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Runtime/Spinlock.h>
+
+namespace Kernel::Vm {
+/**
+ * @brief Allocator for ranges of kernel virtual address space
+ *
+ * This is modeled after the vmem allocator: the arena is divided into segments, each described by
+ * a boundary tag, which are kept in a list sorted by address. Free segments are additionally on
+ * one of several free lists, segregated by the power of two of their size; allocated segments are
+ * kept in a hash table keyed by their base address.
+ *
+ * Allocations use "instant fit": any segment on the free list for the next larger power of two
+ * than the request is large enough, so a bitmap of non-empty free lists finds a suitable segment
+ * in constant time. Only if there is none is the list holding the request's own power of two
+ * searched. When freed, a segment is merged with its neighbors if they are free.
+ *
+ * Boundary tags come from a small pool in the arena itself, which is refilled with a page at a
+ * time, taken from the arena and backed by the page allocator. Pages holding boundary tags are
+ * never released. Likewise, the hash table starts out with a small built-in bucket array, and is
+ * grown into memory taken from the arena as the number of allocations increases.
+ *
+ * All operations are serialized by a spin lock; the arena only manages address space, it never
+ * maps or touches the memory it hands out.
+ */
+class Arena {
+    public:
+        Arena(const uintptr_t base, const size_t length, const size_t quantum);
+
+        int alloc(const size_t length, const size_t alignment, uintptr_t &outBase);
+        int free(const uintptr_t base, const size_t length);
+
+        void getStats(size_t &outAllocated, size_t &outFree, size_t &outSegments) const;
+
+    private:
+        /// Number of free lists; free list n holds segments of [2^n, 2^(n+1)) quanta
+        constexpr static const size_t kNumFreeLists{64};
+        /// Base 2 logarithm of the number of buckets in the built-in hash table
+        constexpr static const size_t kStaticHashShift{10};
+        /// Base 2 logarithm of the maximum number of hash table buckets
+        constexpr static const size_t kMaxHashShift{20};
+        /// The hash table is grown once there are more than this many allocations per bucket
+        constexpr static const size_t kMaxHashLoad{2};
+        /// Number of boundary tags built into the arena, used until the first refill
+        constexpr static const size_t kNumStaticSegments{16};
+        /**
+         * Minimum number of spare boundary tags
+         *
+         * The spare tags are refilled once fewer than this are left. An allocation needs at most
+         * two new tags, and a refill takes up to two more.
+         */
+        constexpr static const size_t kMinSpareSegments{6};
+
+        /**
+         * @brief Boundary tag
+         *
+         * Describes a single free or allocated segment of the arena.
+         */
+        struct Segment {
+            /// Base address of the segment
+            uintptr_t base;
+            /// Length of the segment, in bytes
+            size_t length;
+
+            /// Previous and next segments by address
+            Segment *prev, *next;
+            /**
+             * Links on the free list, the hash chain, or the spare tag list
+             *
+             * Which list this is depends on the segment's state; for hash chains and spare tags,
+             * only `listNext` is used.
+             */
+            Segment *listPrev, *listNext;
+
+            /// Whether the segment is free
+            bool isFree;
+        };
+
+    private:
+        int allocLocked(const size_t length, const size_t alignment, uintptr_t &outBase);
+        int freeLocked(const uintptr_t base, const size_t length);
+        Segment *findFree(const size_t length, const size_t alignment);
+        void refillSegments();
+        void growHash();
+
+        Segment *newSegment();
+        void releaseSegment(Segment *seg);
+
+        void pushFree(Segment *seg);
+        void removeFree(Segment *seg);
+
+        void insertAfter(Segment *after, Segment *seg);
+        void unlink(Segment *seg);
+
+        /// Get the free list for a segment of the given length
+        inline size_t freeListFor(const size_t length) const {
+            return 63 - __builtin_clzll(length / this->quantum);
+        }
+        /// Get the hash bucket for a segment's base address
+        inline size_t hashFor(const uintptr_t base) const {
+            return ((base / this->quantum) * 0x9E3779B97F4A7C15ULL) >> (64 - this->hashShift);
+        }
+
+    private:
+        /// Protects all arena state
+        mutable Runtime::Spinlock lock;
+
+        /// Allocation granularity, in bytes; a power of two
+        size_t quantum;
+
+        /// First segment (by address)
+        Segment *segments{nullptr};
+
+        /// Free lists, by power of two size
+        Segment *freeLists[kNumFreeLists]{};
+        /// Bitmap of non-empty free lists
+        uint64_t freeListMask{0};
+
+        /// Allocated segments, hashed by base address
+        Segment **hash{staticHash};
+        /// Base 2 logarithm of the number of hash buckets
+        size_t hashShift{kStaticHashShift};
+        /// Number of allocated segments
+        size_t numAllocated{0};
+
+        /// Unused boundary tags
+        Segment *spare{nullptr};
+        /// Number of unused boundary tags
+        size_t numSpare{0};
+        /**
+         * Set while the arena allocates memory for itself (for boundary tags or the hash table),
+         * so that this doesn't recurse
+         */
+        bool internalAlloc{false};
+
+        /// Bytes currently allocated
+        size_t bytesAllocated{0};
+        /// Bytes currently free
+        size_t bytesFree{0};
+        /// Number of segments (free and allocated)
+        size_t numSegments{0};
+
+        /// Boundary tags to get the arena started
+        Segment staticSegments[kNumStaticSegments];
+        /// Hash buckets to get the arena started
+        Segment *staticHash[1 << kStaticHashShift]{};
+};
+}
+
+#endif
@@ -0,0 +1,348 @@
+/**
+ * @file
+ *
+ * @brief General purpose kernel heap
+ *
+ * Small allocations are served by a zone allocator per size class, whose regions live in a
+ * per-class arena inside the kernel heap region; larger ones go directly to the page allocator.
+ */
+#include "Vm/Heap.h"
+#include "Vm/PageAllocator.h"
+
+#include "Logging/Console.h"
+#include "Vm/ZoneAllocator.h"
+
+#include <Platform.h>
+#include <new>
+
+using namespace Kernel::Vm;
+
+/**
+ * @brief Lookup table to get the size class for a requested length
+ *
+ * It's indexed by the length, rounded up to the heap alignment.
+ */
+struct ClassLookup {
+    uint8_t classes[(Heap::kMaxClassSize / Heap::kAlignment) + 1];
+
+    constexpr ClassLookup() : classes{} {
+        size_t cls{0};
+        for(size_t i = 0; i < sizeof(classes); i++) {
+            while(Heap::kClassSizes[cls] < (i * Heap::kAlignment)) {
+                cls++;
+            }
+            classes[i] = cls;
+        }
+    }
+};
+static constexpr const ClassLookup kClassLookup;
+
+/**
+ * @brief Size of the regions of each size class's zone
+ *
+ * Even for the largest size class, this wastes less than a single object per region.
+ */
+static constexpr const size_t kRegionSize{0x10000};
+
+/**
+ * @brief Region backing for a size class's zone
+ *
+ * Regions are allocated from the size class's arena.
+ */
+template<size_t Class>
+struct Heap::Backing {
+    static inline void *Alloc(const size_t length, const size_t) {
+        return Heap::AllocRegion(Class, length);
+    }
+    static inline void Free(void *ptr, const size_t length) {
+        Heap::FreeRegion(Class, ptr, length);
+    }
+};
+
+/**
+ * @brief Zone allocator for a size class
+ */
+template<size_t Class, const char *Name>
+struct Heap::ClassZone {
+    /// Objects of the size class
+    struct alignas(Heap::kAlignment) Object {
+        uint8_t data[Heap::kClassSizes[Class]];
+    };
+
+    using Zone = ZoneAllocator<Object, Name, kRegionSize, Backing<Class>>;
+    static Zone *gZone;
+
+    static void Init() {
+        alignas(Zone) static uint8_t gStorage[sizeof(Zone)];
+        gZone = new(gStorage) Zone;
+    }
+    static void *Alloc() {
+        return gZone->alloc();
+    }
+    static void Free(void *ptr) {
+        gZone->free(ptr);
+    }
+
+    /// Entry for the size class table
+    constexpr static const SizeClass kInfo{
+        .init = &Init,
+        .alloc = &Alloc,
+        .free = &Free,
+    };
+};
+
+template<size_t Class, const char *Name>
+typename Heap::ClassZone<Class, Name>::Zone *Heap::ClassZone<Class, Name>::gZone{nullptr};
+
+// names of the size class zones
+static constexpr const char kHeap16[] = "Heap 16";
+static constexpr const char kHeap32[] = "Heap 32";
+static constexpr const char kHeap48[] = "Heap 48";
+static constexpr const char kHeap64[] = "Heap 64";
+static constexpr const char kHeap96[] = "Heap 96";
+static constexpr const char kHeap128[] = "Heap 128";
+static constexpr const char kHeap192[] = "Heap 192";
+static constexpr const char kHeap256[] = "Heap 256";
+static constexpr const char kHeap384[] = "Heap 384";
+static constexpr const char kHeap512[] = "Heap 512";
+static constexpr const char kHeap768[] = "Heap 768";
+static constexpr const char kHeap1024[] = "Heap 1024";
+static constexpr const char kHeap1536[] = "Heap 1536";
+static constexpr const char kHeap2048[] = "Heap 2048";
+
+const Heap::SizeClass Heap::gClasses[kNumClasses]{
+    ClassZone<0, kHeap16>::kInfo,
+    ClassZone<1, kHeap32>::kInfo,
+    ClassZone<2, kHeap48>::kInfo,
+    ClassZone<3, kHeap64>::kInfo,
+    ClassZone<4, kHeap96>::kInfo,
+    ClassZone<5, kHeap128>::kInfo,
+    ClassZone<6, kHeap192>::kInfo,
+    ClassZone<7, kHeap256>::kInfo,
+    ClassZone<8, kHeap384>::kInfo,
+    ClassZone<9, kHeap512>::kInfo,
+    ClassZone<10, kHeap768>::kInfo,
+    ClassZone<11, kHeap1024>::kInfo,
+    ClassZone<12, kHeap1536>::kInfo,
+    ClassZone<13, kHeap2048>::kInfo,
+};
+Heap::Arena Heap::gArenas[kNumClasses];
+bool Heap::gInitialized{false};
+
+/**
+ * @brief Set up the kernel heap
+ *
+ * This must be called after the page allocator is initialized.
+ */
+void Heap::Init() {
+    static_assert((kNumClasses << kArenaShift) <= (Platform::KernelAddressLayout::KernelHeapEnd -
+                Platform::KernelAddressLayout::KernelHeapStart + 1),
+            "kernel heap region too small for size class arenas");
+
+    for(size_t i = 0; i < kNumClasses; i++) {
+        auto &arena = gArenas[i];
+        arena.next = Platform::KernelAddressLayout::KernelHeapStart + (i << kArenaShift);
+        arena.end = arena.next + (1ULL << kArenaShift);
+
+        gClasses[i].init();
+    }
+
+    __atomic_store_n(&gInitialized, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Allocate memory from the heap
+ *
+ * @param length Number of bytes to allocate
+ *
+ * @return Pointer to memory aligned to kAlignment, or `nullptr` if no memory is available
+ */
+void *Heap::Alloc(const size_t length) {
+    REQUIRE(__atomic_load_n(&gInitialized, __ATOMIC_RELAXED), "heap not initialized");
+
+    if(length > kMaxClassSize) {
+        return AllocLarge(length);
+    }
+
+    const auto cls = kClassLookup.classes[(length + (kAlignment - 1)) / kAlignment];
+    return gClasses[cls].alloc();
+}
+
+/**
+ * @brief Release memory previously allocated from the heap
+ *
+ * The size class of the allocation is determined from the arena its address is in; anything not
+ * in the kernel heap region must be a large allocation.
+ *
+ * @param ptr Pointer returned by Alloc(); may be `nullptr`
+ */
+void Heap::Free(void *ptr) {
+    if(!ptr) return;
+
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    if(addr >= Platform::KernelAddressLayout::KernelHeapStart &&
+            addr <= Platform::KernelAddressLayout::KernelHeapEnd) {
+        const auto cls = (addr - Platform::KernelAddressLayout::KernelHeapStart) >> kArenaShift;
+        REQUIRE(cls < kNumClasses, "invalid heap pointer %p", ptr);
+
+        gClasses[cls].free(ptr);
+        return;
+    }
+
+    auto header = GetLargeHeader(ptr);
+    const auto length = header->length;
+    header->magic = 0;
+
+    Vm::VFree(header, length + sizeof(LargeHeader));
+}
+
+/**
+ * @brief Get the usable size of a heap allocation
+ *
+ * @param ptr Pointer returned by Alloc()
+ *
+ * @return Number of bytes that may be used; this may be larger than the requested length.
+ */
+size_t Heap::GetSize(const void *ptr) {
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    if(addr >= Platform::KernelAddressLayout::KernelHeapStart &&
+            addr <= Platform::KernelAddressLayout::KernelHeapEnd) {
+        const auto cls = (addr - Platform::KernelAddressLayout::KernelHeapStart) >> kArenaShift;
+        REQUIRE(cls < kNumClasses, "invalid heap pointer %p", ptr);
+
+        return kClassSizes[cls];
+    }
+
+    return GetLargeHeader(ptr)->length;
+}
+
+/**
+ * @brief Satisfy a large allocation from the page allocator
+ *
+ * @param length Number of bytes to allocate
+ *
+ * @return Pointer to memory following the allocation's header, or `nullptr` on failure
+ */
+void *Heap::AllocLarge(const size_t length) {
+    const auto total = length + sizeof(LargeHeader);
+    if(total < length) {
+        return nullptr;
+    }
+
+    auto header = reinterpret_cast<LargeHeader *>(Vm::VAlloc(total));
+    if(!header) return nullptr;
+
+    header->length = length;
+    header->magic = kLargeMagic;
+
+    return header + 1;
+}
+
+/**
+ * @brief Get the header of a large allocation
+ *
+ * @param ptr Pointer returned by Alloc()
+ *
+ * @return Allocation header; if it is invalid, the system panics.
+ */
+Heap::LargeHeader *Heap::GetLargeHeader(const void *ptr) {
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    if(addr < Platform::KernelAddressLayout::VAllocStart ||
+            addr > Platform::KernelAddressLayout::VAllocEnd ||
+            (addr % Platform::PageTable::PageSize()) != sizeof(LargeHeader)) {
+        PANIC("invalid heap pointer %p", ptr);
+    }
+
+    auto header = reinterpret_cast<LargeHeader *>(const_cast<void *>(ptr)) - 1;
+    if(header->magic != kLargeMagic) {
+        PANIC("invalid heap pointer %p (magic %016zx)", ptr, header->magic);
+    }
+
+    return header;
+}
+
+/**
+ * @brief Allocate a region for a size class's zone
+ *
+ * Regions are allocated from the size class's arena; addresses of previously released regions
+ * are reused first. Since all regions of a size class have the same size, this keeps them
+ * aligned to their size.
+ *
+ * @param cls Size class index
+ * @param length Size of the region, in bytes
+ *
+ * @return Address of the region, or `nullptr` if no memory is available
+ */
+void *Heap::AllocRegion(const size_t cls, const size_t length) {
+    auto &arena = gArenas[cls];
+    uintptr_t virt;
+
+    {
+        Runtime::SpinlockGuard guard(arena.lock);
+
+        if(arena.numRecycled) {
+            virt = arena.recycled[--arena.numRecycled];
+        } else {
+            if(arena.next + length > arena.end) {
+                return nullptr;
+            }
+
+            virt = arena.next;
+            arena.next += length;
+        }
+    }
+
+    if(!PageAllocator::MapPages(virt, length / Platform::PageTable::PageSize())) {
+        Runtime::SpinlockGuard guard(arena.lock);
+        if(arena.numRecycled < kMaxRecycledRegions) {
+            arena.recycled[arena.numRecycled++] = virt;
+        }
+        return nullptr;
+    }
+
+    return reinterpret_cast<void *>(virt);
+}
+
+/**
+ * @brief Release a size class zone's region
+ *
+ * Its pages are unmapped and freed, and its address is remembered for reuse.
+ *
+ * @param cls Size class index
+ * @param ptr Address of the region
+ * @param length Size of the region, in bytes
+ */
+void Heap::FreeRegion(const size_t cls, void *ptr, const size_t length) {
+    auto &arena = gArenas[cls];
+    const auto virt = reinterpret_cast<uintptr_t>(ptr);
+
+    PageAllocator::UnmapPages(virt, length);
+
+    Runtime::SpinlockGuard guard(arena.lock);
+    if(arena.numRecycled < kMaxRecycledRegions) {
+        arena.recycled[arena.numRecycled++] = virt;
+    }
+}
+
+
+
+/**
+ * @brief Allocate memory from the kernel heap
+ *
+ * @param length Number of bytes to allocate
+ *
+ * @return Pointer to at least `length` bytes of memory, aligned to 16 bytes, or `nullptr` if no
+ *         memory is available. Its contents are undefined.
+ */
+void *Kernel::Malloc(const size_t length) {
+    return Heap::Alloc(length);
+}
+
+/**
+ * @brief Release memory allocated from the kernel heap
+ *
+ * @param ptr Pointer previously returned by Malloc(); may be `nullptr`
+ */
+void Kernel::Free(void *ptr) {
+    Heap::Free(ptr);
+}
@@ -0,0 +1,115 @@
+#ifndef KERNEL_VM_HEAP_H
+#define KERNEL_VM_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Runtime/Spinlock.h>
+#include <Vm/Alloc.h>
+
+namespace Kernel::Vm {
+/**
+ * @brief General purpose kernel heap
+ *
+ * Implements Kernel::Malloc() and Kernel::Free(). Small allocations are rounded up to one of a
+ * fixed set of size classes, each of which is served by its own zone allocator. The regions of
+ * each size class's zone are allocated from a dedicated arena inside the kernel heap's address
+ * range, so the size class (and thus the size) of an allocation follows directly from its
+ * address.
+ *
+ * Allocations larger than the largest size class are satisfied directly by the page allocator.
+ * They are prefixed with a small header that records their length.
+ */
+class Heap {
+    public:
+        /// Alignment of all heap allocations
+        constexpr static const size_t kAlignment{16};
+        /// Number of size classes
+        constexpr static const size_t kNumClasses{14};
+        /// Object size of each size class, in ascending order
+        constexpr static const size_t kClassSizes[kNumClasses]{
+            16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+        };
+        /// Largest allocation served by a size class
+        constexpr static const size_t kMaxClassSize{kClassSizes[kNumClasses - 1]};
+
+    public:
+        Heap() = delete;
+
+        static void Init();
+
+        [[nodiscard]] static void *Alloc(const size_t length);
+        static void Free(void *ptr);
+        static size_t GetSize(const void *ptr);
+
+    private:
+        /**
+         * Base 2 logarithm of the size of each size class's arena
+         *
+         * Each arena is 64G, which comfortably fits 16 of them into the kernel heap region.
+         */
+        constexpr static const size_t kArenaShift{36};
+
+        /**
+         * Maximum number of released regions whose addresses are kept for reuse, per arena
+         *
+         * Any further released address space is not reused.
+         */
+        constexpr static const size_t kMaxRecycledRegions{32};
+
+        /// Magic value in the header of large allocations
+        constexpr static const uint64_t kLargeMagic{0x4c41524745484541};
+
+        /// Size classes and the functions to allocate from them
+        struct SizeClass {
+            /// Set up the size class's zone
+            void (*init)();
+            /// Allocate an object from the zone
+            void *(*alloc)();
+            /// Return an object to the zone
+            void (*free)(void *);
+        };
+
+        /// Virtual address space from which a size class's regions are allocated
+        struct Arena {
+            /// Protects the arena
+            Runtime::Spinlock lock;
+            /// Next unused address in the arena
+            uintptr_t next;
+            /// End of the arena
+            uintptr_t end;
+
+            /// Number of recycled region addresses
+            size_t numRecycled{0};
+            /// Addresses of released regions, which are reused before allocating fresh space
+            uintptr_t recycled[kMaxRecycledRegions];
+        };
+
+        /// Prefixed to large allocations
+        struct LargeHeader {
+            /// Length of the allocation, excluding the header
+            size_t length;
+            /// Set to kLargeMagic
+            uint64_t magic;
+        };
+        static_assert(sizeof(LargeHeader) == kAlignment, "invalid large allocation header");
+
+        template<size_t Class> struct Backing;
+        template<size_t Class, const char *Name> struct ClassZone;
+
+        static void *AllocLarge(const size_t length);
+        static LargeHeader *GetLargeHeader(const void *ptr);
+
+        static void *AllocRegion(const size_t cls, const size_t length);
+        static void FreeRegion(const size_t cls, void *ptr, const size_t length);
+
+    private:
+        static const SizeClass gClasses[kNumClasses];
+        static Arena gArenas[kNumClasses];
+
+        /// Set once the heap is ready for use
+        static bool gInitialized;
+};
+}
+
+#endif
@@ -3,13 +3,14 @@
  *
  * @brief Virtual page allocator
  *
- * Thie file contains the implementation of the virtual page allocator. Currently, this is an
- * extremely naiive implementation that simply moves a cursor through the virtual memory region
- * reserved for the virtual allocator.
+ * Thie file contains the implementation of the virtual page allocator. Virtual address space in
+ * the region reserved for the virtual allocator is managed by an Arena, so that it can be reused
+ * once freed.
  *
  * Underlying physical memory is allocated directly from the physical memory allocator, and the
  * kernel pagetables are also directly manipualted.
  */
+#include "Vm/Arena.h"
 #include "Vm/Manager.h"
 #include "Vm/Map.h"
 #include "Vm/PageAllocator.h"
@@ -17,6 +18,7 @@
 #include "Exceptions/Handler.h"
 #include "Memory/PhysicalAllocator.h"
 #include "Logging/Console.h"
+#include "Runtime/String.h"
 
 #include <Intrinsics.h>
 #include <Platform.h>
@@ -24,14 +26,15 @@
 
 using namespace Kernel::Vm;
 
+// space in .bss segment for the address space arena
+static KUSH_ALIGNED(64) uint8_t gArenaBuf[sizeof(Arena)];
+
 /**
- * @brief Allocation cursor
+ * @brief Address space arena
  *
- * This dude points to the start of the region of virtual memory space at which we should begin
- * allocating new pages. The pointer is continuously advanced until it reaches the end of the
- * virtual address region. (At which point we panic, but…)
+ * Manages the virtual memory region reserved for the virtual allocator. It's set up by Init().
  */
-uintptr_t PageAllocator::gAllocCursor{Platform::KernelAddressLayout::VAllocStart};
+Arena *PageAllocator::gArena{nullptr};
 
 /**
  * @brief Total number of allocated pages
@@ -40,26 +43,147 @@ uintptr_t PageAllocator::gAllocCursor{Platform::KernelAddressLayout::VAllocStart
  */
 uintptr_t PageAllocator::gPagesAllocated{0};
 
+Kernel::Runtime::Spinlock PageAllocator::gLazyLock;
+PageAllocator::LazyRegion PageAllocator::gLazyRegions[kMaxLazyRegions];
+size_t PageAllocator::gNumLazyRegions{0};
+
+Kernel::Runtime::Spinlock PageAllocator::gDeferredLock;
+PageAllocator::DeferredRange PageAllocator::gDeferredRanges[kMaxDeferredRanges];
+size_t PageAllocator::gNumDeferredRanges{0};
+size_t PageAllocator::gNumFlushedRanges{0};
+uint64_t PageAllocator::gDeferredPages[kMaxDeferredPages];
+size_t PageAllocator::gNumDeferredPages{0};
+size_t PageAllocator::gTlbFlushes{0};
+size_t PageAllocator::gTlbFlushesAvoided{0};
+size_t PageAllocator::gLargePages{0};
+
 
 /**
  * @brief Initialize the virtual page allocator
  */
 void PageAllocator::Init() {
-    gAllocCursor = Platform::KernelAddressLayout::VAllocStart;
+    gArena = new (gArenaBuf) Arena(Platform::KernelAddressLayout::VAllocStart,
+            Platform::KernelAddressLayout::VAllocEnd - Platform::KernelAddressLayout::VAllocStart
+            + 1, Platform::PageTable::PageSize());
     gPagesAllocated = 0;
+    gNumLazyRegions = 0;
+
+    const auto err = PhysicalAllocator::AddPressureHandler(&HandlePressure);
+    REQUIRE(!err, "failed to install valloc pressure handler: %d", err);
 }
 
 /**
  * @brief Handle a page fault
  *
- * Any fault inside the page allocator results in a kernel panic.
+ * Faults caused by the kernel accessing a not yet backed page of a lazy allocation are resolved
+ * by backing the page with memory. Any other fault inside the page allocator results in a kernel
+ * panic.
+ *
+ * @return 1 if the fault was handled
  */
 int PageAllocator::HandleFault(Platform::ProcessorState &state, const uintptr_t address,
         const FaultAccessType access) {
+    if(TestFlags(access & FaultAccessType::PageNotPresent) &&
+            !TestFlags(access & FaultAccessType::User)) {
+        const auto err = CommitLazy(address);
+        if(err == 1) {
+            return 1;
+        } else if(err < 0) {
+            Exceptions::Handler::AbortWithException(Exceptions::Handler::ExceptionType::PageFault,
+                    state, reinterpret_cast<void *>(address), "Failed to commit lazy valloc page");
+        }
+    }
+
     Exceptions::Handler::AbortWithException(Exceptions::Handler::ExceptionType::PageFault,
             state, reinterpret_cast<void *>(address), "Fault in valloc region");
 }
 
+/**
+ * @brief Back the page of a lazy allocation containing the given address with memory
+ *
+ * The page is zeroed before it's used. If the page is already mapped (because another processor
+ * faulted on it at the same time) nothing happens.
+ *
+ * @param address Faulting address
+ *
+ * @return 1 if the page is now mapped, 0 if the address isn't in a lazy allocation, or a negative
+ *         error code.
+ */
+int PageAllocator::CommitLazy(const uintptr_t address) {
+    int err;
+    uint64_t phys;
+    Vm::Mode mode;
+    const auto pageSz = Platform::PageTable::PageSize();
+    const auto page = address & ~(pageSz - 1);
+
+    Runtime::SpinlockGuard guard(gLazyLock);
+
+    auto region = FindLazy(page);
+    if(!region) {
+        return 0;
+    }
+
+    auto map = Map::Kernel();
+    REQUIRE(map, "invalid kernel map? wtf");
+
+    err = map->pt.getPhysAddr(page, phys, mode);
+    if(err) {
+        return err;
+    }
+
+    // allocate a physical page and map it
+    err = PhysicalAllocator::AllocatePages(1, &phys);
+    if(err != 1) {
+        return -1;
+    }
+
+    err = map->pt.mapPage(phys, page, Kernel::Vm::Mode::KernelRW);
+    if(err) {
+        PhysicalAllocator::FreePages(1, &phys);
+        return err;
+    }
+
+    memset(reinterpret_cast<void *>(page), 0, pageSz);
+
+    region->committed++;
+    __atomic_add_fetch(&gPagesAllocated, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+/**
+ * @brief Find the lazy allocation containing an address
+ *
+ * The caller must hold the lazy allocation lock.
+ *
+ * @param address Address to look up
+ *
+ * @return Lazy allocation whose pages (not counting its guard pages) contain the address, or
+ *         `nullptr` if there is none.
+ */
+PageAllocator::LazyRegion *PageAllocator::FindLazy(const uintptr_t address) {
+    // find the last region starting at or below the address
+    size_t low{0}, high{gNumLazyRegions};
+    while(low < high) {
+        const auto mid = low + ((high - low) / 2);
+        if(gLazyRegions[mid].base <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if(!low) {
+        return nullptr;
+    }
+
+    auto region = &gLazyRegions[low - 1];
+    if(address - region->base >= region->numPages * Platform::PageTable::PageSize()) {
+        return nullptr;
+    }
+    return region;
+}
+
 
 
 /**
@@ -68,72 +192,149 @@ int PageAllocator::HandleFault(Platform::ProcessorState &state, const uintptr_t
  * Returns the starting address of a page aligned, virtually contiguous region of memory. The
  * underlying physical memory is allocated directly from the physical allocator.
  *
+ * Allocations of at least a large page are aligned to the large page size, so that they can be
+ * backed by large pages where possible.
+ *
+ * The address space reserved for the allocation includes a few unmapped guard pages past its end.
+ *
  * @param length Length of the allocation, in bytes. Rounded up to the nearest page multiple
+ * @param alignment Required alignment of the starting address, in bytes; it must be a power of
+ *        two. Pass 0 if page alignment is sufficient.
  *
  * @return Starting address of the first page in the allocated region, or NULL on failure
  *
- * @remark The maximum size of an allocation through this mechanism is limited.
- *
  * @TODO Add thread safety (locking) support
  */
-void *PageAllocator::Alloc(const size_t length) {
-    int err;
-    uintptr_t virt;
+void *PageAllocator::Alloc(const size_t length, const size_t alignment) {
+    REQUIRE(!alignment || __builtin_popcountll(alignment) == 1, "invalid alignment %zx",
+            alignment);
 
-    // check if alloc pointer would overflow
+    REQUIRE(gArena, "page allocator not initialized");
+
+    // reserve address space, including the guard pages
+    uintptr_t start;
     const auto pageLength = Platform::PageTable::NearestPageSize(length),
         pageLengthWithGuards = pageLength + (kNumGuardPages * Platform::PageTable::PageSize());
-    const auto end = gAllocCursor + pageLengthWithGuards;
-
-    REQUIRE(end < Platform::KernelAddressLayout::VAllocEnd &&
-            end > gAllocCursor, "PageAllocator internal inconsistency: alloc ptr %p, request %u",
-            gAllocCursor, pageLength);
 
-    // allocate physical pages
-    uint64_t phys[kMaxAllocPages]{};
-    size_t numPages = pageLength / Platform::PageTable::PageSize();
+    // large allocations are aligned so they can be mapped with large pages
+    auto align = alignment;
+    if(pageLength >= kLargePageSize && align < kLargePageSize) {
+        align = kLargePageSize;
+    }
 
-    err = PhysicalAllocator::AllocatePages(numPages, phys);
-    if(err < -1) { // allocation failure
+    if(gArena->alloc(pageLengthWithGuards, align, start)) {
         return nullptr;
-    } else if(err != numPages) { // partial allocation
-        PhysicalAllocator::FreePages(err, phys);
+    }
+
+    // allocate physical pages and map them
+    if(!MapPages(start, pageLength / Platform::PageTable::PageSize())) {
+        gArena->free(start, pageLengthWithGuards);
         return nullptr;
     }
 
-    // then map them into the kernel's map
-    auto map = Map::Kernel();
-    REQUIRE(map, "invalid kernel map? wtf");
+    auto startPtr = reinterpret_cast<void *>(start);
 
-    virt = gAllocCursor;
+    if(kLogAlloc) {
+        Console::Trace("PageAlloc: ptr=%p, %u pages", startPtr, gPagesAllocated);
+    }
 
-    for(size_t i = 0; i < numPages; i++) {
-        err = map->pt.mapPage(phys[i], virt, Kernel::Vm::Mode::KernelRW);
-        // TODO: can we handle this error better?
-        REQUIRE(!err, "failed to map virtual page: %d", err);
+    return startPtr;
+}
 
-        virt += Platform::PageTable::PageSize();
+/**
+ * @brief Reserve a range of virtual memory for kernel use, backing it with memory on demand
+ *
+ * Like Alloc(), but no physical memory is allocated up front: instead, each page is backed by a
+ * freshly zeroed physical page the first time it's accessed. This must not happen with
+ * interrupts disabled, or in an interrupt handler.
+ *
+ * Release the region with Free() as usual; only the pages that were accessed are freed.
+ *
+ * @param length Length of the allocation, in bytes. Rounded up to the nearest page multiple
+ * @param alignment Required alignment of the starting address, in bytes; it must be a power of
+ *        two. Pass 0 if page alignment is sufficient.
+ *
+ * @return Starting address of the first page in the reserved region, or NULL on failure
+ */
+void *PageAllocator::AllocLazy(const size_t length, const size_t alignment) {
+    REQUIRE(!alignment || __builtin_popcountll(alignment) == 1, "invalid alignment %zx",
+            alignment);
+
+    REQUIRE(gArena, "page allocator not initialized");
+
+    // reserve address space, including the guard pages
+    uintptr_t start;
+    const auto pageLength = Platform::PageTable::NearestPageSize(length),
+        pageLengthWithGuards = pageLength + (kNumGuardPages * Platform::PageTable::PageSize());
+
+    if(gArena->alloc(pageLengthWithGuards, alignment, start)) {
+        return nullptr;
     }
 
-    // TODO: record the allocation somewhere
+    // record it in the lazy allocation table, keeping it sorted
+    bool recorded{false};
+    {
+        Runtime::SpinlockGuard guard(gLazyLock);
+
+        if(gNumLazyRegions < kMaxLazyRegions) {
+            size_t i = gNumLazyRegions++;
+            for(; i && gLazyRegions[i - 1].base > start; i--) {
+                gLazyRegions[i] = gLazyRegions[i - 1];
+            }
+
+            gLazyRegions[i] = {
+                .base = start,
+                .numPages = pageLength / Platform::PageTable::PageSize(),
+                .committed = 0,
+            };
+            recorded = true;
+        }
+    }
+
+    if(!recorded) {
+        gArena->free(start, pageLengthWithGuards);
+        return nullptr;
+    }
 
-    // update allocator state
-    auto startPtr = reinterpret_cast<void *>(gAllocCursor);
-    gAllocCursor += pageLengthWithGuards;
-    gPagesAllocated += numPages;
+    auto startPtr = reinterpret_cast<void *>(start);
 
     if(kLogAlloc) {
-        Console::Trace("PageAlloc: ptr=%p, %u pages", gAllocCursor, gPagesAllocated);
+        Console::Trace("PageAlloc: lazy ptr=%p, %zu bytes", startPtr, pageLength);
     }
 
     return startPtr;
 }
 
+/**
+ * @brief Get the number of pages of a lazy allocation that are backed by memory
+ *
+ * @param ptr Start of a region previously allocated with AllocLazy()
+ * @param outPages Variable to receive the number of backed pages
+ *
+ * @return 0 on success, or -1 if the pointer isn't the start of a lazy allocation.
+ */
+int PageAllocator::GetCommitted(const void *ptr, size_t &outPages) {
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+
+    Runtime::SpinlockGuard guard(gLazyLock);
+
+    auto region = FindLazy(addr);
+    if(!region || region->base != addr) {
+        return -1;
+    }
+
+    outPages = region->committed;
+    return 0;
+}
+
 /**
  * @brief Release a previously allocated virtual memory region
  *
- * This returns the underlying physical pages to the physical allocator pool, and unmaps them from
- * the virtual memory.
+ * This unmaps the region, and returns the underlying physical pages to the physical allocator pool.
+ * For lazy allocations, only pages that were accessed are released.
+ *
+ * Unless the region is very large, its pages and address space are only released once the TLB is
+ * flushed, which is batched across several frees.
  *
  * @param ptr Start of the virtual region previously allocated
  * @param length Length of the allocation, in bytes.
@@ -141,47 +342,486 @@ void *PageAllocator::Alloc(const size_t length) {
  * @TODO Add thread safety (locking) support
  */
 void PageAllocator::Free(void *ptr, const size_t length) {
-    int err;
-    uint64_t phys[kMaxAllocPages]{};
-    Vm::Mode mode;
-
     // validate inputs
     REQUIRE(ptr && length, "invalid arguments (%s)", __FUNCTION__);
     REQUIRE(!(reinterpret_cast<uintptr_t>(ptr) % Platform::PageTable::PageSize()),
             "unaligned start ptr: %p", ptr);
 
-    const auto pageLength = Platform::PageTable::NearestPageSize(length);
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    const auto pageLength = Platform::PageTable::NearestPageSize(length),
+        pageLengthWithGuards = pageLength + (kNumGuardPages * Platform::PageTable::PageSize());
     size_t numPages = pageLength / Platform::PageTable::PageSize();
+    bool isLazy{false};
+
+    // remove lazy allocations from the table first, so no further pages get backed
+    {
+        Runtime::SpinlockGuard guard(gLazyLock);
+
+        auto region = FindLazy(addr);
+        if(region) {
+            REQUIRE(region->base == addr && region->numPages == numPages,
+                    "invalid VFree(%p, %zu)", ptr, length);
+
+            numPages = region->committed;
+
+            const auto idx = static_cast<size_t>(region - gLazyRegions);
+            for(size_t i = idx + 1; i < gNumLazyRegions; i++) {
+                gLazyRegions[i - 1] = gLazyRegions[i];
+            }
+            gNumLazyRegions--;
+            isLazy = true;
+        }
+    }
+
+    /*
+     * Allocations too large for the deferred queue, or that may be backed by large pages, are
+     * released right away. So are lazy allocations that were never accessed: nothing of them can
+     * be in any TLB.
+     */
+    if(numPages > kMaxDeferredPages || !numPages || (!isLazy && pageLength >= kLargePageSize)) {
+        if(numPages) {
+            ReleasePages(addr, pageLength, numPages);
+        }
+
+        const auto err = gArena->free(addr, pageLengthWithGuards);
+        REQUIRE(!err, "invalid VFree(%p, %zu)", ptr, length);
+    }
+    // otherwise, unmap the pages and queue them and the address space for release
+    else {
+        Runtime::SpinlockGuard guard(gDeferredLock);
+
+        if(gNumDeferredRanges == kMaxDeferredRanges ||
+                (gNumDeferredPages + numPages) > kMaxDeferredPages) {
+            FlushDeferredLocked();
+        }
+
+        size_t unmappedLength;
+        const auto unmapped = UnmapDeferred(addr, pageLength, numPages, unmappedLength);
+        REQUIRE(unmapped == numPages, "VFree(%p, %zu) unmapped %zu pages, expected %zu", ptr,
+                length, unmapped, numPages);
+
+        gDeferredRanges[gNumDeferredRanges++] = {
+            .base = addr,
+            .length = unmappedLength,
+            .reserved = pageLengthWithGuards,
+        };
+    }
+
+    if(kLogFrees) {
+        Console::Trace("PageAlloc: ptr=%p, %u pages", ptr, gPagesAllocated);
+    }
+}
+
+/**
+ * @brief Release all allocations awaiting a TLB flush
+ *
+ * This should be called periodically (for example, when the system is idle) so that memory of
+ * freed allocations doesn't sit in the deferred queue indefinitely.
+ */
+void PageAllocator::FlushDeferred() {
+    Runtime::SpinlockGuard guard(gDeferredLock);
+    FlushDeferredLocked();
+}
+
+/**
+ * @brief Print page allocator statistics to the console
+ */
+void PageAllocator::DumpStats() {
+    size_t allocated, free, segments;
+    gArena->getStats(allocated, free, segments);
+
+    Console::Notice("VAlloc: %zu pages (%zu large pages), %zu lazy regions, %zu bytes reserved "
+            "(%zu segments)", __atomic_load_n(&gPagesAllocated, __ATOMIC_RELAXED),
+            __atomic_load_n(&gLargePages, __ATOMIC_RELAXED),
+            __atomic_load_n(&gNumLazyRegions, __ATOMIC_RELAXED), allocated, segments);
+    Console::Notice("  frees: %zu TLB flushes, %zu avoided; %zu pages awaiting flush",
+            __atomic_load_n(&gTlbFlushes, __ATOMIC_RELAXED),
+            __atomic_load_n(&gTlbFlushesAvoided, __ATOMIC_RELAXED),
+            __atomic_load_n(&gNumDeferredPages, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Unmap a freed allocation and add its physical pages to the deferred queue
+ *
+ * The TLB is not invalidated; until FlushDeferredLocked() is called, stale translations for the
+ * range may still exist, so neither its address space nor its physical pages may be reused. The
+ * caller must hold the deferred queue lock, and ensure the queue has room for all pages.
+ *
+ * If only some pages of the range are mapped (as in lazy allocations) the search stops once all
+ * of them have been found, and only the part of the range up to the last of them is unmapped.
+ *
+ * @param virt Page aligned virtual address of the range
+ * @param length Length of the range, in bytes; a multiple of the page size
+ * @param numMapped Number of mapped pages in the range
+ * @param outLength Variable to receive the length of the unmapped part of the range, in bytes
+ *
+ * @return Number of pages that were unmapped
+ */
+size_t PageAllocator::UnmapDeferred(const uintptr_t virt, const size_t length,
+        const size_t numMapped, size_t &outLength) {
+    int err;
+    Vm::Mode mode;
+    const auto pageSz = Platform::PageTable::PageSize();
+    const bool sparse = numMapped < (length / pageSz);
+    size_t numUnmapped{0}, end{0};
 
-    // read out the corresponding physical page addresses
     auto map = Map::Kernel();
     REQUIRE(map, "invalid kernel map? wtf");
 
-    for(size_t i = 0; i < numPages; i++) {
-        const auto virt = reinterpret_cast<uintptr_t>(ptr) + (i * Platform::PageTable::PageSize());
-
-        err = map->pt.getPhysAddr(virt, phys[i], mode);
+    for(size_t off = 0; off < length && numUnmapped < numMapped; off += pageSz) {
+        uint64_t phys;
+        err = map->pt.getPhysAddr(virt + off, phys, mode);
+        if(sparse && !err) {
+            continue;
+        }
         REQUIRE(err == 1, "%s failed: %d", "PageTable::getPhysAddr", err);
+        REQUIRE(gNumDeferredPages < kMaxDeferredPages, "deferred page queue overflow");
+
+        gDeferredPages[gNumDeferredPages++] = phys;
+        numUnmapped++;
+        end = off + pageSz;
     }
 
-    // unmap the pages
-    err = map->pt.unmap(reinterpret_cast<uintptr_t>(ptr), pageLength);
-    REQUIRE(!err, "%s failed: %d", "PageTable::unmap", err);
+    if(end) {
+        err = map->pt.unmap(virt, end);
+        REQUIRE(!err, "%s failed: %d", "PageTable::unmap", err);
+    }
 
-    // update TLBs (extremely important!)
-    err = map->invalidateTlb(reinterpret_cast<uintptr_t>(ptr), pageLength,
-            TlbInvalidateHint::InvalidateAll | TlbInvalidateHint::Unmapped);
-    REQUIRE(!err, "failed to invalidate tlb: %d", err);
+    outLength = end;
+    return numUnmapped;
+}
 
-    // release the underlying physical pages
-    err = PhysicalAllocator::FreePages(numPages, phys);
-    REQUIRE(err == numPages, "failed to release phys pages: %d", err);
+/**
+ * @brief Perform a TLB flush for all deferred allocations, then release them
+ *
+ * The caller must hold the deferred queue lock.
+ */
+void PageAllocator::FlushDeferredLocked() {
+    int err;
 
-    gPagesAllocated -= numPages;
+    if(!gNumDeferredRanges) {
+        return;
+    }
 
-    // TODO: update recorded allocation state
-    if(kLogFrees) {
-        Console::Trace("PageAlloc: ptr=%p, %u pages", gAllocCursor, gPagesAllocated);
+    ReleaseDeferredPagesLocked();
+
+    // release the address space
+    for(size_t i = 0; i < gNumDeferredRanges; i++) {
+        const auto &range = gDeferredRanges[i];
+
+        err = gArena->free(range.base, range.reserved);
+        REQUIRE(!err, "invalid VFree(%p, %zu)", reinterpret_cast<void *>(range.base),
+                range.length);
+    }
+
+    gNumDeferredRanges = 0;
+    gNumFlushedRanges = 0;
+}
+
+/**
+ * @brief Perform a TLB flush for deferred allocations, then release their physical pages
+ *
+ * Only allocations that have not yet been flushed are invalidated: on the local processor, only
+ * their ranges are invalidated, unless there are many pages in the queue, in which case the
+ * entire TLB is flushed instead. Remote processors are sent a single shootdown covering all of
+ * them.
+ *
+ * Their address space stays in the queue, so this does not touch the arena.
+ *
+ * The caller must hold the deferred queue lock.
+ */
+void PageAllocator::ReleaseDeferredPagesLocked() {
+    int err;
+
+    if(gNumFlushedRanges == gNumDeferredRanges) {
+        return;
+    }
+
+    auto map = Map::Kernel();
+    REQUIRE(map, "invalid kernel map? wtf");
+
+    // invalidate TLBs
+    if(gNumDeferredPages > kFullFlushPages) {
+        err = map->invalidateTlb(0, 0, TlbInvalidateHint::InvalidateAll |
+                TlbInvalidateHint::InvalidateEntire | TlbInvalidateHint::Unmapped);
+        REQUIRE(!err, "failed to invalidate tlb: %d", err);
+    } else {
+        uintptr_t low{UINTPTR_MAX}, high{0};
+
+        for(size_t i = gNumFlushedRanges; i < gNumDeferredRanges; i++) {
+            const auto &range = gDeferredRanges[i];
+
+            err = map->invalidateTlb(range.base, range.length,
+                    TlbInvalidateHint::InvalidateLocal | TlbInvalidateHint::Unmapped);
+            REQUIRE(!err, "failed to invalidate tlb: %d", err);
+
+            if(range.base < low) low = range.base;
+            if(range.base + range.length > high) high = range.base + range.length;
+        }
+
+        err = map->invalidateTlb(low, high - low,
+                TlbInvalidateHint::InvalidateRemote | TlbInvalidateHint::Unmapped);
+        REQUIRE(!err, "failed to invalidate tlb: %d", err);
+    }
+
+    // release the physical pages
+    if(gNumDeferredPages) {
+        err = PhysicalAllocator::FreePages(gNumDeferredPages, gDeferredPages);
+        REQUIRE(err == static_cast<int>(gNumDeferredPages), "failed to release phys pages: %d",
+                err);
+        __atomic_sub_fetch(&gPagesAllocated, gNumDeferredPages, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&gTlbFlushes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gTlbFlushesAvoided, gNumDeferredRanges - gNumFlushedRanges - 1,
+            __ATOMIC_RELAXED);
+
+    gNumFlushedRanges = gNumDeferredRanges;
+    __atomic_store_n(&gNumDeferredPages, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Memory pressure handler
+ *
+ * Releases the physical pages in the deferred queue, which may otherwise hold on to up to
+ * `kMaxDeferredPages` pages until the next flush. The address space of the deferred allocations
+ * is left queued, since the arena may be locked further up the call stack.
+ *
+ * If the deferred queue is locked (because the pressure change was caused by the queue itself,
+ * or another processor is working on it) nothing happens.
+ */
+void PageAllocator::HandlePressure(const size_t, const PhysicalAllocator::Pressure level,
+        void *) {
+    if(level == PhysicalAllocator::kPressureNone) {
+        return;
+    }
+    if(!gDeferredLock.tryLock()) {
+        return;
+    }
+
+    ReleaseDeferredPagesLocked();
+    gDeferredLock.unlock();
+}
+
+/**
+ * @brief Back a range of kernel virtual memory with newly allocated physical pages
+ *
+ * The pages are mapped read/write into the kernel's map. Besides the page allocator's own region,
+ * this is used by other kernel allocators that manage their own virtual address space.
+ *
+ * Physical pages are requested from the physical allocator in batches of up to `kMapBatchPages`
+ * pages, and each batch is mapped before the next one is requested, so ranges of any size can be
+ * mapped without needing storage for all of their physical addresses.
+ *
+ * Parts of the range that cover an entire, aligned large page are mapped with a large page if one
+ * is available; regular pages are used for the rest of the range, or if this fails.
+ *
+ * @param virt Page aligned virtual address to map the pages at
+ * @param numPages Number of pages to map
+ *
+ * @return Whether the pages were allocated and mapped; on failure, nothing remains mapped.
+ */
+bool PageAllocator::MapPages(const uintptr_t virt, const size_t numPages) {
+    int err;
+    uint64_t phys[kMapBatchPages];
+    const auto pageSz = Platform::PageTable::PageSize();
+
+    auto map = Map::Kernel();
+    REQUIRE(map, "invalid kernel map? wtf");
+
+    for(size_t done = 0; done < numPages; ) {
+        const auto batchVirt = virt + (done * pageSz);
+
+        // map a large page if the range covers one entirely
+        if(!(batchVirt % kLargePageSize) && (numPages - done) >= kPagesPerLargePage &&
+                MapLargePage(batchVirt)) {
+            done += kPagesPerLargePage;
+            __atomic_add_fetch(&gPagesAllocated, kPagesPerLargePage, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // otherwise, map regular pages up to the next large page boundary
+        const auto toBoundary = (kLargePageSize - (batchVirt % kLargePageSize)) / pageSz;
+        auto batch = ((numPages - done) < kMapBatchPages) ? (numPages - done) : kMapBatchPages;
+        if(batch > toBoundary) {
+            batch = toBoundary;
+        }
+
+        // allocate physical pages
+        err = PhysicalAllocator::AllocatePages(batch, phys);
+        if(err != static_cast<int>(batch)) {
+            // release this batch (if partially allocated) and everything mapped so far
+            if(err > 0) {
+                PhysicalAllocator::FreePages(err, phys);
+            }
+            if(done) {
+                UnmapPages(virt, done * pageSz);
+            }
+            return false;
+        }
+
+        // then map them into the kernel's map
+        for(size_t i = 0; i < batch; i++) {
+            err = map->pt.mapPage(phys[i], batchVirt + (i * pageSz), Kernel::Vm::Mode::KernelRW);
+            // TODO: can we handle this error better?
+            REQUIRE(!err, "failed to map virtual page: %d", err);
+        }
+
+        done += batch;
+        __atomic_add_fetch(&gPagesAllocated, batch, __ATOMIC_RELAXED);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Try to back a large page worth of kernel virtual memory with a single large page
+ *
+ * @param virt Virtual address to map at; aligned to the large page size
+ *
+ * @return Whether a large page was allocated and mapped; if not, the caller should use regular
+ *         pages instead.
+ */
+bool PageAllocator::MapLargePage(const uintptr_t virt) {
+    int err;
+    uintptr_t phys;
+
+    err = PhysicalAllocator::AllocateLargePage(kLargePageSize, phys);
+    if(err != 1) {
+        return false;
+    }
+
+    auto map = Map::Kernel();
+    REQUIRE(map, "invalid kernel map? wtf");
+
+    // this fails if a page table already exists for the range
+    err = map->pt.mapLargePage(phys, virt, Kernel::Vm::Mode::KernelRW);
+    if(err) {
+        err = PhysicalAllocator::FreeLargePage(phys, kLargePageSize);
+        REQUIRE(err == 1, "failed to release large page: %d", err);
+        return false;
+    }
+
+    __atomic_add_fetch(&gLargePages, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * @brief Unmap a range of kernel virtual memory and release its physical pages
+ *
+ * This is the inverse of MapPages().
+ *
+ * @param virt Page aligned virtual address of the range
+ * @param length Length of the range, in bytes; rounded up to the nearest page size
+ */
+void PageAllocator::UnmapPages(const uintptr_t virt, const size_t length) {
+    ReleasePages(virt, length, Platform::PageTable::NearestPageSize(length) /
+            Platform::PageTable::PageSize());
+}
+
+/**
+ * @brief Unmap a range of kernel virtual memory and release its physical pages
+ *
+ * The range is processed in batches of up to `kMapBatchPages` pages, or a single large page:
+ * each batch is unmapped and its TLB entries invalidated before its physical pages are released.
+ *
+ * If only some pages of the range are mapped (as in lazy allocations) processing stops once all of
+ * them have been released.
+ *
+ * @param virt Page aligned virtual address of the range
+ * @param length Length of the range, in bytes; rounded up to the nearest page size
+ * @param numMapped Number of mapped pages in the range; if this is less than the number of pages
+ *        in the range, unmapped pages are skipped.
+ */
+void PageAllocator::ReleasePages(const uintptr_t virt, const size_t length,
+        const size_t numMapped) {
+    int err;
+    uint64_t phys[kMapBatchPages];
+    Vm::Mode mode;
+    const auto pageSz = Platform::PageTable::PageSize();
+
+    const auto pageLength = Platform::PageTable::NearestPageSize(length);
+    const size_t numPages = pageLength / pageSz;
+    const bool sparse = numMapped < numPages;
+    size_t remaining{numMapped};
+
+    auto map = Map::Kernel();
+    REQUIRE(map, "invalid kernel map? wtf");
+
+    for(size_t done = 0; done < numPages && remaining; ) {
+        const auto batchVirt = virt + (done * pageSz);
+
+        // large pages are released one at a time
+        if(!(batchVirt % kLargePageSize) && (numPages - done) >= kPagesPerLargePage) {
+            uint64_t largePhys;
+            size_t mappedSize;
+
+            err = map->pt.getPhysAddr(batchVirt, largePhys, mode, mappedSize);
+            if(err == 1 && mappedSize == kLargePageSize) {
+                err = map->pt.unmap(batchVirt, kLargePageSize);
+                REQUIRE(!err, "%s failed: %d", "PageTable::unmap", err);
+
+                err = map->invalidateTlb(batchVirt, kLargePageSize,
+                        TlbInvalidateHint::InvalidateAll | TlbInvalidateHint::Unmapped);
+                REQUIRE(!err, "failed to invalidate tlb: %d", err);
+                __atomic_add_fetch(&gTlbFlushes, 1, __ATOMIC_RELAXED);
+
+                err = PhysicalAllocator::FreeLargePage(largePhys, kLargePageSize);
+                REQUIRE(err == 1, "failed to release large page: %d", err);
+
+                done += kPagesPerLargePage;
+                remaining -= kPagesPerLargePage;
+                __atomic_sub_fetch(&gPagesAllocated, kPagesPerLargePage, __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&gLargePages, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+        }
+
+        // otherwise, release regular pages up to the next large page boundary
+        const auto toBoundary = (kLargePageSize - (batchVirt % kLargePageSize)) / pageSz;
+        auto batch = ((numPages - done) < kMapBatchPages) ? (numPages - done) : kMapBatchPages;
+        if(batch > toBoundary) {
+            batch = toBoundary;
+        }
+        const auto batchLength = batch * pageSz;
+
+        // read out the corresponding physical page addresses
+        size_t numFound{0};
+        for(size_t i = 0; i < batch && numFound < remaining; i++) {
+            size_t mappedSize;
+            err = map->pt.getPhysAddr(batchVirt + (i * pageSz), phys[numFound], mode,
+                    mappedSize);
+            if(sparse && !err) {
+                continue;
+            }
+            REQUIRE(err == 1, "%s failed: %d", "PageTable::getPhysAddr", err);
+            REQUIRE(mappedSize == pageSz, "unexpected large page at %p",
+                    reinterpret_cast<void *>(batchVirt + (i * pageSz)));
+            numFound++;
+        }
+
+        if(!numFound) {
+            done += batch;
+            continue;
+        }
+
+        // unmap the pages
+        err = map->pt.unmap(batchVirt, batchLength);
+        REQUIRE(!err, "%s failed: %d", "PageTable::unmap", err);
+
+        // update TLBs (extremely important!)
+        err = map->invalidateTlb(batchVirt, batchLength,
+                TlbInvalidateHint::InvalidateAll | TlbInvalidateHint::Unmapped);
+        REQUIRE(!err, "failed to invalidate tlb: %d", err);
+        __atomic_add_fetch(&gTlbFlushes, 1, __ATOMIC_RELAXED);
+
+        // release the underlying physical pages
+        err = PhysicalAllocator::FreePages(numFound, phys);
+        REQUIRE(err == static_cast<int>(numFound), "failed to release phys pages: %d", err);
+
+        done += batch;
+        remaining -= numFound;
+        __atomic_sub_fetch(&gPagesAllocated, numFound, __ATOMIC_RELAXED);
     }
 }
 
@@ -198,6 +838,31 @@ void *Kernel::Vm::VAlloc(const size_t length) {
     return PageAllocator::Alloc(length);
 }
 
+/**
+ * @brief Allocate contiguous virtual memory with a particular alignment
+ *
+ * @param length Number of bytes to allocate; rounded up to the nearest page size
+ * @param alignment Alignment of the starting address, in bytes; must be a power of two
+ *
+ * @return Start of virtual address space, or NULL on error
+ */
+void *Kernel::Vm::VAllocAligned(const size_t length, const size_t alignment) {
+    return PageAllocator::Alloc(length, alignment);
+}
+
+/**
+ * @brief Reserve contiguous virtual memory, which is backed by memory only once accessed
+ *
+ * @param length Number of bytes to reserve; rounded up to the nearest page size
+ *
+ * @return Start of virtual address space, or NULL on error. It reads as all zeroes.
+ *
+ * @remark The memory must not be accessed for the first time with interrupts disabled.
+ */
+void *Kernel::Vm::VAllocLazy(const size_t length) {
+    return PageAllocator::AllocLazy(length);
+}
+
 /**
  * @brief Free a range of virtual memory
  *
@@ -4,14 +4,30 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <Memory/PhysicalAllocator.h>
+#include <Runtime/Spinlock.h>
 #include <Vm/Alloc.h>
+#include <Vm/Types.h>
+#include <platform/PageTable.h>
 #include <platform/Processor.h>
 
 namespace Kernel::Vm {
+class Arena;
+
 /**
  * @brief Virtual page allocator
  *
  * This dude dispenses blocks of consecutive virtual address pages.
+ *
+ * Regular allocations are backed by physical memory right away. Lazy allocations only reserve
+ * address space: each page is backed the first time it's accessed, from the page fault handler.
+ * This suits large, sparsely used structures, which would otherwise tie up memory (and time
+ * spent building page tables) for pages that are never touched.
+ *
+ * Freed allocations are unmapped right away, but the TLB invalidation is deferred: their physical
+ * pages and address space are queued, and only recycled once a single TLB flush covering the
+ * entire queue has been performed. This happens when the queue fills up, or when FlushDeferred()
+ * is called. When physical memory runs low, the queued physical pages are released early.
  */
 class PageAllocator {
     public:
@@ -19,9 +35,18 @@ class PageAllocator {
         static int HandleFault(Platform::ProcessorState &state,
                 const uintptr_t address, const FaultAccessType access);
 
-        [[nodiscard]] static void *Alloc(const size_t length);
+        [[nodiscard]] static void *Alloc(const size_t length, const size_t alignment = 0);
+        [[nodiscard]] static void *AllocLazy(const size_t length, const size_t alignment = 0);
         static void Free(void *ptr, const size_t length);
 
+        static int GetCommitted(const void *ptr, size_t &outPages);
+
+        static void FlushDeferred();
+        static void DumpStats();
+
+        static bool MapPages(const uintptr_t virt, const size_t numPages);
+        static void UnmapPages(const uintptr_t virt, const size_t length);
+
     private:
         constexpr static const bool kLogAlloc{false};
         constexpr static const bool kLogFrees{false};
@@ -35,12 +60,120 @@ class PageAllocator {
         constexpr static const size_t kNumGuardPages{2};
 
         /**
-         * @brief Maximum number of pages that can be allocated in one call
+         * @brief Number of pages allocated (or freed) and mapped at a time
+         *
+         * Physical addresses for each batch are kept on the stack.
+         */
+        constexpr static const size_t kMapBatchPages{16};
+
+        /// Size of large pages, which are used to back suitably sized and aligned ranges
+        constexpr static const size_t kLargePageSize{Platform::PageTable::LargePageSize()};
+        /// Number of regular pages in a large page
+        constexpr static const size_t kPagesPerLargePage{kLargePageSize /
+            Platform::PageTable::PageSize()};
+
+        /**
+         * @brief Maximum number of lazy allocations that may exist at once
+         *
+         * Lazy allocations are meant for a few large structures, so a small table suffices.
+         */
+        constexpr static const size_t kMaxLazyRegions{64};
+
+        /**
+         * @brief A lazy allocation
+         *
+         * Describes an allocation whose pages are only backed by memory once accessed.
          */
-        constexpr static const size_t kMaxAllocPages{16};
+        struct LazyRegion {
+            /// Base address of the allocation
+            uintptr_t base;
+            /// Number of pages in the allocation (excluding guard pages)
+            size_t numPages;
+            /// Number of pages that are currently backed by memory
+            size_t committed;
+        };
 
-        static uintptr_t gAllocCursor;
+        /**
+         * @brief Maximum number of freed allocations whose release may be deferred
+         */
+        constexpr static const size_t kMaxDeferredRanges{32};
+        /**
+         * @brief Maximum number of physical pages whose release may be deferred
+         *
+         * Allocations with more pages than this are released (and flushed) immediately.
+         */
+        constexpr static const size_t kMaxDeferredPages{512};
+        /**
+         * @brief Number of deferred pages above which the entire TLB is flushed
+         *
+         * Below this, only the deferred ranges are invalidated, page by page.
+         */
+        constexpr static const size_t kFullFlushPages{64};
+
+        /**
+         * @brief A freed allocation awaiting a TLB flush
+         */
+        struct DeferredRange {
+            /// Base address of the allocation
+            uintptr_t base;
+            /// Length of the unmapped part of the allocation, in bytes
+            size_t length;
+            /// Length of the address space to release (including guard pages), in bytes
+            size_t reserved;
+        };
+
+        static bool MapLargePage(const uintptr_t virt);
+        static void ReleasePages(const uintptr_t virt, const size_t length,
+                const size_t numMapped);
+        static size_t UnmapDeferred(const uintptr_t virt, const size_t length,
+                const size_t numMapped, size_t &outLength);
+        static void FlushDeferredLocked();
+        static void ReleaseDeferredPagesLocked();
+        static void HandlePressure(const size_t pool, const PhysicalAllocator::Pressure level,
+                void *);
+
+        static LazyRegion *FindLazy(const uintptr_t address);
+        static int CommitLazy(const uintptr_t address);
+
+        static Arena *gArena;
         static size_t gPagesAllocated;
+
+        /// Protects the lazy allocation table
+        static Runtime::Spinlock gLazyLock;
+        /// Lazy allocations, sorted by base address
+        static LazyRegion gLazyRegions[kMaxLazyRegions];
+        /// Number of lazy allocations
+        static size_t gNumLazyRegions;
+
+        /// Protects the deferred free queue
+        static Runtime::Spinlock gDeferredLock;
+        /// Freed allocations awaiting a TLB flush
+        static DeferredRange gDeferredRanges[kMaxDeferredRanges];
+        /// Number of deferred allocations
+        static size_t gNumDeferredRanges;
+        /**
+         * @brief Number of deferred allocations whose TLB entries have already been invalidated
+         *
+         * These are always at the start of the queue, and their physical pages have been
+         * released; only their address space remains to be released.
+         */
+        static size_t gNumFlushedRanges;
+        /// Physical pages of the deferred allocations
+        static uint64_t gDeferredPages[kMaxDeferredPages];
+        /// Number of deferred physical pages
+        static size_t gNumDeferredPages;
+
+        /**
+         * @brief Number of TLB flushes performed when releasing pages
+         *
+         * Each flush of the deferred queue counts once, as does each batch (or large page)
+         * invalidated when pages are released immediately.
+         */
+        static size_t gTlbFlushes;
+        /// Number of TLB flushes saved by batching frees
+        static size_t gTlbFlushesAvoided;
+        /// Number of large pages currently mapped
+        static size_t gLargePages;
 };
 }
 
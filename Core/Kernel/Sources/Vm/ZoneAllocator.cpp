@@ -0,0 +1,131 @@
+#include "Vm/ZoneAllocator.h"
+
+#include "Logging/Console.h"
+#include "Smp/CpuLocals.h"
+
+#include <platform/ProcessorLocals.h>
+
+using namespace Kernel::Vm;
+
+bool ZoneAllocatorBase::gMagazinesEnabled{false};
+ZoneAllocatorBase *ZoneAllocatorBase::gZones{nullptr};
+Kernel::Runtime::Spinlock ZoneAllocatorBase::gZonesLock;
+
+/**
+ * @brief Initialize a zone and add it to the list of zones.
+ *
+ * @param name Name of the zone, used for statistics
+ */
+ZoneAllocatorBase::ZoneAllocatorBase(const char *name) : name(name) {
+    Runtime::SpinlockGuard guard(gZonesLock);
+
+    this->nextZone = gZones;
+    __atomic_store_n(&gZones, this, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Start using the per processor magazines of all zones.
+ *
+ * This must be called only once processor local storage has been set up on all processors that
+ * may allocate from zones, since the calling processor's index is read from there.
+ */
+void ZoneAllocatorBase::EnableMagazines() {
+    __atomic_store_n(&gMagazinesEnabled, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Shrink the empty region caches of all zones when memory runs low.
+ *
+ * This must be called once, after the physical allocator has been initialized.
+ */
+void ZoneAllocatorBase::EnablePressureHandler() {
+    const auto err = PhysicalAllocator::AddPressureHandler(&HandlePressure);
+    REQUIRE(!err, "failed to install zone pressure handler: %d", err);
+}
+
+/**
+ * @brief Pressure handler for all zones.
+ *
+ * Under pressure, each zone retires all of its empty regions (and keeps none around until the
+ * pressure subsides.) Since this may be invoked with arbitrary locks held, the memory of those
+ * regions is only released on the zone's next allocation or free, or by ReleaseRetired().
+ */
+void ZoneAllocatorBase::HandlePressure(const size_t, const PhysicalAllocator::Pressure level,
+        void *) {
+    for(auto zone = __atomic_load_n(&gZones, __ATOMIC_ACQUIRE); zone; zone = zone->nextZone) {
+        zone->trim(level != PhysicalAllocator::kPressureNone);
+    }
+}
+
+/**
+ * @brief Release the memory of regions that all zones retired under memory pressure.
+ *
+ * This should be called periodically (for example, when the system is idle) so that zones that
+ * aren't used anymore give back their retired regions.
+ */
+void ZoneAllocatorBase::ReleaseRetired() {
+    for(auto zone = __atomic_load_n(&gZones, __ATOMIC_ACQUIRE); zone; zone = zone->nextZone) {
+        zone->releaseRetired();
+    }
+}
+
+/**
+ * @brief Get the calling processor's magazine in a zone.
+ *
+ * @return Magazine to use, or `nullptr` if magazines aren't enabled yet, or the processor has
+ *         none; in that case, the zone's regions must be accessed directly.
+ */
+ZoneAllocatorBase::Magazine *ZoneAllocatorBase::GetMagazine(ZoneAllocatorBase *zone) {
+    if(!__atomic_load_n(&gMagazinesEnabled, __ATOMIC_RELAXED)) return nullptr;
+
+    const auto cpu = Platform::ProcessorLocals::GetKernelData()->cpuId;
+    if(cpu >= kMaxProcessors) return nullptr;
+
+    return &zone->magazines[cpu];
+}
+
+/**
+ * @brief Read the magazine counters of this zone, summed over all processors.
+ *
+ * @param outHits Number of allocations satisfied from a magazine
+ * @param outMisses Number of allocations that had to refill a magazine
+ */
+void ZoneAllocatorBase::getMagazineStats(size_t &outHits, size_t &outMisses) const {
+    size_t hits{0}, misses{0};
+
+    for(const auto &mag : this->magazines) {
+        hits += __atomic_load_n(&mag.hits, __ATOMIC_RELAXED);
+        misses += __atomic_load_n(&mag.misses, __ATOMIC_RELAXED);
+    }
+
+    outHits = hits;
+    outMisses = misses;
+}
+
+/**
+ * @brief Write the statistics of all zones to the console.
+ *
+ * For each zone, this prints the number of regions and allocated objects along with their
+ * high-water marks, how many regions were released, and how many allocations were satisfied from
+ * a magazine versus how many had to refill one.
+ */
+void ZoneAllocatorBase::DumpStats() {
+    for(auto zone = __atomic_load_n(&gZones, __ATOMIC_ACQUIRE); zone; zone = zone->nextZone) {
+        size_t hits, misses;
+        zone->getMagazineStats(hits, misses);
+
+        const auto total = hits + misses;
+        const auto rate = total ? ((hits * 10000) / total) : 0;
+
+        Console::Notice("Zone %s: %zu regions (peak %zu, %zu empty, %zu released), "
+                "%zu objects (peak %zu)", zone->name,
+                __atomic_load_n(&zone->numRegions, __ATOMIC_RELAXED),
+                __atomic_load_n(&zone->peakRegions, __ATOMIC_RELAXED),
+                __atomic_load_n(&zone->numEmptyRegions, __ATOMIC_RELAXED),
+                __atomic_load_n(&zone->regionsReleased, __ATOMIC_RELAXED),
+                __atomic_load_n(&zone->numObjects, __ATOMIC_RELAXED),
+                __atomic_load_n(&zone->peakObjects, __ATOMIC_RELAXED));
+        Console::Notice("  magazines: %zu hits, %zu misses (%zu.%02zu%% hit rate)", hits, misses,
+                rate / 100, rate % 100);
+    }
+}